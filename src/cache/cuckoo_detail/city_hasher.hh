@@ -1,3 +1,9 @@
+#include <cstring>
+#include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
 #include "city.h"
 
 /*! CityHasher is a std::hash-style wrapper around CityHash. We
@@ -12,11 +18,27 @@ public:
 };
 
 /*! This is a template specialization of CityHasher for
- *  std::string. */
+ *  std::string. It is transparent: C strings and, with C++17,
+ *  std::string_view hash to the same value as the equivalent
+ *  std::string, so a table using it together with a transparent
+ *  equality predicate (std::equal_to<>) can be searched without
+ *  materializing a std::string. */
 template <>
 class CityHasher<std::string> {
 public:
+    typedef void is_transparent;
+
     size_t operator()(const std::string& k) const {
         return CityHash64(k.c_str(), k.size());
     }
+
+    size_t operator()(const char* k) const {
+        return CityHash64(k, strlen(k));
+    }
+
+#if __cplusplus >= 201703L
+    size_t operator()(std::string_view k) const {
+        return CityHash64(k.data(), k.size());
+    }
+#endif
 };
@@ -3,9 +3,24 @@
 #ifndef _CUCKOOHASH_CONFIG_H
 #define _CUCKOOHASH_CONFIG_H
 
-//! SLOT_PER_BUCKET is the maximum number of keys per bucket
+#include <cstddef>
+
+//! SLOT_PER_BUCKET is the number of slots per bucket DEFAULT_SIZE is
+//! measured in. Each table has its own number of slots per bucket, see
+//! cuckoo_default_slot_per_bucket.
 const size_t SLOT_PER_BUCKET = 8;
 
+//! cuckoo_default_slot_per_bucket returns the default number of slots per
+//! bucket of a table whose keys and values take \p kv_size bytes together:
+//! the largest of 16, 8 and 4 slots whose keys and values fit in two 64-byte
+//! cache lines, or 4 if none does.
+constexpr size_t cuckoo_default_slot_per_bucket(size_t kv_size) {
+    return kv_size * 16 <= 128 ? 16 : kv_size * 8 <= 128 ? 8 : 4;
+}
+
+//! DEFAULT_NUM_LOCKS is the default number of lock stripes of a table
+const size_t DEFAULT_NUM_LOCKS = 1 << 13;
+
 //! DEFAULT_SIZE is the default number of elements in an empty hash
 //! table
 const size_t DEFAULT_SIZE = (1U << 16) * SLOT_PER_BUCKET;
@@ -13,4 +28,11 @@ const size_t DEFAULT_SIZE = (1U << 16) * SLOT_PER_BUCKET;
 //! set LIBCUCKOO_DEBUG to 1 to enable debug output
 #define LIBCUCKOO_DEBUG 0
 
+//! set LIBCUCKOO_STATS to 1 to collect the cuckoo displacement statistics
+//! returned by cuckoohash_map::displacement_stats. When it is 0 they aren't
+//! collected at all.
+#ifndef LIBCUCKOO_STATS
+#define LIBCUCKOO_STATS 0
+#endif
+
 #endif
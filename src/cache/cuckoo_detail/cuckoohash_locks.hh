@@ -0,0 +1,271 @@
+/*! \file */
+
+#ifndef _CUCKOOHASH_LOCKS_HH
+#define _CUCKOOHASH_LOCKS_HH
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// These are the lock policies cuckoohash_map can use for its lock stripes.
+// A policy has to provide lock(), unlock() and try_lock(), and a stats()
+// method returning a cuckoo_lock_stats. Every policy counts contention only
+// on its slow path, and the counters are written by the thread that has just
+// acquired the lock, so the uncontended path never touches them.
+
+//! cuckoo_lock_stats reports how often a lock, or the sum of all the lock
+//! stripes of a table, was contended.
+struct cuckoo_lock_stats {
+    //! Number of acquisitions that could not take the lock right away.
+    size_t contended = 0;
+    //! Number of busy-wait rounds spent waiting for the lock.
+    size_t spins = 0;
+    //! Number of times a waiter gave up the CPU (yield or futex wait).
+    size_t sleeps = 0;
+
+    cuckoo_lock_stats& operator+=(const cuckoo_lock_stats& other) {
+        contended += other.contended;
+        spins += other.spins;
+        sleeps += other.sleeps;
+        return *this;
+    }
+};
+
+// cuckoo_cpu_relax tells the CPU we are busy-waiting. On x86 the pause
+// instruction keeps a spinning hyperthread from starving its sibling and
+// avoids the memory-order mis-speculation penalty when the lock is released.
+static inline void cuckoo_cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// cuckoo_lock_counters holds the contention counters of one lock. Only the
+// lock holder writes them, so they are updated with relaxed loads and stores
+// instead of read-modify-write instructions.
+class cuckoo_lock_counters {
+    std::atomic<size_t> contended_;
+    std::atomic<size_t> spins_;
+    std::atomic<size_t> sleeps_;
+
+    static void add(std::atomic<size_t>& c, size_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+    }
+
+public:
+    cuckoo_lock_counters() : contended_(0), spins_(0), sleeps_(0) {}
+
+    void record(size_t spins, size_t sleeps) {
+        add(contended_, 1);
+        add(spins_, spins);
+        add(sleeps_, sleeps);
+    }
+
+    cuckoo_lock_stats stats() const {
+        cuckoo_lock_stats st;
+        st.contended = contended_.load(std::memory_order_relaxed);
+        st.spins = spins_.load(std::memory_order_relaxed);
+        st.sleeps = sleeps_.load(std::memory_order_relaxed);
+        return st;
+    }
+};
+
+//! cuckoo_spinlock is the original test-and-set spinlock. It spins on the
+//! atomic exchange itself, so every waiter keeps the cache line bouncing
+//! between cores. It is kept as a baseline for comparison.
+class cuckoo_spinlock {
+    std::atomic_flag lock_;
+    cuckoo_lock_counters counters_;
+
+public:
+    cuckoo_spinlock() {
+        lock_.clear();
+    }
+
+    inline void lock() {
+        if (!lock_.test_and_set(std::memory_order_acquire)) {
+            return;
+        }
+        size_t spins = 1;
+        while (lock_.test_and_set(std::memory_order_acquire)) {
+            ++spins;
+        }
+        counters_.record(spins, 0);
+    }
+
+    inline void unlock() {
+        lock_.clear(std::memory_order_release);
+    }
+
+    inline bool try_lock() {
+        return !lock_.test_and_set(std::memory_order_acquire);
+    }
+
+    cuckoo_lock_stats stats() const {
+        return counters_.stats();
+    }
+} __attribute__((aligned(64)));
+
+//! cuckoo_backoff_spinlock is a test-and-test-and-set spinlock. Waiters spin
+//! on a plain load, which stays in their own cache, and back off
+//! exponentially with pause instructions between attempts. Once the backoff
+//! reaches its cap the waiter yields its CPU on every round, so a lock holder
+//! that was preempted can run again when there are more threads than cores.
+class cuckoo_backoff_spinlock {
+    std::atomic<bool> lock_;
+    cuckoo_lock_counters counters_;
+
+    // Upper bound on the number of pause instructions between two attempts
+    static const size_t kMaxBackoff = 1 << 10;
+
+    void lock_slow() {
+        size_t backoff = 1;
+        size_t spins = 0;
+        size_t sleeps = 0;
+        do {
+            while (lock_.load(std::memory_order_relaxed)) {
+                ++spins;
+                if (backoff < kMaxBackoff) {
+                    for (size_t i = 0; i < backoff; ++i) {
+                        cuckoo_cpu_relax();
+                    }
+                    backoff <<= 1;
+                } else {
+                    ++sleeps;
+                    std::this_thread::yield();
+                }
+            }
+        } while (lock_.exchange(true, std::memory_order_acquire));
+        counters_.record(spins, sleeps);
+    }
+
+public:
+    cuckoo_backoff_spinlock() : lock_(false) {}
+
+    inline void lock() {
+        if (!lock_.exchange(true, std::memory_order_acquire)) {
+            return;
+        }
+        lock_slow();
+    }
+
+    inline void unlock() {
+        lock_.store(false, std::memory_order_release);
+    }
+
+    inline bool try_lock() {
+        return !lock_.load(std::memory_order_relaxed) &&
+            !lock_.exchange(true, std::memory_order_acquire);
+    }
+
+    cuckoo_lock_stats stats() const {
+        return counters_.stats();
+    }
+} __attribute__((aligned(64)));
+
+//! cuckoo_adaptive_lock spins for a short while, like
+//! cuckoo_backoff_spinlock, and then puts the waiter to sleep on a futex
+//! until the holder wakes it up. Its state is 0 when unlocked, 1 when locked
+//! and 2 when locked with possible sleepers, so an uncontended unlock never
+//! makes a system call. On platforms without futexes, sleeping falls back to
+//! yielding.
+class cuckoo_adaptive_lock {
+    std::atomic<int> state_;
+    cuckoo_lock_counters counters_;
+
+    // Number of spin rounds before a waiter goes to sleep
+    static const size_t kSpinLimit = 64;
+
+    void futex_wait(int expected) {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int*>(&state_), FUTEX_WAIT_PRIVATE,
+                expected, nullptr, nullptr, 0);
+#else
+        (void)expected;
+        std::this_thread::yield();
+#endif
+    }
+
+    void futex_wake() {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int*>(&state_), FUTEX_WAKE_PRIVATE,
+                1, nullptr, nullptr, 0);
+#endif
+    }
+
+    void lock_slow() {
+        size_t spins = 0;
+        size_t sleeps = 0;
+        size_t backoff = 1;
+        int c = 0;
+        for (; spins < kSpinLimit; ++spins) {
+            c = state_.load(std::memory_order_relaxed);
+            if (c == 0 && state_.compare_exchange_weak(
+                    c, 1, std::memory_order_acquire,
+                    std::memory_order_relaxed)) {
+                counters_.record(spins, sleeps);
+                return;
+            }
+            if (c == 2) {
+                // Somebody is already sleeping, so spinning further is
+                // unlikely to pay off
+                break;
+            }
+            for (size_t i = 0; i < backoff; ++i) {
+                cuckoo_cpu_relax();
+            }
+            backoff <<= (backoff < 64);
+        }
+        // Mark the lock as contended before sleeping, so the holder knows it
+        // has to wake us up.
+        c = state_.exchange(2, std::memory_order_acquire);
+        while (c != 0) {
+            ++sleeps;
+            futex_wait(2);
+            c = state_.exchange(2, std::memory_order_acquire);
+        }
+        counters_.record(spins, sleeps);
+    }
+
+public:
+    cuckoo_adaptive_lock() : state_(0) {}
+
+    inline void lock() {
+        int c = 0;
+        if (state_.compare_exchange_strong(c, 1, std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+            return;
+        }
+        lock_slow();
+    }
+
+    inline void unlock() {
+        if (state_.exchange(0, std::memory_order_release) == 2) {
+            futex_wake();
+        }
+    }
+
+    inline bool try_lock() {
+        int c = 0;
+        return state_.compare_exchange_strong(c, 1, std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+    }
+
+    cuckoo_lock_stats stats() const {
+        return counters_.stats();
+    }
+} __attribute__((aligned(64)));
+
+#endif
@@ -8,27 +8,101 @@
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <functional>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
 #include <thread>
 #include <tuple>
 #include <type_traits>
+#include <typeinfo>
 #include <unistd.h>
 #include <utility>
 #include <vector>
 
 #include "cuckoohash_config.h"
+#include "cuckoohash_locks.hh"
 #include "cuckoohash_util.h"
 
-//! cuckoohash_map is the hash table class.
+//! cuckoo_expiry_stats reports how a table with expiring entries reclaimed
+//! them.
+struct cuckoo_expiry_stats {
+    //! Number of expired entries reclaimed by the operations that ran into
+    //! them.
+    size_t lazy_expired = 0;
+    //! Number of expired entries reclaimed by sweep_expired.
+    size_t swept_expired = 0;
+    //! Number of sweep_expired calls.
+    size_t sweep_ticks = 0;
+    //! Number of buckets sweep_expired has looked at.
+    size_t buckets_swept = 0;
+    //! Duration of the last sweep_expired call, in nanoseconds.
+    uint64_t last_tick_ns = 0;
+    //! Duration of the longest sweep_expired call, in nanoseconds.
+    uint64_t max_tick_ns = 0;
+};
+
+//! cuckoo_displacement_stats reports how inserts found room in a table by
+//! moving elements along cuckoo paths, and how often the table had to be
+//! resized. The counters are only collected if LIBCUCKOO_STATS is set, and
+//! are all zero otherwise.
+struct cuckoo_displacement_stats {
+    //! Number of cuckoo path searches, run by inserts that found both of
+    //! their buckets full.
+    size_t searches = 0;
+    //! path_length[n] is the number of searches that found a path of n
+    //! moves.
+    std::vector<size_t> path_length;
+    //! Number of searches that found no path short enough.
+    size_t search_failures = 0;
+    //! Number of paths that changed before they could be moved along, so
+    //! the insert had to search again.
+    size_t move_retries = 0;
+    //! Number of inserts that found the table full and expanded it.
+    size_t table_full = 0;
+    //! Number of times the table was resized.
+    size_t resizes = 0;
+    //! Total and longest time spent resizing the table, in nanoseconds.
+    uint64_t resize_ns = 0;
+    uint64_t max_resize_ns = 0;
+    //! Number of bytes of keys and values copied into resized tables.
+    size_t bytes_moved = 0;
+    //! Contention on the lock stripes of the current table, as returned by
+    //! cuckoohash_map::lock_stats.
+    cuckoo_lock_stats locks;
+};
+
+//! cuckoohash_map is the hash table class. \p Lock is the type of lock
+//! guarding each lock stripe; see cuckoohash_locks.hh for the available
+//! policies. If \p WithExpiry is true, every slot also stores an expiry
+//! deadline, and entries can be given a time to live. \p SlotPerBucket is
+//! the number of slots in each bucket, which defaults to what fits the keys
+//! and values of a bucket in two cache lines, see
+//! cuckoo_default_slot_per_bucket. \p NumLocks is the number of lock
+//! stripes, a power of two. If \p StoreHash is true, every slot also stores
+//! the full hash of its key, so moving elements around and growing the table
+//! never hash keys again, which pays off for keys that are expensive to hash,
+//! like long strings.
 template <class Key, class T, class Hash = std::hash<Key>,
-          class Pred = std::equal_to<Key> >
+          class Pred = std::equal_to<Key>,
+          class Lock = cuckoo_backoff_spinlock,
+          bool WithExpiry = false,
+          size_t SlotPerBucket =
+              cuckoo_default_slot_per_bucket(sizeof(Key) + sizeof(T)),
+          size_t NumLocks = DEFAULT_NUM_LOCKS,
+          bool StoreHash = false>
 class cuckoohash_map {
 public:
     //! key_type is the type of keys.
@@ -41,6 +115,8 @@ public:
     typedef Hash              hasher;
     //! key_equal is the type of the equality predicate.
     typedef Pred              key_equal;
+    //! lock_type is the type of the lock guarding each lock stripe.
+    typedef Lock              lock_type;
 
     //! Class returned by operator[] which wraps an entry in the hash table.
     //! Note that this reference type behave somewhat differently from an STL
@@ -114,41 +190,66 @@ private:
     static const bool is_simple =
         std::is_pod<key_type>::value && sizeof(key_type) <= 8;
 
+    // true if both the hasher and the key equality predicate declare
+    // is_transparent, which enables the heterogeneous lookup overloads
+    static const bool is_transparent =
+        cuckoo_is_transparent<hasher>::value &&
+        cuckoo_is_transparent<key_equal>::value;
+
+    // enable_if_lookup_key<K, R> is R if K can be used to look up keys
+    // without converting it to key_type first.
+    template <class K, class R>
+    using enable_if_lookup_key = typename std::enable_if<
+        is_transparent &&
+        !std::is_same<typename std::decay<K>::type, key_type>::value,
+        R>::type;
+
     // number of locks in the locks_ array
-    static const size_t kNumLocks = 1 << 13;
+    static const size_t kNumLocks = NumLocks;
+
+    static_assert(SlotPerBucket > 0, "buckets must have at least one slot");
+    static_assert(NumLocks > 0 && (NumLocks & (NumLocks - 1)) == 0,
+                  "the number of locks must be a power of two");
 
     // number of cores on the machine
     static const size_t kNumCores;
 
-    // The maximum number of cuckoo operations per insert. This must be less
-    // than or equal to SLOT_PER_BUCKET^(MAX_BFS_DEPTH+1)
+    // The maximum number of cuckoo operations per insert. With fewer than 8
+    // slots per bucket, the search runs out of paths before that.
     static const size_t MAX_CUCKOO_COUNT = 500;
 
     // The maximum depth of a BFS path
     static const size_t MAX_BFS_DEPTH = 4;
 
-    // Structs and functions used internally
-    class spinlock {
-        std::atomic_flag lock_;
-    public:
-        spinlock() {
-            lock_.clear();
-        }
+    // Each core checks whether the table should shrink automatically once
+    // every this many deletes. It must be a power of two.
+    static const size_t kShrinkCheckInterval = 1 << 10;
 
-        inline void lock() {
-            while (lock_.test_and_set(std::memory_order_acquire));
-        }
+    // The number of times shrink_to_fit retries freeing the old table while
+    // other threads still use it
+    static const size_t kShrinkFreeRetries = 1000;
 
-        inline void unlock() {
-            lock_.clear(std::memory_order_release);
-        }
+    // The number of consecutive checks that must find the load factor below
+    // the automatic shrink threshold before the table shrinks
+    static const size_t kShrinkVotes = 2;
 
-        inline bool try_lock() {
-            return !lock_.test_and_set(std::memory_order_acquire);
-        }
+    // log2 of the number of bucket groups bulk_load splits the table in, see
+    // bulk_place_all
+    static const size_t kBulkGroupBits = 12;
 
-    } __attribute__((aligned(64)));
+    // The dump file format version, see dump. It changes whenever the
+    // header or the bucket layout does.
+    static const uint32_t kDumpVersion = 1;
+
+    // The size of the dump file header. The buckets follow it, so it is a
+    // multiple of the page size, which lets load map them in place.
+    static const size_t kDumpHeaderSize = 4096;
 
+    // The maximum number of sample keys, and their hashes, a dump stores to
+    // check that the hash function that loads it is the same
+    static const size_t kDumpMaxSamples = 16;
+
+    // Structs and functions used internally
     typedef enum {
         ok = 0,
         failure = 1,
@@ -166,7 +267,7 @@ private:
     // bucket will derive the correct class depending on whether the type is
     // simple or not.
     class RealPartialContainer {
-        std::array<partial_t, SLOT_PER_BUCKET> partials_;
+        std::array<partial_t, SlotPerBucket> partials_;
     public:
         const partial_t& partial(int ind) const {
             return partials_[ind];
@@ -190,26 +291,104 @@ private:
         }
     };
 
-    // The Bucket type holds SLOT_PER_BUCKET keys and values, and a occupied
+    // Two expiry deadline containers, one for tables with expiring entries and
+    // one that never expires anything, so tables without expiry don't pay for
+    // the deadlines. A deadline is a cuckoo_now_ms time, or 0 for entries
+    // that never expire.
+    class RealExpiryContainer {
+        std::array<uint64_t, SlotPerBucket> deadlines_;
+    public:
+        uint64_t deadline(int ind) const {
+            return deadlines_[ind];
+        }
+        void set_deadline(int ind, uint64_t deadline) {
+            deadlines_[ind] = deadline;
+        }
+    };
+
+    class FakeExpiryContainer {
+    public:
+        uint64_t deadline(int) const {
+            return 0;
+        }
+        void set_deadline(int, uint64_t) {}
+    };
+
+    // Two hash containers, one for tables that store the full hash of every
+    // key in its slot and one for those that hash keys again whenever they
+    // need it, see slot_hash.
+    class RealHashContainer {
+        std::array<size_t, SlotPerBucket> hashes_;
+    public:
+        size_t hash(int ind) const {
+            return hashes_[ind];
+        }
+        void set_hash(int ind, size_t hv) {
+            hashes_[ind] = hv;
+        }
+    };
+
+    class FakeHashContainer {
+    public:
+        // hash should never be called, so we raise an exception if it is.
+        size_t hash(int) const {
+            throw std::logic_error(
+                "FakeHashContainer::hash should never be called");
+        }
+        void set_hash(int, size_t) {}
+    };
+
+    // The Bucket type holds SlotPerBucket keys and values, and a occupied
     // bitset, which indicates whether the slot at the given bit index is in
     // the table or not. It uses aligned_storage arrays to store the keys and
     // values to allow constructing and destroying key-value pairs in place.
+    // The referenced bitset holds the CLOCK reference bit of each slot, which
+    // lookups set and eviction clears, both only in cache mode. It is
+    // mutable, since lookups only hold the bucket lock through a const
+    // table. The scanned bitset marks the elements a weak scan has already
+    // visited in an older version of the table, see for_each_weak.
     class Bucket : public std::conditional<is_simple, FakePartialContainer,
-                                           RealPartialContainer>::type {
+                                           RealPartialContainer>::type,
+                   public std::conditional<WithExpiry, RealExpiryContainer,
+                                           FakeExpiryContainer>::type,
+                   public std::conditional<StoreHash, RealHashContainer,
+                                           FakeHashContainer>::type {
     private:
         std::array<typename std::aligned_storage<
                        sizeof(key_type), alignof(key_type)>::type,
-                   SLOT_PER_BUCKET> keys_;
+                   SlotPerBucket> keys_;
         std::array<typename std::aligned_storage<
                        sizeof(mapped_type), alignof(mapped_type)>::type,
-                   SLOT_PER_BUCKET> vals_;
-        std::bitset<SLOT_PER_BUCKET> occupied_;
+                   SlotPerBucket> vals_;
+        std::bitset<SlotPerBucket> occupied_;
+        mutable std::bitset<SlotPerBucket> referenced_;
+        std::bitset<SlotPerBucket> scanned_;
 
     public:
         bool occupied(int ind) const {
             return occupied_.test(ind);
         }
 
+        bool referenced(int ind) const {
+            return referenced_.test(ind);
+        }
+
+        void touch(int ind) const {
+            referenced_.set(ind);
+        }
+
+        void clear_referenced(int ind) {
+            referenced_.reset(ind);
+        }
+
+        bool scanned(int ind) const {
+            return scanned_.test(ind);
+        }
+
+        void set_scanned(int ind, bool scanned) {
+            scanned_.set(ind, scanned);
+        }
+
         const key_type& key(int ind) const {
             return *static_cast<const key_type*>(
                 static_cast<const void*>(&keys_[ind]));
@@ -236,16 +415,20 @@ private:
 
         void eraseKV(size_t pos) {
             occupied_.reset(pos);
+            referenced_.reset(pos);
+            scanned_.reset(pos);
             (&key(pos))->~key_type();
             (&val(pos))->~mapped_type();
         }
 
         Bucket() {
             occupied_.reset();
+            referenced_.reset();
+            scanned_.reset();
         }
 
         ~Bucket() {
-            for (size_t i = 0; i < SLOT_PER_BUCKET; ++i) {
+            for (size_t i = 0; i < SlotPerBucket; ++i) {
                 if (occupied(i)) {
                     eraseKV(i);
                 }
@@ -253,6 +436,65 @@ private:
         }
     };
 
+    // bucket_container holds the buckets of a table, either in memory of its
+    // own or in a private, copy-on-write mapping of a dump file, see load.
+    // Mapped buckets are used as the dump wrote them, so their constructors
+    // and destructors never run, which is why dumps are only supported for
+    // trivially copyable keys and values.
+    class bucket_container {
+        Bucket* buckets_;
+        size_t size_;
+        void* map_;
+        size_t map_len_;
+
+        void release() {
+            if (map_ != nullptr) {
+                munmap(map_, map_len_);
+                map_ = nullptr;
+            } else {
+                delete[] buckets_;
+            }
+            buckets_ = nullptr;
+        }
+
+    public:
+        explicit bucket_container(size_t n)
+            : buckets_(new Bucket[n]), size_(n), map_(nullptr), map_len_(0) {}
+
+        // This constructor takes ownership of the map_len bytes long mapping
+        // map, whose n buckets start offset bytes in.
+        bucket_container(size_t n, void* map, size_t map_len, size_t offset)
+            : buckets_(static_cast<Bucket*>(static_cast<void*>(
+                           static_cast<char*>(map) + offset))),
+              size_(n), map_(map), map_len_(map_len) {}
+
+        bucket_container(const bucket_container&) = delete;
+        bucket_container& operator=(const bucket_container&) = delete;
+
+        ~bucket_container() {
+            release();
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        Bucket& operator[](size_t i) {
+            return buckets_[i];
+        }
+
+        const Bucket& operator[](size_t i) const {
+            return buckets_[i];
+        }
+
+        // reset empties all the buckets, replacing a mapping with memory of
+        // the container's own.
+        void reset() {
+            release();
+            buckets_ = new Bucket[size_];
+        }
+    };
+
     // cacheint is a cache-aligned atomic integer type.
     struct cacheint {
         std::atomic<size_t> num;
@@ -261,8 +503,31 @@ private:
         cacheint(cacheint&& x): num(x.num.load()) {}
     } __attribute__((aligned(64)));
 
+#if LIBCUCKOO_STATS
+    // DisplacementCounters holds the displacement statistics of the threads
+    // whose counterid it is, see displacement_stats.
+    struct DisplacementCounters {
+        std::atomic<size_t> searches, search_failures, move_retries,
+            table_full;
+        std::array<std::atomic<size_t>, MAX_BFS_DEPTH + 1> path_length;
+        DisplacementCounters()
+            : searches(0), search_failures(0), move_retries(0),
+              table_full(0) {
+            for (auto& n : path_length) {
+                n.store(0);
+            }
+        }
+    } __attribute__((aligned(64)));
+
+    // stat_add adds n to a statistic counter. Each counter is mostly written
+    // by one thread, so a relaxed add is enough.
+    static void stat_add(std::atomic<size_t>& c, size_t n = 1) {
+        c.fetch_add(n, std::memory_order_relaxed);
+    }
+#endif
+
     // An alias for the type of lock we are using
-    typedef spinlock locktype;
+    typedef lock_type locktype;
 
     // TableInfo contains the entire state of the hashtable. We allocate one
     // TableInfo pointer per hash table and store all of the table memory in it,
@@ -271,8 +536,8 @@ private:
         // 2**hashpower is the number of buckets
         size_t hashpower_;
 
-        // vector of buckets
-        std::vector<Bucket> buckets_;
+        // array of buckets
+        bucket_container buckets_;
 
         // array of locks
         std::array<locktype, kNumLocks> locks_;
@@ -280,11 +545,31 @@ private:
         // per-core counters for the number of inserts and deletes
         std::vector<cacheint> num_inserts, num_deletes;
 
+        // per-core counters for the number of expired elements that
+        // operations reclaimed lazily. They are counted in num_deletes too.
+        std::vector<cacheint> num_expired;
+
+        // weak scan state, see for_each_weak. scanning is set while a scan
+        // runs, and scan_frontier is the number of lock stripes it has
+        // visited. Both only change while the scan holds the lock of the
+        // stripe it is visiting.
+        std::atomic<bool> scanning;
+        std::atomic<size_t> scan_frontier;
+
         // The constructor allocates the memory for the table. It allocates one
-        // cacheint for each core in num_inserts and num_deletes.
+        // cacheint for each core in num_inserts, num_deletes and num_expired.
         TableInfo(const size_t hashpower)
             : hashpower_(hashpower), buckets_(hashsize(hashpower_)),
-              num_inserts(kNumCores), num_deletes(kNumCores) {}
+              num_inserts(kNumCores), num_deletes(kNumCores),
+              num_expired(kNumCores), scanning(false), scan_frontier(0) {}
+
+        // This constructor uses the buckets of a dump file mapped at map, see
+        // load.
+        TableInfo(const size_t hashpower, void* map, size_t map_len)
+            : hashpower_(hashpower),
+              buckets_(hashsize(hashpower_), map, map_len, kDumpHeaderSize),
+              num_inserts(kNumCores), num_deletes(kNumCores),
+              num_expired(kNumCores), scanning(false), scan_frontier(0) {}
 
         ~TableInfo() {}
     };
@@ -370,21 +655,66 @@ private:
     // reserve_calc takes in a parameter specifying a certain number of slots
     // for a table and returns the smallest hashpower that will hold n elements.
     static size_t reserve_calc(size_t n) {
-        double nhd = ceil(log2((double)n / (double)SLOT_PER_BUCKET));
+        double nhd = ceil(log2((double)n / (double)SlotPerBucket));
         size_t new_hashpower = (size_t) (nhd <= 0 ? 1.0 : nhd);
-        assert(n <= hashsize(new_hashpower) * SLOT_PER_BUCKET);
+        assert(n <= hashsize(new_hashpower) * SlotPerBucket);
         return new_hashpower;
     }
 
+    // shrink_calc returns the hashpower a table holding n elements shrinks
+    // to: the smallest one that keeps the load factor at most 3/4, which
+    // leaves the inserts that follow a shrink room before the table has to
+    // grow again.
+    static size_t shrink_calc(size_t n) {
+        return reserve_calc(n + n / 3);
+    }
+
+    // cuckoo_now_ms returns the current time of the steady clock in
+    // milliseconds, which is what expiry deadlines are measured in.
+    static uint64_t cuckoo_now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // deadline_after returns the deadline of an entry inserted now with the
+    // given time to live. It is never 0, which would mean no expiry.
+    static uint64_t deadline_after(std::chrono::milliseconds ttl) {
+        const int64_t ms = std::max<int64_t>(ttl.count(), 0);
+        return std::max<uint64_t>(cuckoo_now_ms() + ms, 1);
+    }
+
 public:
     //! The constructor creates a new hash table with enough space for \p n
     //! elements. If the constructor fails, it will throw an exception.
-    explicit cuckoohash_map(size_t n = DEFAULT_SIZE) {
-        cuckoo_init(reserve_calc(n));
+    explicit cuckoohash_map(size_t n = DEFAULT_SIZE)
+        : cache_mode_(false), num_evictions_(0), sweep_cursor_(0),
+          swept_expired_(0), sweep_ticks_(0), buckets_swept_(0),
+          last_tick_ns_(0), max_tick_ns_(0), lazy_expired_carry_(0),
+          sweeper_stop_(false), auto_shrink_load_(0), shrink_votes_(0) {
+#if LIBCUCKOO_STATS
+        displacement_.reset(new DisplacementCounters[kNumCores]);
+        resizes_.store(0);
+        resize_ns_.store(0);
+        max_resize_ns_.store(0);
+        bytes_moved_.store(0);
+#endif
+        min_hashpower_ = reserve_calc(n);
+        cuckoo_init(min_hashpower_);
     }
 
-    //! The destructor explicitly deletes the current table info.
+    //! This constructor creates a hash table with enough space for the
+    //! key-value pairs in [\p first, \p last), and fills it with them using
+    //! \ref bulk_load.
+    template <class RandomIt>
+    cuckoohash_map(RandomIt first, RandomIt last)
+        : cuckoohash_map(static_cast<size_t>(last - first)) {
+        bulk_load(first, last);
+    }
+
+    //! The destructor stops the sweeper thread, if it is running, and
+    //! explicitly deletes the current table info.
     ~cuckoohash_map() {
+        stop_sweeper();
         TableInfo* ti = table_info.load();
         if (ti != nullptr) {
             delete ti;
@@ -428,6 +758,11 @@ public:
         return hashpower;
     }
 
+    //! slot_per_bucket returns the number of slots in each bucket.
+    static constexpr size_t slot_per_bucket() {
+        return SlotPerBucket;
+    }
+
     //! bucket_count returns the number of buckets in the table.
     size_t bucket_count() const {
         check_hazard_pointer();
@@ -449,16 +784,47 @@ public:
     //! find searches through the table for \p key, and stores the associated
     //! value it finds in \p val.
     bool find(const key_type& key, mapped_type& val) const {
-        check_hazard_pointer();
-        size_t hv = hashed_key(key);
-        TableInfo* ti;
-        size_t i1, i2;
-        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
-        HazardPointerUnsetter hpu;
+        return find_key(key, val);
+    }
 
-        const cuckoo_status st = cuckoo_find(key, val, hv, ti, i1, i2);
-        unlock_two(ti, i1, i2);
-        return (st == ok);
+    //! This overload of find is only available when both \p Hash and \p
+    //! Pred are transparent. It searches the table for a key equal to \p key
+    //! (for example a \p std::string_view over a receive buffer) without
+    //! constructing a \p key_type.
+    template <class K>
+    enable_if_lookup_key<K, bool> find(const K& key, mapped_type& val) const {
+        return find_key(key, val);
+    }
+
+    //! find_fn searches through the table for \p key, and if it finds it,
+    //! runs \p fn on a const reference to the stored value, without copying
+    //! it out. \p fn runs while the bucket locks are held, so it should be
+    //! short (for example, serializing the value into an output buffer) and
+    //! must not call back into the table. If \p key is not there, it returns
+    //! false without running \p fn, otherwise it returns true.
+    template <typename Reader>
+    bool find_fn(const key_type& key, Reader fn) const {
+        return find_fn_key(key, fn);
+    }
+
+    //! The heterogeneous counterpart of find_fn, available when \p Hash and
+    //! \p Pred are transparent.
+    template <class K, typename Reader>
+    enable_if_lookup_key<K, bool> find_fn(const K& key, Reader fn) const {
+        return find_fn_key(key, fn);
+    }
+
+    //! contains returns true if \p key is in the table. It never touches the
+    //! stored value.
+    bool contains(const key_type& key) const {
+        return find_fn_key(key, [](const mapped_type&) {});
+    }
+
+    //! The heterogeneous counterpart of contains, available when \p Hash and
+    //! \p Pred are transparent.
+    template <class K>
+    enable_if_lookup_key<K, bool> contains(const K& key) const {
+        return find_fn_key(key, [](const mapped_type&) {});
     }
 
     //! This version of find does the same thing as the two-argument version,
@@ -474,6 +840,18 @@ public:
         }
     }
 
+    //! The heterogeneous counterpart of the one-argument find.
+    template <class K>
+    enable_if_lookup_key<K, mapped_type> find(const K& key) const {
+        mapped_type val;
+        bool done = find(key, val);
+        if (done) {
+            return val;
+        } else {
+            throw std::out_of_range("key not found in table");
+        }
+    }
+
     //! insert puts the given key-value pair into the table. It first checks
     //! that \p key isn't already in the table, since the table doesn't support
     //! duplicate keys. If the table is out of space, insert will automatically
@@ -481,6 +859,39 @@ public:
     //! which insert will propagate. If \p key is already in the table, it
     //! returns false, otherwise it returns true.
     bool insert(const key_type& key, const mapped_type& val) {
+        return insert_deadline(key, val, 0);
+    }
+
+    //! This insert gives the new entry a time to live of \p ttl, after which
+    //! the table treats it as absent. Expired entries are reclaimed by the
+    //! next operation that runs into them, and by \ref sweep_expired.
+    //! update and update_fn keep the expiry of the entry they change. It is
+    //! only available if \p WithExpiry is true.
+    bool insert(const key_type& key, const mapped_type& val,
+                std::chrono::milliseconds ttl) {
+        static_assert(WithExpiry, "the table was declared without expiry");
+        return insert_deadline(key, val, deadline_after(ttl));
+    }
+
+    //! expire sets the time to live of \p key to \p ttl. If \p key is not
+    //! there, it returns false, otherwise it returns true.
+    bool expire(const key_type& key, std::chrono::milliseconds ttl) {
+        static_assert(WithExpiry, "the table was declared without expiry");
+        return set_deadline_key(key, deadline_after(ttl));
+    }
+
+    //! persist removes the time to live of \p key, so it never expires. If
+    //! \p key is not there, it returns false, otherwise it returns true.
+    bool persist(const key_type& key) {
+        static_assert(WithExpiry, "the table was declared without expiry");
+        return set_deadline_key(key, 0);
+    }
+
+    //! ttl stores the remaining time to live of \p key in \p remaining, or
+    //! std::chrono::milliseconds::max() if \p key never expires. If \p key
+    //! is not there, it returns false, otherwise it returns true.
+    bool ttl(const key_type& key, std::chrono::milliseconds& remaining) const {
+        static_assert(WithExpiry, "the table was declared without expiry");
         check_hazard_pointer();
         check_counterid();
         size_t hv = hashed_key(key);
@@ -488,13 +899,326 @@ public:
         size_t i1, i2;
         std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
         HazardPointerUnsetter hpu;
-        return cuckoo_insert_loop(key, val, hv, ti, i1, i2);
+
+        size_t i, j;
+        const bool found = cuckoo_find_slot(key, hv, ti, i1, i2, i, j);
+        if (found) {
+            const uint64_t deadline = ti->buckets_[i].deadline(j);
+            remaining = deadline == 0 ? std::chrono::milliseconds::max() :
+                std::chrono::milliseconds(
+                    std::max<int64_t>(deadline - cuckoo_now_ms(), 0));
+        }
+        unlock_two(ti, i1, i2);
+        return found;
+    }
+
+    //! sweep_expired reclaims the expired entries of up to \p max_buckets
+    //! buckets, continuing where the previous call stopped, so repeated calls
+    //! walk the whole table. It locks one lock stripe at a time, which keeps
+    //! the cost of each call bounded and never blocks the whole table. It
+    //! returns the number of entries it reclaimed. It is only available if \p
+    //! WithExpiry is true.
+    size_t sweep_expired(size_t max_buckets) {
+        static_assert(WithExpiry, "the table was declared without expiry");
+        check_hazard_pointer();
+        check_counterid();
+        std::unique_lock<std::mutex> ul(sweep_lock_);
+        const auto start = std::chrono::steady_clock::now();
+        TableInfo* ti = snapshot_table_nolock();
+        HazardPointerUnsetter hpu;
+
+        // The cursor walks the buckets stripe by stripe: position p is the
+        // (p % per_stripe)-th bucket of stripe p / per_stripe, so each stripe
+        // is locked once for all of its buckets.
+        const size_t num_buckets = hashsize(ti->hashpower_);
+        const size_t num_stripes = std::min(num_buckets, size_t(kNumLocks));
+        const size_t per_stripe = num_buckets / num_stripes;
+        const uint64_t now = cuckoo_now_ms();
+        size_t pos = sweep_cursor_ % num_buckets;
+        max_buckets = std::min(max_buckets, num_buckets);
+        size_t scanned = 0, reclaimed = 0;
+        while (scanned < max_buckets) {
+            const size_t stripe = pos / per_stripe;
+            lock(ti, stripe);
+            if (ti != table_info.load()) {
+                // The table was resized, the next call sweeps the new one
+                unlock(ti, stripe);
+                break;
+            }
+            do {
+                Bucket& b = ti->buckets_[stripe + (pos % per_stripe) *
+                                         num_stripes];
+                for (size_t j = 0; j < SlotPerBucket; ++j) {
+                    if (b.occupied(j) && b.deadline(j) != 0 &&
+                        b.deadline(j) <= now) {
+                        b.eraseKV(j);
+                        ti->num_deletes[counterid].num.fetch_add(
+                            1, std::memory_order_relaxed);
+                        ++reclaimed;
+                    }
+                }
+                ++pos;
+                ++scanned;
+            } while (scanned < max_buckets && pos % per_stripe != 0);
+            unlock(ti, stripe);
+            if (pos == num_buckets) {
+                pos = 0;
+            }
+        }
+        sweep_cursor_ = pos;
+
+        const uint64_t ns = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        swept_expired_.fetch_add(reclaimed, std::memory_order_relaxed);
+        sweep_ticks_.fetch_add(1, std::memory_order_relaxed);
+        buckets_swept_.fetch_add(scanned, std::memory_order_relaxed);
+        last_tick_ns_.store(ns, std::memory_order_relaxed);
+        if (ns > max_tick_ns_.load(std::memory_order_relaxed)) {
+            max_tick_ns_.store(ns, std::memory_order_relaxed);
+        }
+        return reclaimed;
+    }
+
+    //! start_sweeper starts a background thread that calls \ref
+    //! sweep_expired with \p max_buckets every \p interval, replacing the
+    //! sweeper that was already running, if any. The destructor stops it.
+    void start_sweeper(std::chrono::milliseconds interval,
+                       size_t max_buckets) {
+        static_assert(WithExpiry, "the table was declared without expiry");
+        stop_sweeper();
+        sweeper_stop_ = false;
+        sweeper_ = std::thread([this, interval, max_buckets]() {
+                std::unique_lock<std::mutex> ul(sweeper_mutex_);
+                while (!sweeper_cv_.wait_for(
+                           ul, interval, [this]() { return sweeper_stop_; })) {
+                    ul.unlock();
+                    sweep_expired(max_buckets);
+                    ul.lock();
+                }
+            });
+    }
+
+    //! stop_sweeper stops the thread started by \ref start_sweeper and waits
+    //! for it to exit. It does nothing if no sweeper is running.
+    void stop_sweeper() {
+        if (!sweeper_.joinable()) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> ul(sweeper_mutex_);
+            sweeper_stop_ = true;
+        }
+        sweeper_cv_.notify_all();
+        sweeper_.join();
+    }
+
+    //! expiry_stats returns the counters of expired entries reclaimed lazily
+    //! and by the sweeper, and the cost of the sweeps so far.
+    cuckoo_expiry_stats expiry_stats() const {
+        check_hazard_pointer();
+        const TableInfo* ti = snapshot_table_nolock();
+        HazardPointerUnsetter hpu;
+        cuckoo_expiry_stats st;
+        st.lazy_expired = lazy_expired_carry_.load();
+        for (size_t i = 0; i < ti->num_expired.size(); ++i) {
+            st.lazy_expired += ti->num_expired[i].num.load();
+        }
+        st.swept_expired = swept_expired_.load();
+        st.sweep_ticks = sweep_ticks_.load();
+        st.buckets_swept = buckets_swept_.load();
+        st.last_tick_ns = last_tick_ns_.load();
+        st.max_tick_ns = max_tick_ns_.load();
+        return st;
     }
 
     //! erase removes \p key and it's associated value from the table, calling
     //! their destructors. If \p key is not there, it returns false, otherwise
     //! it returns true.
     bool erase(const key_type& key) {
+        return erase_key(key);
+    }
+
+    //! The heterogeneous counterpart of erase, available when \p Hash and \p
+    //! Pred are transparent.
+    template <class K>
+    enable_if_lookup_key<K, bool> erase(const K& key) {
+        return erase_key(key);
+    }
+
+    //! update changes the value associated with \p key to \p val. If \p key is
+    //! not there, it returns false, otherwise it returns true.
+    bool update(const key_type& key, const mapped_type& val) {
+        return update_key(key, val);
+    }
+
+    //! The heterogeneous counterpart of update, available when \p Hash and \p
+    //! Pred are transparent.
+    template <class K>
+    enable_if_lookup_key<K, bool> update(const K& key, const mapped_type& val) {
+        return update_key(key, val);
+    }
+
+    //! update_fn changes the value associated with \p key with the function \p
+    //! fn. \p fn should be a function that accepts an argument of type \p
+    //! mapped_type and returns a new value of type \p mapped_type. The exact
+    //! type of \p fn is specified by the \ref updater typedef. If \p key is not
+    //! there, it returns false, otherwise it returns true.
+    template <typename Updater>
+    bool update_fn(const key_type& key, Updater fn) {
+        return update_fn_key(key, fn);
+    }
+
+    //! The heterogeneous counterpart of update_fn, available when \p Hash and
+    //! \p Pred are transparent.
+    template <class K, typename Updater>
+    enable_if_lookup_key<K, bool> update_fn(const K& key, Updater fn) {
+        return update_fn_key(key, fn);
+    }
+
+    //! multi_find searches for all of \p keys while holding the locks of all
+    //! their buckets at once, so it sees their values as of a single point
+    //! in time. It resizes \p vals to the number of keys and stores the
+    //! value of keys[k] in vals[k], leaving the entries of the keys that
+    //! aren't there value-initialized. It returns the number of keys found.
+    size_t multi_find(const std::vector<key_type>& keys,
+                      std::vector<mapped_type>& vals) const {
+        vals.assign(keys.size(), mapped_type());
+        return multi_key(keys, [&vals](const std::vector<mapped_type*>& v) {
+                for (size_t k = 0; k < v.size(); ++k) {
+                    if (v[k] != nullptr) {
+                        vals[k] = *v[k];
+                    }
+                }
+            });
+    }
+
+    //! multi_update changes the values of all of \p keys in one step, while
+    //! holding the locks of all their buckets at once, so no other operation
+    //! sees some of the changes without the others. \p fn is called once
+    //! with a \p std::vector<mapped_type*> whose k-th pointer points to the
+    //! value of keys[k], or is null if keys[k] isn't there, and may read and
+    //! change any of them, for example to decrement several counters only
+    //! if none of them would drop below zero. A key listed twice gets the
+    //! same pointer twice. \p fn runs while the locks are held, so it should
+    //! be short and must not call back into the table. It returns the number
+    //! of keys found.
+    template <typename Updater>
+    size_t multi_update(const std::vector<key_type>& keys, Updater fn) {
+        return multi_key(keys, fn);
+    }
+
+private:
+    // The lookup functions below implement find, find_fn, contains, erase,
+    // update and update_fn for any key type the hasher and key_equal accept.
+    // The public overloads only forward other types here when both are
+    // transparent.
+    bool insert_deadline(const key_type& key, const mapped_type& val,
+                         const uint64_t deadline) {
+        check_hazard_pointer();
+        check_counterid();
+        size_t hv = hashed_key(key);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+        return cuckoo_insert_loop(key, val, deadline, hv, ti, i1, i2);
+    }
+
+    // mark_scanned marks the element with the given key as visited by the
+    // running weak scan. It is used on the table an expansion fills up,
+    // before the table is published.
+    void mark_scanned(const key_type& key) {
+        check_hazard_pointer();
+        size_t hv = hashed_key(key);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        size_t i, j;
+        if (cuckoo_find_slot(key, hv, ti, i1, i2, i, j)) {
+            ti->buckets_[i].set_scanned(j, true);
+        }
+        unlock_two(ti, i1, i2);
+    }
+
+    bool set_deadline_key(const key_type& key, const uint64_t deadline) {
+        check_hazard_pointer();
+        check_counterid();
+        size_t hv = hashed_key(key);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        size_t i, j;
+        const bool found = cuckoo_find_slot(key, hv, ti, i1, i2, i, j);
+        if (found) {
+            ti->buckets_[i].set_deadline(j, deadline);
+        }
+        unlock_two(ti, i1, i2);
+        return found;
+    }
+
+    template <class K>
+    bool find_key(const K& key, mapped_type& val) const {
+        return find_fn_key(key, [&val](const mapped_type& v) { val = v; });
+    }
+
+    template <class K, typename Reader>
+    bool find_fn_key(const K& key, Reader fn) const {
+        check_hazard_pointer();
+        check_counterid();
+        size_t hv = hashed_key(key);
+        TableInfo* ti;
+        size_t i1, i2;
+        std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
+        HazardPointerUnsetter hpu;
+
+        const cuckoo_status st = cuckoo_find_fn(
+            key, fn, hv, ti, i1, i2,
+            cache_mode_.load(std::memory_order_relaxed));
+        unlock_two(ti, i1, i2);
+        return (st == ok);
+    }
+
+    // multi_key locks the buckets of all the keys, finds them and calls fn on
+    // the pointers to their values, as described in multi_update.
+    template <typename Fn>
+    size_t multi_key(const std::vector<key_type>& keys, Fn fn) const {
+        check_hazard_pointer();
+        check_counterid();
+        std::vector<size_t> hvs(keys.size());
+        for (size_t k = 0; k < keys.size(); ++k) {
+            hvs[k] = hashed_key(keys[k]);
+        }
+        std::vector<size_t> stripes;
+        TableInfo* ti = snapshot_and_lock_many(hvs, stripes);
+        ManyUnlocker mu(ti, stripes);
+        HazardPointerUnsetter hpu;
+
+        std::vector<mapped_type*> vals(keys.size(), nullptr);
+        size_t found = 0;
+        const bool track = cache_mode_.load(std::memory_order_relaxed);
+        for (size_t k = 0; k < keys.size(); ++k) {
+            const size_t i1 = index_hash(ti, hvs[k]);
+            const size_t i2 = alt_index(ti, hvs[k], i1);
+            size_t i, j;
+            if (cuckoo_find_slot(keys[k], hvs[k], ti, i1, i2, i, j)) {
+                if (track) {
+                    ti->buckets_[i].touch(j);
+                }
+                vals[k] = &ti->buckets_[i].val(j);
+                ++found;
+            }
+        }
+        fn(vals);
+        return found;
+    }
+
+    template <class K>
+    bool erase_key(const K& key) {
         check_hazard_pointer();
         check_counterid();
         size_t hv = hashed_key(key);
@@ -505,13 +1229,41 @@ public:
 
         const cuckoo_status st = cuckoo_delete(key, hv, ti, i1, i2);
         unlock_two(ti, i1, i2);
+        if (st == ok && (ti->num_deletes[counterid].num.load(
+                             std::memory_order_relaxed) &
+                         (kShrinkCheckInterval - 1)) == 0) {
+            maybe_auto_shrink();
+        }
         return (st == ok);
     }
 
-    //! update changes the value associated with \p key to \p val. If \p key is
-    //! not there, it returns false, otherwise it returns true.
-    bool update(const key_type& key, const mapped_type& val) {
+    // maybe_auto_shrink shrinks the table if automatic shrinking is on and
+    // enough consecutive checks found the load factor below the threshold.
+    void maybe_auto_shrink() {
+        const double threshold = auto_shrink_load_.load();
+        if (threshold == 0) {
+            return;
+        }
+        TableInfo* ti = snapshot_table_nolock();
+        if (ti->hashpower_ <= min_hashpower_ ||
+            cuckoo_loadfactor(ti) >= threshold) {
+            shrink_votes_.store(0);
+            return;
+        }
+        if (shrink_votes_.fetch_add(1) + 1 < kShrinkVotes) {
+            return;
+        }
+        shrink_votes_.store(0);
+        const size_t n = std::max(shrink_calc(cuckoo_size(ti)), min_hashpower_);
+        if (n < ti->hashpower_) {
+            cuckoo_shrink_simple(n);
+        }
+    }
+
+    template <class K>
+    bool update_key(const K& key, const mapped_type& val) {
         check_hazard_pointer();
+        check_counterid();
         size_t hv = hashed_key(key);
         TableInfo* ti;
         size_t i1, i2;
@@ -523,14 +1275,10 @@ public:
         return (st == ok);
     }
 
-    //! update_fn changes the value associated with \p key with the function \p
-    //! fn. \p fn should be a function that accepts an argument of type \p
-    //! mapped_type and returns a new value of type \p mapped_type. The exact
-    //! type of \p fn is specified by the \ref updater typedef. If \p key is not
-    //! there, it returns false, otherwise it returns true.
-    template <typename Updater>
-    bool update_fn(const key_type& key, Updater fn) {
+    template <class K, typename Updater>
+    bool update_fn_key(const K& key, Updater fn) {
         check_hazard_pointer();
+        check_counterid();
         size_t hv = hashed_key(key);
         TableInfo* ti;
         size_t i1, i2;
@@ -542,6 +1290,7 @@ public:
         return (st == ok);
     }
 
+public:
     //! upsert is a combination of update_fn and insert. It first tries updating
     //! the value associated with \p key using \p fn. If \p key is not in the
     //! table, then it runs an insert with \p key and \p val. It will always
@@ -566,7 +1315,7 @@ public:
             }
 
             // We run an insert, since the update failed
-            res = cuckoo_insert_loop(key, val, hv, ti, i1, i2);
+            res = cuckoo_insert_loop(key, val, 0, hv, ti, i1, i2);
 
             // The only valid reason for res being false is if insert
             // encountered a duplicate key after releasing the locks and
@@ -576,9 +1325,66 @@ public:
         return;
     }
 
+    //! bulk_load inserts the key-value pairs in [\p first, \p last), which
+    //! must be random access iterators to pairs. It leaves the table as a
+    //! loop assigning the pairs in order would: a key already in the table
+    //! gets the value of its pair, and of the pairs that share a key, the
+    //! last one wins. It sizes the table for all the pairs at once.
+    //! If the table is empty, it then places the pairs with one thread per
+    //! core without locking each of them: it hashes them in parallel and
+    //! hands groups of contiguous buckets out to the threads, each of which
+    //! puts the pairs whose first bucket is in its groups there, and then
+    //! the pairs left over whose second bucket is. The table is locked
+    //! meanwhile.
+    //! Last, the pairs whose buckets were both full are inserted the usual
+    //! way, with cuckoo paths. If the table isn't empty, all the pairs are
+    //! inserted the usual way, in parallel, each thread taking the keys
+    //! whose hash is equal to its index modulo the number of threads.
+    template <class RandomIt>
+    void bulk_load(RandomIt first, RandomIt last) {
+        static_assert(std::is_same<
+                          typename std::iterator_traits<
+                              RandomIt>::iterator_category,
+                          std::random_access_iterator_tag>::value,
+                      "bulk_load requires random access iterators");
+        const size_t n = last - first;
+        reserve(size() + n);
+
+        // overflow[t] holds the indices of the pairs thread t inserts the
+        // usual way
+        std::vector<std::vector<size_t> > overflow(kNumCores);
+        bool placed;
+        check_hazard_pointer();
+        {
+            TableInfo* ti = snapshot_and_lock_all();
+            AllUnlocker au(ti);
+            HazardPointerUnsetter hpu;
+            placed = cuckoo_size(ti) == 0;
+            if (placed) {
+                bulk_place_all(ti, first, n, overflow,
+                               cache_mode_.load(std::memory_order_relaxed));
+            }
+        }
+        // The pairs that share a key go to the same thread, in input
+        // order, so the last one is assigned last
+        parallel_for([&](size_t t) {
+                if (placed) {
+                    for (size_t i : overflow[t]) {
+                        bulk_assign(first[i].first, first[i].second);
+                    }
+                } else {
+                    for (size_t i = 0; i < n; ++i) {
+                        if (hashed_key(first[i].first) % kNumCores == t) {
+                            bulk_assign(first[i].first, first[i].second);
+                        }
+                    }
+                }
+            });
+    }
+
     //! rehash will size the table using a hashpower of \p n. Note that the
     //! number of buckets in the table will be 2<SUP>\p n</SUP> after expansion,
-    //! so the table will have 2<SUP>\p n</SUP> &times; \ref SLOT_PER_BUCKET
+    //! so the table will have 2<SUP>\p n</SUP> &times; \ref slot_per_bucket()
     //! slots to store items in. If \p n is not larger than the current
     //! hashpower, then the function does nothing. It returns true if the table
     //! expansion succeeded, and false otherwise. rehash can throw an exception
@@ -604,21 +1410,252 @@ public:
         check_hazard_pointer();
         TableInfo* ti = snapshot_table_nolock();
         HazardPointerUnsetter hpu;
-        if (n <= hashsize(ti->hashpower_) * SLOT_PER_BUCKET) {
+        if (n <= hashsize(ti->hashpower_) * SlotPerBucket) {
             return false;
         }
         const cuckoo_status st = cuckoo_expand_simple(reserve_calc(n));
         return (st == ok);
     }
 
+    //! shrink_to_fit shrinks the table to the smallest hashpower that holds
+    //! its elements with a load factor of at most 3/4, moving the elements
+    //! the same way expansion does. It returns true if the table shrank, and
+    //! false if it was already that small. Like expansion, it can throw an
+    //! exception if it fails to allocate the smaller table.
+    bool shrink_to_fit() {
+        check_hazard_pointer();
+        TableInfo* ti = snapshot_table_nolock();
+        HazardPointerUnsetter hpu;
+        const size_t n = shrink_calc(cuckoo_size(ti));
+        if (n >= ti->hashpower_) {
+            return false;
+        }
+        const cuckoo_status st = cuckoo_shrink_simple(n);
+        // The operations that waited for the shrink still point at the old
+        // table, so give them a moment to move on, in order to free it now
+        // rather than at the next resize.
+        for (size_t i = 0; i < kShrinkFreeRetries && !delete_old_tables();
+             ++i) {
+            std::this_thread::yield();
+        }
+        return (st == ok);
+    }
+
+    //! set_auto_shrink makes the table shrink on its own, as with \ref
+    //! shrink_to_fit, when its load factor stays below \p threshold. Erase
+    //! checks the load factor every few thousand deletes, and the table
+    //! shrinks when consecutive checks find it below \p threshold. It never
+    //! shrinks below the size it was constructed with. Shrinking leaves the
+    //! load factor between 3/8 and 3/4, so \p threshold must be below 3/8 to
+    //! keep the table from shrinking repeatedly. A \p threshold of 0 turns
+    //! automatic shrinking off, which is the default.
+    void set_auto_shrink(double threshold) {
+        if (threshold < 0 || threshold >= 0.375) {
+            throw std::invalid_argument(
+                "auto shrink threshold must be in [0, 0.375)");
+        }
+        shrink_votes_.store(0);
+        auto_shrink_load_.store(threshold);
+    }
+
     //! hash_function returns the hash function object used by the table.
     hasher hash_function() const {
         return hashfn;
     }
 
-    //! key_eq returns the equality predicate object used by the table.
-    key_equal key_eq() const {
-        return eqfn;
+    //! key_eq returns the equality predicate object used by the table.
+    key_equal key_eq() const {
+        return eqfn;
+    }
+
+    //! evict_callback is the type of the function cache mode calls with each
+    //! key-value pair it evicts.
+    typedef std::function<void(const key_type&, const mapped_type&)>
+        evict_callback;
+
+    //! set_cache_mode turns cache mode on or off. In cache mode the table never
+    //! grows on its own: when an insert cannot find a cuckoo path to a free
+    //! slot, it evicts an entry instead of expanding the table. The victim is
+    //! picked with the CLOCK algorithm among the slots the cuckoo path search
+    //! walks: lookups and updates set a per-slot reference bit under the bucket
+    //! lock they already hold, the search clears the bits it passes over, and
+    //! the first slot found without its bit set is evicted. \p cb, if set, is
+    //! called with the evicted pair while its bucket lock is held, so it must
+    //! not call back into the table. Explicit \ref rehash and \ref reserve
+    //! calls still resize the table. This should be called before the table
+    //! is shared between threads.
+    void set_cache_mode(bool enabled, evict_callback cb = evict_callback()) {
+        evict_cb_ = cb;
+        cache_mode_.store(enabled);
+    }
+
+    //! cache_mode returns true if the table is in cache mode.
+    bool cache_mode() const {
+        return cache_mode_.load();
+    }
+
+    //! num_evictions returns the number of entries cache mode has evicted.
+    size_t num_evictions() const {
+        return num_evictions_.load(std::memory_order_relaxed);
+    }
+
+    //! lock_stats returns the contention counters of all the lock stripes of
+    //! the current table, summed up. The counters are read without locking,
+    //! so the result is approximate while other threads run. They start from
+    //! zero whenever the table is resized.
+    cuckoo_lock_stats lock_stats() const {
+        check_hazard_pointer();
+        const TableInfo* ti = snapshot_table_nolock();
+        HazardPointerUnsetter hpu;
+        cuckoo_lock_stats st;
+        for (size_t i = 0; i < kNumLocks; ++i) {
+            st += ti->locks_[i].stats();
+        }
+        return st;
+    }
+
+    //! dump writes the contents of the table to the file at \p path, in a
+    //! binary format that \ref load reads back: a versioned header followed
+    //! by the buckets exactly as they are laid out in memory, with their
+    //! occupancy, partial keys, reference bits and expiry deadlines. It is
+    //! only available for trivially copyable keys and values. The table is
+    //! locked while the file is written, and the file is written under a
+    //! temporary name and renamed to \p path once complete. It throws
+    //! std::system_error if writing the file fails.
+    void dump(const std::string& path) const {
+        static_assert(std::is_trivially_copyable<key_type>::value &&
+                      std::is_trivially_copyable<mapped_type>::value,
+                      "dump requires trivially copyable keys and values");
+        const std::string tmp = path + ".tmp";
+        const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw_file_error("cannot create", tmp);
+        }
+        {
+            FileCloser fc(fd);
+            check_hazard_pointer();
+            TableInfo* ti = snapshot_and_lock_all();
+            AllUnlocker au(ti);
+            HazardPointerUnsetter hpu;
+            dump_table(ti, fd, tmp);
+            if (fsync(fd) != 0) {
+                throw_file_error("cannot sync", tmp);
+            }
+        }
+        if (rename(tmp.c_str(), path.c_str()) != 0) {
+            throw_file_error("cannot rename", tmp);
+        }
+    }
+
+    //! load replaces the contents of the table with those of the file \p
+    //! path written by \ref dump. If the table hashes keys the same way as
+    //! the one that wrote the file, and the file's table is at least as big
+    //! as this one was constructed, load maps the file's buckets privately,
+    //! copy-on-write, and uses them in place: nothing is rehashed or copied,
+    //! and pages are read in as they are first used. It then returns true.
+    //! Otherwise it inserts the file's elements into the table in parallel,
+    //! as expansion does, and returns false. Tables with expiring entries
+    //! move the deadlines to this process's clock, which writes every bucket
+    //! holding one. It throws std::system_error if the file cannot be read
+    //! and std::runtime_error if it isn't a dump of this type of table.
+    bool load(const std::string& path) {
+        static_assert(std::is_trivially_copyable<key_type>::value &&
+                      std::is_trivially_copyable<mapped_type>::value,
+                      "load requires trivially copyable keys and values");
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw_file_error("cannot open", path);
+        }
+        FileCloser fc(fd);
+        std::vector<char> page(kDumpHeaderSize);
+        if (pread(fd, page.data(), page.size(), 0) !=
+            static_cast<ssize_t>(page.size())) {
+            throw std::runtime_error("truncated dump header in " + path);
+        }
+        DumpHeader hdr;
+        memcpy(&hdr, page.data(), sizeof(hdr));
+        if (memcmp(hdr.magic, "CUCKOODM", sizeof(hdr.magic)) != 0 ||
+            hdr.version != kDumpVersion) {
+            throw std::runtime_error(path + " is not a cuckoohash_map dump");
+        }
+        if (hdr.slot_per_bucket != SlotPerBucket ||
+            hdr.bucket_size != sizeof(Bucket) ||
+            hdr.key_size != sizeof(key_type) ||
+            hdr.mapped_size != sizeof(mapped_type) ||
+            hdr.layout_id != dump_layout_id() ||
+            hdr.num_samples > dump_samples()) {
+            throw std::runtime_error(path + " is a dump of another table type");
+        }
+        // Beyond this, the buckets of an untrusted hashpower would not fit
+        // in a size_t, and their size could wrap around to the file's
+        if (hdr.hashpower >= sizeof(size_t) * 8 - log2_ceil(sizeof(Bucket))) {
+            throw std::runtime_error("corrupt dump header in " + path);
+        }
+        const size_t len = kDumpHeaderSize +
+            hashsize(hdr.hashpower) * sizeof(Bucket);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            throw_file_error("cannot stat", path);
+        }
+        if (static_cast<size_t>(st.st_size) != len) {
+            throw std::runtime_error("truncated dump " + path);
+        }
+        void* map = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                         fd, 0);
+        if (map == MAP_FAILED) {
+            throw_file_error("cannot map", path);
+        }
+        std::unique_ptr<TableInfo> loaded(
+            new TableInfo(hdr.hashpower, map, len));
+        loaded->num_inserts[0].num.store(hdr.size);
+        if (WithExpiry) {
+            rebase_deadlines(loaded.get(), hdr);
+        }
+
+        check_hazard_pointer();
+        if (same_hash(page.data()) && hdr.hashpower >= min_hashpower_) {
+            {
+                TableInfo* ti = snapshot_and_lock_all();
+                AllUnlocker au(ti);
+                HazardPointerUnsetter hpu;
+                replace_table(ti, loaded.release());
+            }
+            delete_old_tables();
+            return true;
+        }
+        clear();
+        reserve(hdr.size);
+        insert_all(*this, loaded.get());
+        return false;
+    }
+
+    //! displacement_stats returns the cuckoo displacement statistics of the
+    //! table, summed over all threads, along with its \ref lock_stats. They
+    //! are only collected if LIBCUCKOO_STATS is set, and are read without
+    //! locking, so they are approximate while other threads run.
+    cuckoo_displacement_stats displacement_stats() const {
+        cuckoo_displacement_stats st;
+        st.path_length.assign(MAX_BFS_DEPTH + 1, 0);
+#if LIBCUCKOO_STATS
+        for (size_t i = 0; i < kNumCores; ++i) {
+            const DisplacementCounters& c = displacement_[i];
+            st.searches += c.searches.load(std::memory_order_relaxed);
+            st.search_failures +=
+                c.search_failures.load(std::memory_order_relaxed);
+            st.move_retries += c.move_retries.load(std::memory_order_relaxed);
+            st.table_full += c.table_full.load(std::memory_order_relaxed);
+            for (size_t d = 0; d <= MAX_BFS_DEPTH; ++d) {
+                st.path_length[d] +=
+                    c.path_length[d].load(std::memory_order_relaxed);
+            }
+        }
+        st.resizes = resizes_.load();
+        st.resize_ns = resize_ns_.load();
+        st.max_resize_ns = max_resize_ns_.load();
+        st.bytes_moved = bytes_moved_.load();
+#endif
+        st.locks = lock_stats();
+        return st;
     }
 
     //! Returns a \ref reference to the mapped value stored at the given key.
@@ -642,10 +1679,50 @@ private:
     // during expansion. This keeps the memory alive for any leftover
     // operations, until they are deleted by the global hazard pointer manager.
     std::list<std::unique_ptr<TableInfo>> old_table_infos;
+    std::mutex old_table_infos_lock_;
 
     static hasher hashfn;
     static key_equal eqfn;
 
+    // cache mode state, see set_cache_mode
+    std::atomic<bool> cache_mode_;
+    evict_callback evict_cb_;
+    std::atomic<size_t> num_evictions_;
+
+    // expiry sweeping state, see sweep_expired. sweep_lock_ serializes the
+    // sweeps, and protects sweep_cursor_, the position the next sweep starts
+    // at.
+    std::mutex sweep_lock_;
+    size_t sweep_cursor_;
+    std::atomic<size_t> swept_expired_, sweep_ticks_, buckets_swept_;
+    std::atomic<uint64_t> last_tick_ns_, max_tick_ns_;
+    // the lazy expiry count of the tables replaced by expansions
+    std::atomic<size_t> lazy_expired_carry_;
+
+    // background sweeper thread, see start_sweeper
+    std::thread sweeper_;
+    std::mutex sweeper_mutex_;
+    std::condition_variable sweeper_cv_;
+    bool sweeper_stop_;
+
+    // serializes weak scans, see for_each_weak
+    mutable std::mutex scan_lock_;
+
+    // automatic shrinking state, see set_auto_shrink. The table never shrinks
+    // on its own below min_hashpower_, the hashpower it was constructed with.
+    size_t min_hashpower_;
+    std::atomic<double> auto_shrink_load_;
+    std::atomic<size_t> shrink_votes_;
+
+#if LIBCUCKOO_STATS
+    // displacement statistics, see displacement_stats. displacement_ has one
+    // entry per counterid.
+    std::unique_ptr<DisplacementCounters[]> displacement_;
+    std::atomic<size_t> resizes_;
+    std::atomic<uint64_t> resize_ns_, max_resize_ns_;
+    std::atomic<size_t> bytes_moved_;
+#endif
+
     // lock locks the given bucket index.
     static inline void lock(TableInfo* ti, const size_t i) {
         ti->locks_[lock_ind(i)].lock();
@@ -812,6 +1889,57 @@ private:
         }
     };
 
+    // ManyUnlocker is an object which releases the given lock stripes of the
+    // given table info when its destructor is called.
+    class ManyUnlocker {
+        TableInfo* ti_;
+        const std::vector<size_t>& stripes_;
+    public:
+        ManyUnlocker(TableInfo* ti, const std::vector<size_t>& stripes)
+            : ti_(ti), stripes_(stripes) {}
+        ~ManyUnlocker() {
+            for (size_t s : stripes_) {
+                ti_->locks_[s].unlock();
+            }
+        }
+    };
+
+    // snapshot_and_lock_many is similar to snapshot_and_lock_two, except that
+    // it locks the buckets of all the given hash values. It stores the lock
+    // stripes of the buckets in stripes, sorted and without duplicates, and
+    // takes their locks in that order, which is the order lock_two and
+    // lock_three use, so it can't deadlock with them or with itself.
+    TableInfo* snapshot_and_lock_many(const std::vector<size_t>& hvs,
+                                      std::vector<size_t>& stripes) const {
+        while (true) {
+            TableInfo* ti = table_info.load();
+            *hazard_pointer = ti;
+            // If the table info has changed, ti could have been deleted, so try
+            // again
+            if (ti != table_info.load()) {
+                continue;
+            }
+            stripes.clear();
+            for (size_t hv : hvs) {
+                const size_t i1 = index_hash(ti, hv);
+                stripes.push_back(lock_ind(i1));
+                stripes.push_back(lock_ind(alt_index(ti, hv, i1)));
+            }
+            std::sort(stripes.begin(), stripes.end());
+            stripes.erase(std::unique(stripes.begin(), stripes.end()),
+                          stripes.end());
+            for (size_t s : stripes) {
+                ti->locks_[s].lock();
+            }
+            // If the table info has changed, unlock the locks and try again.
+            if (ti != table_info.load()) {
+                ManyUnlocker mu(ti, stripes);
+                continue;
+            }
+            return ti;
+        }
+    }
+
     // snapshot_and_lock_all is similar to snapshot_and_lock_two, except that it
     // takes all the locks in the table.
     TableInfo* snapshot_and_lock_all() const {
@@ -843,7 +1971,12 @@ private:
     // hashsize returns the number of buckets corresponding to a given
     // hashpower.
     static inline size_t hashsize(const size_t hashpower) {
-        return 1U << hashpower;
+        return size_t(1) << hashpower;
+    }
+
+    // log2_ceil returns the smallest p such that 2^p >= n.
+    static constexpr size_t log2_ceil(const size_t n, const size_t p = 0) {
+        return (size_t(1) << p) >= n ? p : log2_ceil(n, p + 1);
     }
 
     // hashmask returns the bitmask for the buckets array corresponding to a
@@ -852,8 +1985,10 @@ private:
         return hashsize(hashpower) - 1;
     }
 
-    // hashed_key hashes the given key.
-    static inline size_t hashed_key(const key_type &key) {
+    // hashed_key hashes the given key. K is key_type, or any type the hasher
+    // accepts if it is transparent.
+    template <class K>
+    static inline size_t hashed_key(const K &key) {
         return hashfn(key);
     }
 
@@ -867,15 +2002,29 @@ private:
     // could be. It takes the first possible bucket as a parameter. Note that
     // this function will return the first possible bucket if index is the
     // second possible bucket, so alt_index(ti, hv, alt_index(ti, hv,
-    // index_hash(ti, hv))) == index_hash(ti, hv).
+    // index_hash(ti, hv))) == index_hash(ti, hv). Tables that store hashes
+    // derive the tag from all the bits of the hash rather than from those
+    // above the hashpower, so the low bits of both indices stay the same when
+    // the table grows, which is what lets cuckoo_split move each element to
+    // one of the buckets its bucket splits into.
     static inline size_t alt_index(
         const TableInfo* ti, const size_t hv, const size_t index) {
         // ensure tag is nonzero for the multiply
-        const size_t tag = (hv >> ti->hashpower_) + 1;
+        const size_t tag = (StoreHash ?
+                            (hv * 0xc6a4a7935bd1e995ULL) >> 32 :
+                            hv >> ti->hashpower_) + 1;
         // 0x5bd1e995 is the hash constant from MurmurHash2
         return (index ^ (tag * 0x5bd1e995)) & hashmask(ti->hashpower_);
     }
 
+    // slot_hash returns the hash of the key in slot j of bucket i, without
+    // hashing it if the table stores hashes.
+    static inline size_t slot_hash(const TableInfo* ti, const size_t i,
+                                   const size_t j) {
+        return StoreHash ? ti->buckets_[i].hash(j) :
+            hashed_key(ti->buckets_[i].key(j));
+    }
+
     // partial_key returns a partial_t representing the upper sizeof(partial_t)
     // bytes of the hashed key. This is used for partial-key cuckoohashing. If
     // the key type is POD and small, we don't use partial keys, so we just
@@ -893,11 +2042,13 @@ private:
         return 0;
     }
 
-    // CuckooRecord holds one position in a cuckoo path.
+    // CuckooRecord holds one position in a cuckoo path, and the key found
+    // there, along with its hash if the table stores hashes.
     typedef struct  {
         size_t bucket;
         size_t slot;
         key_type key;
+        size_t hv;
     }  CuckooRecord;
 
     // b_slot holds the information for a BFS path through the table
@@ -907,7 +2058,7 @@ private:
         // a compressed representation of the slots for each of the buckets in
         // the path.
         size_t pathcode;
-        // static_assert(pow(SLOT_PER_BUCKET, MAX_BFS_DEPTH+1) <
+        // static_assert(pow(SlotPerBucket, MAX_BFS_DEPTH+1) <
         //               std::numeric_limits<decltype(pathcode)>::max(),
         //               "pathcode may not be large enough to encode a cuckoo
         //               path"); The 0-indexed position in the cuckoo path this
@@ -945,44 +2096,90 @@ private:
             const size_t next = (last == MAX_CUCKOO_COUNT) ? 0 : last+1;
             return next != first;
         }
+
+        bool empty() {
+            return first == last;
+        }
     } __attribute__((__packed__));
 
+    // CuckooVictim records the slot cache mode evicts when slot_search can't
+    // find a free slot. found is set if the slot was unreferenced; otherwise
+    // the fallback is the first occupied slot the search looked at.
+    struct CuckooVictim {
+        size_t bucket;
+        size_t slot;
+        bool found;
+        bool has_fallback;
+        CuckooVictim()
+            : bucket(0), slot(0), found(false), has_fallback(false) {}
+    };
+
+    // clock_sweep runs one step of the CLOCK algorithm on an occupied slot
+    // that slot_search passes over in cache mode. A slot referenced since the
+    // last sweep gets a second chance and has its bit cleared, and the first
+    // unreferenced slot becomes the victim. It expects the bucket to be locked.
+    static void clock_sweep(TableInfo* ti, const size_t bucket,
+                            const size_t slot, CuckooVictim* victim) {
+        if (victim == nullptr || victim->found) {
+            return;
+        }
+        Bucket& b = ti->buckets_[bucket];
+        if (b.referenced(slot)) {
+            b.clear_referenced(slot);
+            if (!victim->has_fallback) {
+                victim->bucket = bucket;
+                victim->slot = slot;
+                victim->has_fallback = true;
+            }
+        } else {
+            victim->bucket = bucket;
+            victim->slot = slot;
+            victim->found = true;
+        }
+    }
+
     // slot_search searches for a cuckoo path using breadth-first search. It
     // starts with the i1 and i2 buckets, and, until it finds a bucket with an
     // empty slot, adds each slot of the bucket in the b_slot. If the queue runs
-    // out of space, it fails.
-    static b_slot slot_search(TableInfo* ti, const size_t i1, const size_t i2) {
+    // out of space, it fails. If victim is not null (cache mode), it also
+    // sweeps the reference bits of the slots it passes over, to choose a slot
+    // to evict in case it fails.
+    static b_slot slot_search(TableInfo* ti, const size_t i1, const size_t i2,
+                              CuckooVictim* victim) {
         b_queue q;
         // The initial pathcode informs cuckoopath_search which bucket the path
         // starts on
         q.enqueue(b_slot(i1, 0, 0));
         q.enqueue(b_slot(i2, 1, 0));
-        while (q.not_full()) {
+        // With few slots per bucket, the paths up to MAX_BFS_DEPTH long can
+        // run out before the queue fills up
+        while (q.not_full() && !q.empty()) {
             b_slot x = q.dequeue();
             // Picks a random slot to start from
-            for (size_t slot = 0; slot < SLOT_PER_BUCKET && q.not_full();
+            for (size_t slot = 0; slot < SlotPerBucket && q.not_full();
                  ++slot) {
                 lock(ti, x.bucket);
                 if (!ti->buckets_[x.bucket].occupied(slot)) {
                     // We can terminate the search here
-                    x.pathcode = x.pathcode * SLOT_PER_BUCKET + slot;
+                    x.pathcode = x.pathcode * SlotPerBucket + slot;
                     unlock(ti, x.bucket);
                     return x;
                 }
+                clock_sweep(ti, x.bucket, slot, victim);
                 // Create a new b_slot item, that represents the bucket we would
                 // look at after searching x.bucket for empty slots.
-                const size_t hv = hashed_key(ti->buckets_[x.bucket].key(slot));
+                const size_t hv = slot_hash(ti, x.bucket, slot);
                 unlock(ti, x.bucket);
                 b_slot y(alt_index(ti, hv, x.bucket),
-                         x.pathcode * SLOT_PER_BUCKET + slot, x.depth+1);
+                         x.pathcode * SlotPerBucket + slot, x.depth+1);
 
                 // Check if any of the slots in the prospective bucket are
                 // empty, and, if so, return that b_slot. We lock the bucket so
                 // that no changes occur while iterating.
                 lock(ti, y.bucket);
-                for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                for (size_t j = 0; j < SlotPerBucket; ++j) {
                     if (!ti->buckets_[y.bucket].occupied(j)) {
-                        y.pathcode = y.pathcode * SLOT_PER_BUCKET + j;
+                        y.pathcode = y.pathcode * SlotPerBucket + j;
                         unlock(ti, y.bucket);
                         return y;
                     }
@@ -1005,17 +2202,18 @@ private:
     // cuckoo path on success, and -1 on failure. Since it doesn't take locks on
     // the buckets it searches, the data can change between this function and
     // cuckoopath_move. Thus cuckoopath_move checks that the data matches the
-    // cuckoo path before changing it.
+    // cuckoo path before changing it. victim is passed on to slot_search.
     static int cuckoopath_search(TableInfo* ti, CuckooRecord* cuckoo_path,
-                                 const size_t i1, const size_t i2) {
-        b_slot x = slot_search(ti, i1, i2);
+                                 const size_t i1, const size_t i2,
+                                 CuckooVictim* victim) {
+        b_slot x = slot_search(ti, i1, i2, victim);
         if (x.depth == -1) {
             return -1;
         }
         // Fill in the cuckoo path slots from the end to the beginning
         for (int i = x.depth; i >= 0; i--) {
-            cuckoo_path[i].slot = x.pathcode % SLOT_PER_BUCKET;
-            x.pathcode /= SLOT_PER_BUCKET;
+            cuckoo_path[i].slot = x.pathcode % SlotPerBucket;
+            x.pathcode /= SlotPerBucket;
         }
         // Fill in the cuckoo_path buckets and keys from the beginning to the
         // end, using the final pathcode to figure out which bucket the path
@@ -1032,6 +2230,9 @@ private:
                 return 0;
             }
             curr->key = ti->buckets_[curr->bucket].key(curr->slot);
+            if (StoreHash) {
+                curr->hv = ti->buckets_[curr->bucket].hash(curr->slot);
+            }
             unlock(ti, curr->bucket);
         } else {
             assert(x.pathcode == 1);
@@ -1043,11 +2244,15 @@ private:
                 return 0;
             }
             curr->key = ti->buckets_[curr->bucket].key(curr->slot);
+            if (StoreHash) {
+                curr->hv = ti->buckets_[curr->bucket].hash(curr->slot);
+            }
             unlock(ti, curr->bucket);
         }
         for (int i = 1; i <= x.depth; ++i) {
             CuckooRecord* prev = curr++;
-            const size_t prevhv = hashed_key(prev->key);
+            const size_t prevhv = StoreHash ? prev->hv :
+                hashed_key(prev->key);
             assert(prev->bucket == index_hash(ti, prevhv) ||
                    prev->bucket == alt_index(ti, prevhv, index_hash(ti,
                                                                     prevhv)));
@@ -1061,12 +2266,31 @@ private:
                 return i;
             }
             curr->key = ti->buckets_[curr->bucket].key(curr->slot);
+            if (StoreHash) {
+                curr->hv = ti->buckets_[curr->bucket].hash(curr->slot);
+            }
             unlock(ti, curr->bucket);
         }
         return x.depth;
     }
 
 
+    // crosses_scan_frontier returns true if a weak scan is running on the
+    // table, and moving an element from bucket fb to bucket tb would carry it
+    // from a stripe the scan has visited to one it hasn't, or the other way
+    // around, so that the scan would miss the element or see it twice. It
+    // expects the locks of both buckets to be taken, which keeps the frontier
+    // from passing either of them.
+    static bool crosses_scan_frontier(const TableInfo* ti, const size_t fb,
+                                      const size_t tb) {
+        if (!ti->scanning.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        const size_t frontier =
+            ti->scan_frontier.load(std::memory_order_relaxed);
+        return (lock_ind(fb) < frontier) != (lock_ind(tb) < frontier);
+    }
+
     // cuckoopath_move moves keys along the given cuckoo path in order to make
     // an empty slot in one of the buckets in cuckoo_insert. Before the start of
     // this function, the two insert-locked buckets were unlocked in run_cuckoo.
@@ -1119,9 +2343,11 @@ private:
             // that happened, just... try again. Also the slot we are filling in
             // may have already been filled in by another thread, or the slot we
             // are moving from may be empty, both of which invalidate the swap.
+            // A running weak scan also forbids moves across its frontier.
             if (!eqfn(ti->buckets_[fb].key(fs), from->key) ||
                 ti->buckets_[tb].occupied(ts) ||
-                !ti->buckets_[fb].occupied(fs)) {
+                !ti->buckets_[fb].occupied(fs) ||
+                crosses_scan_frontier(ti, fb, tb)) {
                 if (depth == 1) {
                     unlock_three(ti, fb, tb, ob);
                 } else {
@@ -1133,8 +2359,16 @@ private:
             if (!is_simple) {
                 ti->buckets_[tb].partial(ts) = ti->buckets_[fb].partial(fs);
             }
+            if (StoreHash) {
+                ti->buckets_[tb].set_hash(ts, ti->buckets_[fb].hash(fs));
+            }
             ti->buckets_[tb].setKV(ts, ti->buckets_[fb].key(fs),
                                    ti->buckets_[fb].val(fs));
+            if (ti->buckets_[fb].referenced(fs)) {
+                ti->buckets_[tb].touch(ts);
+            }
+            ti->buckets_[tb].set_deadline(ts, ti->buckets_[fb].deadline(fs));
+            ti->buckets_[tb].set_scanned(ts, ti->buckets_[fb].scanned(fs));
             ti->buckets_[fb].eraseKV(fs);
             if (depth == 1) {
                 // Don't unlock fb or ob, since they are needed in
@@ -1184,11 +2418,29 @@ private:
         // insert to try again if the comparison fails.
         unlock_two(ti, i1, i2);
 
+        const bool evicting = cache_mode_.load(std::memory_order_relaxed);
         bool done = false;
         while (!done) {
-            int depth = cuckoopath_search(ti, cuckoo_path, i1, i2);
+            CuckooVictim victim;
+            int depth = cuckoopath_search(ti, cuckoo_path, i1, i2,
+                                          evicting ? &victim : nullptr);
+            LIBCUCKOO_STAT(stat_add(displacement_[counterid].searches));
+            LIBCUCKOO_STAT(stat_add(
+                depth < 0 ? displacement_[counterid].search_failures :
+                displacement_[counterid].path_length[depth]));
             if (depth < 0) {
-                break;
+                if (!evicting) {
+                    break;
+                }
+                // In cache mode we make room instead of failing, and search
+                // again, which will find the freed slot. If the table was
+                // resized in the meantime, the outer insert has to retry on
+                // the new table.
+                if (ti != table_info.load()) {
+                    return failure_under_expansion;
+                }
+                clock_evict(ti, victim);
+                continue;
             }
 
             if (cuckoopath_move(ti, cuckoo_path, depth, i1, i2)) {
@@ -1201,6 +2453,7 @@ private:
                 done = true;
                 break;
             }
+            LIBCUCKOO_STAT(stat_add(displacement_[counterid].move_retries));
         }
 
         if (!done) {
@@ -1216,13 +2469,72 @@ private:
         return ok;
     }
 
-    // try_read_from-bucket will search the bucket for the given key and store
-    // the associated value if it finds it.
-    static bool try_read_from_bucket(const TableInfo* ti,
-                                     const partial_t partial,
-                                     const key_type &key, mapped_type &val,
-                                     const size_t i) {
-        for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+    // clock_evict removes the victim chosen by slot_search from the table,
+    // calling the eviction callback on it. It gives up if the slot was emptied
+    // or referenced again since the search, in which case the caller simply
+    // searches again.
+    void clock_evict(TableInfo* ti, const CuckooVictim& victim) {
+        if (!victim.found && !victim.has_fallback) {
+            return;
+        }
+        lock(ti, victim.bucket);
+        Bucket& b = ti->buckets_[victim.bucket];
+        if (b.occupied(victim.slot) &&
+            !(victim.found && b.referenced(victim.slot))) {
+            if (evict_cb_) {
+                evict_cb_(b.key(victim.slot), b.val(victim.slot));
+            }
+            b.eraseKV(victim.slot);
+            ti->num_deletes[counterid].num.fetch_add(
+                1, std::memory_order_relaxed);
+            num_evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        unlock(ti, victim.bucket);
+    }
+
+    // reclaim_if_expired erases the element in the given slot if it has
+    // expired, and returns true if it did. Tables without expiry never call
+    // the clock here, since their deadlines are always 0.
+    static bool reclaim_if_expired(TableInfo* ti, const size_t i,
+                                   const size_t j) {
+        const uint64_t deadline = ti->buckets_[i].deadline(j);
+        if (deadline == 0 || deadline > cuckoo_now_ms()) {
+            return false;
+        }
+        ti->buckets_[i].eraseKV(j);
+        ti->num_deletes[counterid].num.fetch_add(1, std::memory_order_relaxed);
+        ti->num_expired[counterid].num.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // try_find_slot will search the bucket for the given key and store its
+    // slot in j if it finds it.
+    template <class K>
+    static bool try_find_slot(TableInfo* ti, const partial_t partial,
+                              const K &key, const size_t i, size_t& j) {
+        for (j = 0; j < SlotPerBucket; ++j) {
+            if (!ti->buckets_[i].occupied(j)) {
+                continue;
+            }
+            if (!is_simple && partial != ti->buckets_[i].partial(j)) {
+                continue;
+            }
+            if (eqfn(key, ti->buckets_[i].key(j))) {
+                return !reclaim_if_expired(ti, i, j);
+            }
+        }
+        return false;
+    }
+
+    // try_read_from_bucket_fn will search the bucket for the given key and
+    // run the given function on the associated value if it finds it. It sets
+    // the reference bit of the slot if track is set.
+    template <class K, typename Reader>
+    static bool try_read_from_bucket_fn(TableInfo* ti,
+                                        const partial_t partial,
+                                        const K &key, Reader& fn,
+                                        const size_t i, const bool track) {
+        for (size_t j = 0; j < SlotPerBucket; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
@@ -1230,36 +2542,52 @@ private:
                 continue;
             }
             if (eqfn(key, ti->buckets_[i].key(j))) {
-                val = ti->buckets_[i].val(j);
+                if (reclaim_if_expired(ti, i, j)) {
+                    return false;
+                }
+                if (track) {
+                    ti->buckets_[i].touch(j);
+                }
+                fn(ti->buckets_[i].val(j));
                 return true;
             }
         }
         return false;
     }
 
-    // add_to_bucket will insert the given key-value pair into the slot.
-    static void add_to_bucket(TableInfo* ti, const partial_t partial,
+    // add_to_bucket will insert the given key-value pair, whose key hashes to
+    // hv, into the slot, with the given expiry deadline. The slot is
+    // referenced if track is set.
+    static void add_to_bucket(TableInfo* ti, const size_t hv,
                               const key_type &key, const mapped_type &val,
-                              const size_t i, const size_t j) {
+                              const uint64_t deadline,
+                              const size_t i, const size_t j,
+                              const bool track) {
         assert(!ti->buckets_[i].occupied(j));
         if (!is_simple) {
-            ti->buckets_[i].partial(j) = partial;
+            ti->buckets_[i].partial(j) = partial_key(hv);
         }
+        ti->buckets_[i].set_hash(j, hv);
         ti->buckets_[i].setKV(j, key, val);
+        ti->buckets_[i].set_deadline(j, deadline);
+        if (track) {
+            ti->buckets_[i].touch(j);
+        }
         ti->num_inserts[counterid].num.fetch_add(1, std::memory_order_relaxed);
     }
 
     // try_find_insert_bucket will search the bucket and store the index of an
     // empty slot if it finds one, or -1 if it doesn't. Regardless, it will
     // search the entire bucket and return false if it finds the key already in
-    // the table (duplicate key error) and true otherwise.
+    // the table (duplicate key error) and true otherwise. Expired elements
+    // it comes across are reclaimed, and their slots count as empty.
     static bool try_find_insert_bucket(
         TableInfo* ti, const partial_t partial,
         const key_type &key, const size_t i, int& j) {
         j = -1;
         bool found_empty = false;
-        for (size_t k = 0; k < SLOT_PER_BUCKET; ++k) {
-            if (ti->buckets_[i].occupied(k)) {
+        for (size_t k = 0; k < SlotPerBucket; ++k) {
+            if (ti->buckets_[i].occupied(k) && !reclaim_if_expired(ti, i, k)) {
                 if (!is_simple && partial != ti->buckets_[i].partial(k)) {
                     continue;
                 }
@@ -1278,9 +2606,10 @@ private:
 
     // try_del_from_bucket will search the bucket for the given key, and set the
     // slot of the key to empty if it finds it.
+    template <class K>
     static bool try_del_from_bucket(TableInfo* ti, const partial_t partial,
-                                    const key_type &key, const size_t i) {
-        for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                                    const K &key, const size_t i) {
+        for (size_t j = 0; j < SlotPerBucket; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
@@ -1288,6 +2617,9 @@ private:
                 continue;
             }
             if (eqfn(ti->buckets_[i].key(j), key)) {
+                if (reclaim_if_expired(ti, i, j)) {
+                    return false;
+                }
                 ti->buckets_[i].eraseKV(j);
                 ti->num_deletes[counterid].num.fetch_add(
                     1, std::memory_order_relaxed);
@@ -1298,11 +2630,12 @@ private:
     }
 
     // try_update_bucket will search the bucket for the given key and change its
-    // associated value if it finds it.
+    // associated value if it finds it, referencing it if track is set.
+    template <class K>
     static bool try_update_bucket(TableInfo* ti, const partial_t partial,
-                                  const key_type &key, const mapped_type &value,
-                                  const size_t i) {
-        for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                                  const K &key, const mapped_type &value,
+                                  const size_t i, const bool track) {
+        for (size_t j = 0; j < SlotPerBucket; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
@@ -1310,7 +2643,13 @@ private:
                 continue;
             }
             if (eqfn(ti->buckets_[i].key(j), key)) {
+                if (reclaim_if_expired(ti, i, j)) {
+                    return false;
+                }
                 ti->buckets_[i].val(j) = value;
+                if (track) {
+                    ti->buckets_[i].touch(j);
+                }
                 return true;
             }
         }
@@ -1318,12 +2657,13 @@ private:
     }
 
     // try_update_bucket_fn will search the bucket for the given key and change
-    // its associated value with the given function if it finds it.
-    template <typename Updater>
+    // its associated value with the given function if it finds it,
+    // referencing it if track is set.
+    template <class K, typename Updater>
     static bool try_update_bucket_fn(TableInfo* ti, const partial_t partial,
-                                     const key_type &key, Updater fn,
-                                     const size_t i) {
-        for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
+                                     const K &key, Updater fn,
+                                     const size_t i, const bool track) {
+        for (size_t j = 0; j < SlotPerBucket; ++j) {
             if (!ti->buckets_[i].occupied(j)) {
                 continue;
             }
@@ -1331,29 +2671,68 @@ private:
                 continue;
             }
             if (eqfn(ti->buckets_[i].key(j), key)) {
+                if (reclaim_if_expired(ti, i, j)) {
+                    return false;
+                }
                 ti->buckets_[i].val(j) = fn(ti->buckets_[i].val(j));
+                if (track) {
+                    ti->buckets_[i].touch(j);
+                }
                 return true;
             }
         }
         return false;
     }
 
-    // cuckoo_find searches the table for the given key and value, storing the
-    // value in the val if it finds the key. It expects the locks to be taken
-    // and released outside the function.
-    static cuckoo_status cuckoo_find(const key_type& key, mapped_type& val,
-                                     const size_t hv, const TableInfo* ti,
-                                     const size_t i1, const size_t i2) {
+    // cuckoo_find_fn searches the table for the given key, running fn on the
+    // associated value if it finds the key. It sets its reference bit if track
+    // is set, which the callers read from cache_mode_ once per operation. It
+    // expects the locks to be taken and released outside the function.
+    template <class K, typename Reader>
+    static cuckoo_status cuckoo_find_fn(const K& key, Reader& fn,
+                                        const size_t hv, TableInfo* ti,
+                                        const size_t i1, const size_t i2,
+                                        const bool track) {
         const partial_t partial = partial_key(hv);
-        if (try_read_from_bucket(ti, partial, key, val, i1)) {
+        if (try_read_from_bucket_fn(ti, partial, key, fn, i1, track)) {
             return ok;
         }
-        if (try_read_from_bucket(ti, partial, key, val, i2)) {
+        if (try_read_from_bucket_fn(ti, partial, key, fn, i2, track)) {
             return ok;
         }
         return failure_key_not_found;
     }
 
+    // cuckoo_contains checks whether the given key is in the table, without
+    // touching its value. It expects the locks to be taken and released
+    // outside the function.
+    template <class K>
+    static bool cuckoo_contains(const K& key, const size_t hv,
+                                TableInfo* ti,
+                                const size_t i1, const size_t i2) {
+        auto nop = [](const mapped_type&) {};
+        return cuckoo_find_fn(key, nop, hv, ti, i1, i2, false) == ok;
+    }
+
+    // cuckoo_find_slot searches the table for the given key, storing its
+    // bucket and slot in i and j if it finds it. It expects the locks to be
+    // taken and released outside the function.
+    template <class K>
+    static bool cuckoo_find_slot(const K& key, const size_t hv,
+                                 TableInfo* ti, const size_t i1,
+                                 const size_t i2, size_t& i, size_t& j) {
+        const partial_t partial = partial_key(hv);
+        if (try_find_slot(ti, partial, key, i1, j)) {
+            i = i1;
+            return true;
+        }
+        if (try_find_slot(ti, partial, key, i2, j)) {
+            i = i2;
+            return true;
+        }
+        return false;
+    }
+
     // cuckoo_insert tries to insert the given key-value pair into an empty slot
     // in i1 or i2, performing cuckoo hashing if necessary. It expects the locks
     // to be taken outside the function, but they are released here, since
@@ -1362,11 +2741,12 @@ private:
     // hashing presents multiple concurrency issues, which are explained in the
     // function.
     cuckoo_status cuckoo_insert(const key_type &key, const mapped_type &val,
+                                const uint64_t deadline,
                                 const size_t hv, TableInfo* ti,
                                 const size_t i1, const size_t i2) {
-        mapped_type oldval;
         int res1, res2;
         const partial_t partial = partial_key(hv);
+        const bool track = cache_mode_.load(std::memory_order_relaxed);
         if (!try_find_insert_bucket(ti, partial, key, i1, res1)) {
             unlock_two(ti, i1, i2);
             return failure_key_duplicated;
@@ -1376,12 +2756,12 @@ private:
             return failure_key_duplicated;
         }
         if (res1 != -1) {
-            add_to_bucket(ti, partial, key, val, i1, res1);
+            add_to_bucket(ti, hv, key, val, deadline, i1, res1, track);
             unlock_two(ti, i1, i2);
             return ok;
         }
         if (res2 != -1) {
-            add_to_bucket(ti, partial, key, val, i2, res2);
+            add_to_bucket(ti, hv, key, val, deadline, i2, res2, track);
             unlock_two(ti, i1, i2);
             return ok;
         }
@@ -1404,15 +2784,17 @@ private:
             // Since we unlocked the buckets during run_cuckoo, another insert
             // could have inserted the same key into either i1 or i2, so we
             // check for that before doing the insert.
-            if (cuckoo_find(key, oldval, hv, ti, i1, i2) == ok) {
+            if (cuckoo_contains(key, hv, ti, i1, i2)) {
                 unlock_two(ti, i1, i2);
                 return failure_key_duplicated;
             }
-            add_to_bucket(ti, partial, key, val, insert_bucket, insert_slot);
+            add_to_bucket(ti, hv, key, val, deadline, insert_bucket,
+                          insert_slot, track);
             unlock_two(ti, i1, i2);
             return ok;
         }
         assert(st == failure);
+        LIBCUCKOO_STAT(stat_add(displacement_[counterid].table_full));
         LIBCUCKOO_DBG("hash table is full (hashpower = %zu, hash_items = %zu,"
                       "load factor = %.2f), need to increase hashpower\n",
                       ti->hashpower_, cuckoo_size(ti), cuckoo_loadfactor(ti));
@@ -1424,8 +2806,9 @@ private:
     // directly after snapshot_and_lock_two, and by the end of the function, the
     // hazard pointer will have been unset.
     bool cuckoo_insert_loop(const key_type& key, const mapped_type& val,
-                            size_t hv, TableInfo* ti, size_t i1, size_t i2) {
-        cuckoo_status st = cuckoo_insert(key, val, hv, ti, i1, i2);
+                            const uint64_t deadline, size_t hv,
+                            TableInfo* ti, size_t i1, size_t i2) {
+        cuckoo_status st = cuckoo_insert(key, val, deadline, hv, ti, i1, i2);
         while (st != ok) {
             // If the insert failed with failure_key_duplicated, it returns here
             if (st == failure_key_duplicated) {
@@ -1442,7 +2825,7 @@ private:
                 }
             }
             std::tie(ti, i1, i2) = snapshot_and_lock_two(hv);
-            st = cuckoo_insert(key, val, hv, ti, i1, i2);
+            st = cuckoo_insert(key, val, deadline, hv, ti, i1, i2);
         }
         return true;
     }
@@ -1450,7 +2833,8 @@ private:
     // cuckoo_delete searches the table for the given key and sets the slot with
     // that key to empty if it finds it. It expects the locks to be taken and
     // released outside the function.
-    cuckoo_status cuckoo_delete(const key_type &key, const size_t hv,
+    template <class K>
+    cuckoo_status cuckoo_delete(const K &key, const size_t hv,
                                 TableInfo* ti, const size_t i1,
                                 const size_t i2) {
         const partial_t partial = partial_key(hv);
@@ -1466,14 +2850,16 @@ private:
     // cuckoo_update searches the table for the given key and updates its value
     // if it finds it. It expects the locks to be taken and released outside the
     // function.
-    cuckoo_status cuckoo_update(const key_type &key, const mapped_type &val,
+    template <class K>
+    cuckoo_status cuckoo_update(const K &key, const mapped_type &val,
                                 const size_t hv, TableInfo* ti,
                                 const size_t i1, const size_t i2) {
         const partial_t partial = partial_key(hv);
-        if (try_update_bucket(ti, partial, key, val, i1)) {
+        const bool track = cache_mode_.load(std::memory_order_relaxed);
+        if (try_update_bucket(ti, partial, key, val, i1, track)) {
             return ok;
         }
-        if (try_update_bucket(ti, partial, key, val, i2)) {
+        if (try_update_bucket(ti, partial, key, val, i2, track)) {
             return ok;
         }
         return failure_key_not_found;
@@ -1483,15 +2869,16 @@ private:
     // function on its value if it finds it, assigning the result of the
     // function to the value. It expects the locks to be taken and released
     // outside the function.
-    template <typename Updater>
-    cuckoo_status cuckoo_update_fn(const key_type &key, Updater fn,
+    template <class K, typename Updater>
+    cuckoo_status cuckoo_update_fn(const K &key, Updater fn,
                                      const size_t hv, TableInfo* ti,
                                      const size_t i1, const size_t i2) {
         const partial_t partial = partial_key(hv);
-        if (try_update_bucket_fn(ti, partial, key, fn, i1)) {
+        const bool track = cache_mode_.load(std::memory_order_relaxed);
+        if (try_update_bucket_fn(ti, partial, key, fn, i1, track)) {
             return ok;
         }
-        if (try_update_bucket_fn(ti, partial, key, fn, i2)) {
+        if (try_update_bucket_fn(ti, partial, key, fn, i2, track)) {
             return ok;
         }
         return failure_key_not_found;
@@ -1509,9 +2896,7 @@ private:
     // elements it removes from the table. It assumes the locks are taken as
     // necessary.
     cuckoo_status cuckoo_clear(TableInfo* ti) {
-        const size_t num_buckets = ti->buckets_.size();
-        ti->buckets_.clear();
-        ti->buckets_.resize(num_buckets);
+        ti->buckets_.reset();
         for (size_t i = 0; i < ti->num_inserts.size(); ++i) {
             ti->num_inserts[i].num.store(0);
             ti->num_deletes[i].num.store(0);
@@ -1532,20 +2917,36 @@ private:
 
     // cuckoo_loadfactor returns the load factor of the given table.
     double cuckoo_loadfactor(const TableInfo* ti) const {
-        return static_cast<double>(cuckoo_size(ti)) / SLOT_PER_BUCKET /
+        return static_cast<double>(cuckoo_size(ti)) / SlotPerBucket /
             hashsize(ti->hashpower_);
     }
 
-    // insert_into_table is a helper function used by cuckoo_expand_simple to
-    // fill up the new table.
+    // insert_into_table is a helper function used by cuckoo_migrate to fill up
+    // the new table.
     static void insert_into_table(
-        cuckoohash_map<Key, T, Hash>& new_map, const TableInfo* old_ti,
+        cuckoohash_map& new_map, const TableInfo* old_ti,
         size_t i, size_t end) {
+        const uint64_t now = WithExpiry ? cuckoo_now_ms() : 0;
+        const bool scanning = old_ti->scanning.load();
+        const size_t frontier = old_ti->scan_frontier.load();
         for (;i < end; ++i) {
-            for (size_t j = 0; j < SLOT_PER_BUCKET; ++j) {
-                if (old_ti->buckets_[i].occupied(j)) {
-                    new_map.insert(old_ti->buckets_[i].key(j),
-                                   old_ti->buckets_[i].val(j));
+            for (size_t j = 0; j < SlotPerBucket; ++j) {
+                if (!old_ti->buckets_[i].occupied(j)) {
+                    continue;
+                }
+                // Expired elements are dropped instead of copied
+                const uint64_t deadline = old_ti->buckets_[i].deadline(j);
+                if (deadline != 0 && deadline <= now) {
+                    continue;
+                }
+                const key_type& key = old_ti->buckets_[i].key(j);
+                new_map.insert_deadline(key, old_ti->buckets_[i].val(j),
+                                        deadline);
+                // The running weak scan must not see the elements it has
+                // already visited again in the new table
+                if (scanning && (lock_ind(i) < frontier ||
+                                 old_ti->buckets_[i].scanned(j))) {
+                    new_map.mark_scanned(key);
                 }
             }
         }
@@ -1557,19 +2958,156 @@ private:
     // the table during expansion. If some other thread is holding the expansion
     // thread at the time, then it will return failure_under_expansion.
     cuckoo_status cuckoo_expand_simple(size_t n) {
-        TableInfo* ti = snapshot_and_lock_all();
-        assert(ti == table_info.load());
-        AllUnlocker au(ti);
-        HazardPointerUnsetter hpu;
-        if (n <= ti->hashpower_) {
-            // Most likely another expansion ran before this one could grab the
-            // locks
-            return failure_under_expansion;
+        cuckoo_status st;
+        {
+            TableInfo* ti = snapshot_and_lock_all();
+            assert(ti == table_info.load());
+            AllUnlocker au(ti);
+            HazardPointerUnsetter hpu;
+            if (n <= ti->hashpower_) {
+                // Most likely another expansion ran before this one could grab
+                // the locks
+                return failure_under_expansion;
+            }
+            st = cuckoo_migrate(ti, n);
+        }
+        delete_old_tables();
+        return st;
+    }
+
+    // cuckoo_shrink_simple is the counterpart of cuckoo_expand_simple which
+    // moves the table to the smaller hashpower n. If the table is already
+    // that small by the time it has all the locks, it returns
+    // failure_under_expansion.
+    cuckoo_status cuckoo_shrink_simple(size_t n) {
+        cuckoo_status st;
+        {
+            TableInfo* ti = snapshot_and_lock_all();
+            assert(ti == table_info.load());
+            AllUnlocker au(ti);
+            HazardPointerUnsetter hpu;
+            if (n >= ti->hashpower_) {
+                return failure_under_expansion;
+            }
+            st = cuckoo_migrate(ti, n);
         }
+        delete_old_tables();
+        return st;
+    }
+
+    // delete_old_tables frees the tables replaced by cuckoo_migrate that no
+    // thread is using anymore, and returns true if none are left. It runs
+    // after the replaced table is unlocked, and with this thread's hazard
+    // pointer unset, so the table just replaced is freed right away unless
+    // another thread still uses it.
+    bool delete_old_tables() {
+        std::unique_lock<std::mutex> ul(old_table_infos_lock_);
+        global_hazard_pointers.delete_unused(old_table_infos);
+        return old_table_infos.empty();
+    }
+
+    // cuckoo_migrate moves all the elements of the table to a new table with
+    // hashpower n, inserting them in parallel, or splitting the buckets with
+    // cuckoo_split if the table stores hashes and grows, and replaces the
+    // table with it. It expects all the locks of ti to be taken. When
+    // shrinking, the elements may not fit in the new table, in which case the
+    // inserts expand it as usual.
+    cuckoo_status cuckoo_migrate(TableInfo* ti, size_t n) {
+#if LIBCUCKOO_STATS
+        const auto start = std::chrono::steady_clock::now();
+#endif
+        TableInfo* new_ti;
+        if (StoreHash && n > ti->hashpower_) {
+            new_ti = cuckoo_split(ti, n);
+        } else {
+            // Creates a new hash table with hashpower n and adds all the
+            // elements from the old buckets. It then sets new_map's
+            // table_info to nullptr, so that it doesn't get deleted when
+            // new_map goes out of scope
+            cuckoohash_map new_map(hashsize(n) * SlotPerBucket);
+            insert_all(new_map, ti);
+            new_ti = new_map.table_info.load();
+            new_map.table_info.store(nullptr);
+        }
+#if LIBCUCKOO_STATS
+        const uint64_t ns = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        stat_add(resizes_);
+        resize_ns_.fetch_add(ns);
+        if (ns > max_resize_ns_.load()) {
+            max_resize_ns_.store(ns);
+        }
+        bytes_moved_.fetch_add(cuckoo_size(new_ti) *
+                               (sizeof(key_type) + sizeof(mapped_type)));
+#endif
+        replace_table(ti, new_ti);
+        return ok;
+    }
+
+    // cuckoo_split returns a new table with hashpower n, larger than ti's,
+    // holding all the elements of ti. Since alt_index keeps the low bits of
+    // both indices of an element as the table grows, the element in bucket
+    // i of ti belongs in the bucket of the new table whose low bits are i
+    // among its two, which its stored hash gives. So the buckets split
+    // without hashing keys or searching cuckoo paths, and every element
+    // keeps its slot. Expired elements are dropped, as in insert_into_table.
+    // The buckets of ti are split between one thread per core.
+    static TableInfo* cuckoo_split(const TableInfo* ti, const size_t n) {
+        std::unique_ptr<TableInfo> new_ti(new TableInfo(n));
+        const size_t threadnum = kNumCores;
+        const size_t num_buckets = hashsize(ti->hashpower_);
+        const size_t old_mask = hashmask(ti->hashpower_);
+        const uint64_t now = WithExpiry ? cuckoo_now_ms() : 0;
+        const bool scanning = ti->scanning.load();
+        const size_t frontier = ti->scan_frontier.load();
+        parallel_for([&](size_t t) {
+                check_counterid();
+                size_t moved = 0;
+                for (size_t i = num_buckets * t / threadnum;
+                     i < num_buckets * (t + 1) / threadnum; ++i) {
+                    const Bucket& b = ti->buckets_[i];
+                    for (size_t j = 0; j < SlotPerBucket; ++j) {
+                        if (!b.occupied(j)) {
+                            continue;
+                        }
+                        const uint64_t deadline = b.deadline(j);
+                        if (deadline != 0 && deadline <= now) {
+                            continue;
+                        }
+                        const size_t hv = b.hash(j);
+                        size_t ni = index_hash(new_ti.get(), hv);
+                        if ((ni & old_mask) != i) {
+                            ni = alt_index(new_ti.get(), hv, ni);
+                        }
+                        assert((ni & old_mask) == i);
+                        Bucket& nb = new_ti->buckets_[ni];
+                        if (!is_simple) {
+                            nb.partial(j) = b.partial(j);
+                        }
+                        nb.set_hash(j, hv);
+                        nb.setKV(j, b.key(j), b.val(j));
+                        nb.set_deadline(j, deadline);
+                        if (b.referenced(j)) {
+                            nb.touch(j);
+                        }
+                        // The running weak scan must not see the elements
+                        // it has already visited again in the new table
+                        nb.set_scanned(j, scanning &&
+                                       (lock_ind(i) < frontier ||
+                                        b.scanned(j)));
+                        ++moved;
+                    }
+                }
+                new_ti->num_inserts[counterid].num.fetch_add(
+                    moved, std::memory_order_relaxed);
+            });
+        return new_ti.release();
+    }
 
-        // Creates a new hash table with hashpower n and adds all the
-        // elements from the old buckets
-        cuckoohash_map<Key, T, Hash> new_map(hashsize(n) * SLOT_PER_BUCKET);
+    // insert_all inserts all the elements of ti into new_map, splitting its
+    // buckets between one thread per core.
+    static void insert_all(cuckoohash_map& new_map, const TableInfo* ti) {
         const size_t threadnum = kNumCores;
         const size_t buckets_per_thread =
             hashsize(ti->hashpower_) / threadnum;
@@ -1585,17 +3123,367 @@ private:
         for (size_t i = 0; i < threadnum; ++i) {
             insertion_threads[i].join();
         }
-        // Sets this table_info to new_map's. It then sets new_map's
-        // table_info to nullptr, so that it doesn't get deleted when
-        // new_map goes out of scope
-        table_info.store(new_map.table_info.load());
-        new_map.table_info.store(nullptr);
+    }
+
+    // parallel_for runs fn(t) for each t in [0, kNumCores), each in its own
+    // thread.
+    template <class Fn>
+    static void parallel_for(Fn fn) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < kNumCores; ++t) {
+            threads.emplace_back(fn, t);
+        }
+        for (size_t t = 0; t < kNumCores; ++t) {
+            threads[t].join();
+        }
+    }
+
+    // bulk_place puts key and val in bucket i of ti, or assigns val to key
+    // if the bucket already holds it. It returns false if it couldn't,
+    // because the bucket is full. It takes no locks, see bulk_load.
+    static bool bulk_place(TableInfo* ti, const size_t hv,
+                           const key_type& key, const mapped_type& val,
+                           const size_t i, const bool track) {
+        const partial_t partial = partial_key(hv);
+        Bucket& b = ti->buckets_[i];
+        int free = -1;
+        for (size_t j = 0; j < SlotPerBucket; ++j) {
+            if (!b.occupied(j)) {
+                if (free < 0) {
+                    free = j;
+                }
+                continue;
+            }
+            if (!is_simple && partial != b.partial(j)) {
+                continue;
+            }
+            if (eqfn(key, b.key(j))) {
+                b.val(j) = val;
+                if (track) {
+                    b.touch(j);
+                }
+                return true;
+            }
+        }
+        if (free < 0) {
+            return false;
+        }
+        add_to_bucket(ti, hv, key, val, 0, i, free, track);
+        return true;
+    }
+
+    // bulk_place_all places the n pairs at first in the empty table ti, whose
+    // locks must all be taken, as described in bulk_load. The buckets are
+    // split in kBulkGroups contiguous groups, and each thread owns the
+    // groups equal to its index modulo the number of threads, so every
+    // bucket is only written by one thread, and the buckets a thread writes
+    // at any one time are close together. Each thread goes through the pairs
+    // of a group in input order, so the pairs sharing a key go to the same
+    // thread in the same order and the last one is kept. The indices of
+    // the pairs that didn't fit in either bucket are added to overflow. The
+    // pairs placed are referenced if track is set.
+    template <class RandomIt>
+    static void bulk_place_all(TableInfo* ti, RandomIt first, const size_t n,
+                               std::vector<std::vector<size_t> >& overflow,
+                               const bool track) {
+        const size_t threadnum = kNumCores;
+        const size_t group_bits = ti->hashpower_ < kBulkGroupBits ?
+            ti->hashpower_ : kBulkGroupBits;
+        const size_t num_groups = size_t(1) << group_bits;
+        const size_t shift = ti->hashpower_ - group_bits;
+        // lists[t][g] holds the pairs thread t hands to the owner of group
+        // g, in input order
+        typedef std::vector<std::vector<std::vector<BulkEntry> > > lists_t;
+        lists_t pending(threadnum, std::vector<std::vector<BulkEntry> >(
+                            num_groups));
+        parallel_for([&](size_t t) {
+                for (size_t i = n * t / threadnum;
+                     i < n * (t + 1) / threadnum; ++i) {
+                    const size_t hv = hashed_key(first[i].first);
+                    pending[t][index_hash(ti, hv) >> shift].push_back(
+                        BulkEntry{hv, i});
+                }
+            });
+
+        // Each owner places the pairs of its groups in their first bucket,
+        // and hands the ones left over to the owner of their second bucket
+        lists_t left(threadnum, std::vector<std::vector<BulkEntry> >(
+                         num_groups));
+        parallel_for([&](size_t o) {
+                check_counterid();
+                for (size_t g = o; g < num_groups; g += threadnum) {
+                    for (size_t t = 0; t < threadnum; ++t) {
+                        bulk_place_list(
+                            ti, first, pending[t][g], false, track,
+                            [&](const BulkEntry& e, size_t i2) {
+                                left[o][i2 >> shift].push_back(e);
+                            });
+                        std::vector<BulkEntry>().swap(pending[t][g]);
+                    }
+                }
+            });
+
+        parallel_for([&](size_t o) {
+                check_counterid();
+                for (size_t g = o; g < num_groups; g += threadnum) {
+                    for (size_t t = 0; t < threadnum; ++t) {
+                        bulk_place_list(
+                            ti, first, left[t][g], true, track,
+                            [&](const BulkEntry& e, size_t) {
+                                overflow[o].push_back(e.index);
+                            });
+                    }
+                }
+            });
+    }
+
+    // bulk_assign inserts key with val, or assigns val to it if it is
+    // already in the table, for the pairs bulk_load doesn't place itself.
+    void bulk_assign(const key_type& key, const mapped_type& val) {
+        upsert(key, [&val](const mapped_type&) { return val; }, val);
+    }
+
+    // BulkEntry is a pair to place, by its hash and index, see
+    // bulk_place_all.
+    struct BulkEntry {
+        size_t hv;
+        size_t index;
+    };
+
+    // bulk_place_list places the pairs of list in their first bucket, or
+    // their second if second is true, and calls full(entry, other bucket)
+    // for those whose bucket is full. Since the pairs are scattered over
+    // the input, it prefetches them a few entries ahead.
+    template <class RandomIt, class Full>
+    static void bulk_place_list(TableInfo* ti, RandomIt first,
+                                const std::vector<BulkEntry>& list,
+                                const bool second, const bool track,
+                                Full full) {
+        const size_t ahead = 8;
+        for (size_t k = 0; k < list.size(); ++k) {
+            if (k + ahead < list.size()) {
+                __builtin_prefetch(&*(first + list[k + ahead].index));
+            }
+            const BulkEntry& e = list[k];
+            const size_t i1 = index_hash(ti, e.hv);
+            const size_t i2 = alt_index(ti, e.hv, i1);
+            const auto& kv = first[e.index];
+            if (!bulk_place(ti, e.hv, kv.first, kv.second,
+                            second ? i2 : i1, track)) {
+                full(e, second ? i1 : i2);
+            }
+        }
+    }
+
+    // replace_table makes new_ti the current table in place of ti, whose
+    // locks must all be taken.
+    void replace_table(TableInfo* ti, TableInfo* new_ti) {
+        // Keeps the count of lazily expired elements of the old table
+        for (size_t i = 0; i < ti->num_expired.size(); ++i) {
+            lazy_expired_carry_.fetch_add(ti->num_expired[i].num.load());
+        }
+        // A running weak scan continues on the new table from its start
+        new_ti->scanning.store(ti->scanning.load());
+        table_info.store(new_ti);
 
-        // Rather than deleting ti now, we store it in old_table_infos. We then
-        // run a delete_unused routine to delete all the old table pointers.
+        // Rather than deleting ti now, we store it in old_table_infos. Once
+        // it is unlocked, the caller runs delete_old_tables to delete all
+        // the old table pointers.
+        std::unique_lock<std::mutex> ul(old_table_infos_lock_);
         old_table_infos.push_back(std::move(std::unique_ptr<TableInfo>(ti)));
-        global_hazard_pointers.delete_unused(old_table_infos);
-        return ok;
+    }
+
+    // DumpHeader starts a dump file, see dump. It is followed by
+    // num_samples pairs of a key's hash and the key's bytes, then padded to
+    // kDumpHeaderSize bytes, after which come the buckets exactly as they
+    // are laid out in memory.
+    struct DumpHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t slot_per_bucket;
+        uint64_t bucket_size;
+        uint64_t key_size;
+        uint64_t mapped_size;
+        // type_id of the key and mapped types, and whether buckets hold
+        // partial keys, deadlines and hashes, which must match for the
+        // buckets to be usable at all
+        uint64_t layout_id;
+        // type_id of the hasher, which must match, along with the hashes of
+        // the samples, for load to use the buckets in place
+        uint64_t hasher_id;
+        uint64_t hashpower;
+        uint64_t size;
+        // the steady and system clocks when the dump was written, in
+        // milliseconds, which load uses to carry expiry deadlines over
+        uint64_t steady_ms;
+        uint64_t system_ms;
+        uint64_t num_samples;
+    };
+
+    // type_id returns an FNV-1a hash of the name of type U, mixed into h.
+    template <class U>
+    static uint64_t type_id(uint64_t h = 14695981039346656037ULL) {
+        for (const char* c = typeid(U).name(); *c != '\0'; ++c) {
+            h = (h ^ static_cast<unsigned char>(*c)) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static uint64_t dump_layout_id() {
+        const uint64_t h = type_id<mapped_type>(type_id<key_type>());
+        return (h ^ (is_simple ? 1 : 0) ^ (WithExpiry ? 2 : 0) ^
+                (StoreHash ? 4 : 0)) * 1099511628211ULL;
+    }
+
+    static uint64_t system_now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // dump_samples returns how many sample keys fit in a dump header.
+    static size_t dump_samples() {
+        const size_t fit = (kDumpHeaderSize - sizeof(DumpHeader)) /
+            (sizeof(uint64_t) + sizeof(key_type));
+        return fit < kDumpMaxSamples ? fit : kDumpMaxSamples;
+    }
+
+    static void throw_file_error(const char* what, const std::string& path) {
+        throw std::system_error(errno, std::generic_category(),
+                                std::string(what) + " " + path);
+    }
+
+    // FileCloser closes a file descriptor when it's destroyed.
+    class FileCloser {
+        int fd_;
+    public:
+        FileCloser(int fd): fd_(fd) {}
+        ~FileCloser() {
+            if (fd_ >= 0) {
+                close(fd_);
+            }
+        }
+    };
+
+    static void write_all(int fd, const void* data, size_t len,
+                          const std::string& path) {
+        const char* p = static_cast<const char*>(data);
+        while (len > 0) {
+            const ssize_t n = write(fd, p, len);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw_file_error("cannot write", path);
+            }
+            p += n;
+            len -= n;
+        }
+    }
+
+    // dump_table writes the header and the buckets of ti to fd. It expects
+    // all the locks of ti to be taken.
+    void dump_table(const TableInfo* ti, int fd,
+                    const std::string& path) const {
+        std::vector<char> page(kDumpHeaderSize);
+        DumpHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, "CUCKOODM", sizeof(hdr.magic));
+        hdr.version = kDumpVersion;
+        hdr.slot_per_bucket = SlotPerBucket;
+        hdr.bucket_size = sizeof(Bucket);
+        hdr.key_size = sizeof(key_type);
+        hdr.mapped_size = sizeof(mapped_type);
+        hdr.layout_id = dump_layout_id();
+        hdr.hasher_id = type_id<hasher>();
+        hdr.hashpower = ti->hashpower_;
+        hdr.size = cuckoo_size(ti);
+        hdr.steady_ms = cuckoo_now_ms();
+        hdr.system_ms = system_now_ms();
+
+        // The first keys of the table are the samples
+        char* sample = page.data() + sizeof(DumpHeader);
+        const size_t max_samples = dump_samples();
+        for (size_t i = 0; i < ti->buckets_.size() &&
+                 hdr.num_samples < max_samples; ++i) {
+            for (size_t j = 0; j < SlotPerBucket &&
+                     hdr.num_samples < max_samples; ++j) {
+                if (!ti->buckets_[i].occupied(j)) {
+                    continue;
+                }
+                const key_type& key = ti->buckets_[i].key(j);
+                const uint64_t hv = hashed_key(key);
+                memcpy(sample, &hv, sizeof(hv));
+                memcpy(sample + sizeof(hv), &key, sizeof(key_type));
+                sample += sizeof(hv) + sizeof(key_type);
+                ++hdr.num_samples;
+            }
+        }
+        memcpy(page.data(), &hdr, sizeof(hdr));
+        write_all(fd, page.data(), page.size(), path);
+
+        // The buckets are copied out in chunks, to clear the marks of a
+        // running weak scan, which mean nothing to the loaded table
+        const size_t chunk = std::max<size_t>((1 << 20) / sizeof(Bucket), 1);
+        std::vector<char> buf(chunk * sizeof(Bucket));
+        Bucket* out = static_cast<Bucket*>(static_cast<void*>(buf.data()));
+        for (size_t i = 0; i < ti->buckets_.size(); i += chunk) {
+            const size_t n = std::min(chunk, ti->buckets_.size() - i);
+            memcpy(static_cast<void*>(out),
+                   static_cast<const void*>(&ti->buckets_[i]),
+                   n * sizeof(Bucket));
+            for (size_t k = 0; k < n; ++k) {
+                for (size_t j = 0; j < SlotPerBucket; ++j) {
+                    out[k].set_scanned(j, false);
+                }
+            }
+            write_all(fd, buf.data(), n * sizeof(Bucket), path);
+        }
+    }
+
+    // same_hash returns true if the table hashes keys the way the one that
+    // wrote the dump with header page did.
+    static bool same_hash(const char* page) {
+        DumpHeader hdr;
+        memcpy(&hdr, page, sizeof(hdr));
+        if (hdr.hasher_id != type_id<hasher>()) {
+            return false;
+        }
+        const char* sample = page + sizeof(DumpHeader);
+        for (size_t i = 0; i < hdr.num_samples; ++i) {
+            uint64_t hv;
+            typename std::aligned_storage<
+                sizeof(key_type), alignof(key_type)>::type key;
+            memcpy(&hv, sample, sizeof(hv));
+            memcpy(&key, sample + sizeof(hv), sizeof(key_type));
+            if (hashed_key(*static_cast<const key_type*>(
+                               static_cast<const void*>(&key))) != hv) {
+                return false;
+            }
+            sample += sizeof(hv) + sizeof(key_type);
+        }
+        return true;
+    }
+
+    // rebase_deadlines moves the expiry deadlines of a loaded table from the
+    // steady clock of the process that dumped it to this one, taking off the
+    // wall clock time that passed since. Entries that expired meanwhile get
+    // a deadline in the past.
+    static void rebase_deadlines(TableInfo* ti, const DumpHeader& hdr) {
+        const uint64_t now = cuckoo_now_ms();
+        const uint64_t system_now = system_now_ms();
+        const uint64_t elapsed = system_now > hdr.system_ms ?
+            system_now - hdr.system_ms : 0;
+        for (size_t i = 0; i < ti->buckets_.size(); ++i) {
+            Bucket& b = ti->buckets_[i];
+            for (size_t j = 0; j < SlotPerBucket; ++j) {
+                if (!b.occupied(j) || b.deadline(j) == 0) {
+                    continue;
+                }
+                const uint64_t left = b.deadline(j) > hdr.steady_ms ?
+                    b.deadline(j) - hdr.steady_ms : 0;
+                b.set_deadline(j, left > elapsed ? now + left - elapsed : 1);
+            }
+        }
     }
 
     // Iterator definitions
@@ -1625,9 +3513,9 @@ public:
         // table, based on the boolean argument. We keep this constructor
         // private (but expose it to the cuckoohash_map class), since we don't
         // want users calling it.
-        const_iterator(const cuckoohash_map<Key, T, Hash, Pred>& hm,
+        const_iterator(const cuckoohash_map& hm,
                        bool is_end) : hm_(hm) {
-            cuckoohash_map<Key, T, Hash, Pred>::check_hazard_pointer();
+            cuckoohash_map::check_hazard_pointer();
             ti_ = hm_.snapshot_and_lock_all();
             assert(ti_ == hm_.table_info.load());
 
@@ -1646,7 +3534,7 @@ public:
             }
         }
 
-        friend class cuckoohash_map<Key, T, Hash, Pred>;
+        friend class cuckoohash_map;
 
     public:
         //! This is an rvalue-reference constructor that takes the lock from \p
@@ -1678,7 +3566,7 @@ public:
         void release() {
             if (has_table_lock) {
                 AllUnlocker au(ti_);
-                cuckoohash_map<Key, T, Hash, Pred>::HazardPointerUnsetter hpu;
+                cuckoohash_map::HazardPointerUnsetter hpu;
                 has_table_lock = false;
             }
         }
@@ -1791,10 +3679,10 @@ public:
 
     protected:
         // A pointer to the associated hashmap
-        const cuckoohash_map<Key, T, Hash, Pred>& hm_;
+        const cuckoohash_map& hm_;
 
         // The hashmap's table info
-        typename cuckoohash_map<Key, T, Hash, Pred>::TableInfo* ti_;
+        typename cuckoohash_map::TableInfo* ti_;
 
         // Indicates whether the iterator has the table lock
         bool has_table_lock;
@@ -1843,7 +3731,7 @@ public:
         // advances, and false if it has reached the end of the table, in which
         // case it sets index and slot to end_pos.
         bool forward_slot(size_t& index, size_t& slot) {
-            if (slot < SLOT_PER_BUCKET-1) {
+            if (slot < SlotPerBucket-1) {
                 ++slot;
                 return true;
             } else if (index < hm_.bucket_count()-1) {
@@ -1866,7 +3754,7 @@ public:
                 return true;
             } else if (index > 0) {
                 --index;
-                slot = SLOT_PER_BUCKET-1;
+                slot = SlotPerBucket-1;
                 return true;
             } else {
                 set_begin(index, slot);
@@ -1928,10 +3816,10 @@ public:
     class iterator : public const_iterator {
         // This constructor does the same thing as the private const_iterator
         // one.
-        iterator(cuckoohash_map<Key, T, Hash, Pred>& hm, bool is_end)
+        iterator(cuckoohash_map& hm, bool is_end)
             : const_iterator(hm, is_end) {}
 
-        friend class cuckoohash_map<Key, T, Hash, Pred>;
+        friend class cuckoohash_map;
 
     public:
         //! This constructor is identical to the rvalue-reference constructor of
@@ -2002,46 +3890,197 @@ public:
         }
         return items;
     }
-};
 
-// Initializing the static members
-template <class Key, class T, class Hash, class Pred>
-    __thread typename cuckoohash_map<Key, T, Hash, Pred>::TableInfo**
-    cuckoohash_map<Key, T, Hash, Pred>::hazard_pointer = nullptr;
-
-template <class Key, class T, class Hash, class Pred>
-    __thread int cuckoohash_map<Key, T, Hash, Pred>::counterid = -1;
+    //! for_each_weak calls \p fn with the key and value of every element in
+    //! the table. Unlike \ref cbegin, it doesn't lock the whole table for the
+    //! entire iteration: it walks the table one lock stripe at a time, and
+    //! only holds the lock of the stripe whose elements it is passing to \p
+    //! fn, so other operations keep running. The iteration is weakly
+    //! consistent. Every element that is in the table for the whole
+    //! iteration is seen exactly once, even if the table is expanded in the
+    //! meantime, while elements inserted or erased during the iteration may
+    //! or may not be seen. \p fn must not call into the table. Weak scans of
+    //! one table run one at a time.
+    template <typename Visitor>
+    void for_each_weak(Visitor fn) const {
+        check_hazard_pointer();
+        std::unique_lock<std::mutex> ul(scan_lock_);
+        HazardPointerUnsetter hpu;
+        TableInfo* ti = snapshot_table_nolock();
+        ti->scan_frontier.store(0);
+        ti->scanning.store(true);
+        try {
+            walk_stripes(ti, [&fn](TableInfo* cur, size_t stripe) {
+                    scan_stripe(cur, stripe, fn);
+                    cur->scan_frontier.store(stripe + 1,
+                                             std::memory_order_relaxed);
+                });
+        } catch (...) {
+            // Remove the marks the scan may have left in an expanded table
+            walk_stripes(ti, [](TableInfo* cur, size_t stripe) {
+                    clear_scan_marks(cur, stripe);
+                });
+            ti->scanning.store(false);
+            throw;
+        }
+        ti->scanning.store(false);
+    }
 
-template <class Key, class T, class Hash, class Pred>
-    typename cuckoohash_map<Key, T, Hash, Pred>::hasher
-    cuckoohash_map<Key, T, Hash, Pred>::hashfn;
+    //! snapshot_table_weak is the weakly consistent counterpart of \ref
+    //! snapshot_table, built on \ref for_each_weak.
+    std::vector<value_type> snapshot_table_weak() const {
+        std::vector<value_type> items;
+        items.reserve(size());
+        for_each_weak([&items](const key_type& k, const mapped_type& v) {
+                items.emplace_back(k, v);
+            });
+        return items;
+    }
 
-template <class Key, class T, class Hash, class Pred>
-    typename cuckoohash_map<Key, T, Hash, Pred>::key_equal
-    cuckoohash_map<Key, T, Hash, Pred>::eqfn;
+private:
+    // num_stripes returns the number of lock stripes that guard buckets of
+    // the table. Stripe s guards buckets s, s + num_stripes, and so on.
+    static size_t num_stripes(const TableInfo* ti) {
+        return std::min(hashsize(ti->hashpower_), size_t(kNumLocks));
+    }
+
+    // walk_stripes calls fn(ti, stripe) on every lock stripe of the table in
+    // order, holding the lock of the stripe. If an expansion replaces the
+    // table, it continues on the new table from its first stripe, updating
+    // ti and the hazard pointer.
+    template <typename StripeFn>
+    void walk_stripes(TableInfo*& ti, StripeFn fn) const {
+        size_t stripe = 0;
+        while (stripe < num_stripes(ti)) {
+            lock(ti, stripe);
+            if (ti != table_info.load()) {
+                unlock(ti, stripe);
+                ti = snapshot_table_nolock();
+                stripe = 0;
+                continue;
+            }
+            try {
+                fn(ti, stripe);
+            } catch (...) {
+                unlock(ti, stripe);
+                throw;
+            }
+            unlock(ti, stripe);
+            ++stripe;
+        }
+    }
+
+    // scan_stripe calls fn on the elements of the buckets guarded by the
+    // given stripe, skipping expired elements and the elements the scan has
+    // already visited before an expansion, whose marks it removes.
+    template <typename Visitor>
+    static void scan_stripe(TableInfo* ti, const size_t stripe,
+                            Visitor& fn) {
+        const uint64_t now = WithExpiry ? cuckoo_now_ms() : 0;
+        const size_t step = num_stripes(ti);
+        for (size_t i = stripe; i < ti->buckets_.size(); i += step) {
+            Bucket& b = ti->buckets_[i];
+            for (size_t j = 0; j < SlotPerBucket; ++j) {
+                if (!b.occupied(j)) {
+                    continue;
+                }
+                if (b.scanned(j)) {
+                    b.set_scanned(j, false);
+                    continue;
+                }
+                if (b.deadline(j) != 0 && b.deadline(j) <= now) {
+                    continue;
+                }
+                fn(b.key(j), b.val(j));
+            }
+        }
+    }
 
-template <class Key, class T, class Hash, class Pred>
-    typename cuckoohash_map<Key, T, Hash, Pred>::GlobalHazardPointerList
-    cuckoohash_map<Key, T, Hash, Pred>::global_hazard_pointers;
+    // clear_scan_marks removes the marks of a weak scan from the buckets
+    // guarded by the given stripe.
+    static void clear_scan_marks(TableInfo* ti, const size_t stripe) {
+        const size_t step = num_stripes(ti);
+        for (size_t i = stripe; i < ti->buckets_.size(); i += step) {
+            for (size_t j = 0; j < SlotPerBucket; ++j) {
+                ti->buckets_[i].set_scanned(j, false);
+            }
+        }
+    }
+};
 
-template <class Key, class T, class Hash, class Pred>
-    const size_t cuckoohash_map<Key, T, Hash, Pred>::kNumCores =
+// Initializing the static members
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
+    __thread typename cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::TableInfo**
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::hazard_pointer =
+    nullptr;
+
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
+    __thread int cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::counterid = -1;
+
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
+    typename cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::hasher
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::hashfn;
+
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
+    typename cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::key_equal
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::eqfn;
+
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
+    typename cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::GlobalHazardPointerList
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::global_hazard_pointers;
+
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
+    const size_t cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::kNumCores =
     std::thread::hardware_concurrency() == 0 ?
     sysconf(_SC_NPROCESSORS_ONLN) : std::thread::hardware_concurrency();
 
-template <class Key, class T, class Hash, class Pred>
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
     const std::out_of_range
-    cuckoohash_map<Key, T, Hash, Pred>::const_iterator::end_dereference(
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::const_iterator::
+    end_dereference(
         "Cannot dereference: iterator points past the end of the table");
 
-template <class Key, class T, class Hash, class Pred>
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
     const std::out_of_range
-    cuckoohash_map<Key, T, Hash, Pred>::const_iterator::end_increment(
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::const_iterator::
+    end_increment(
         "Cannot increment: iterator points past the end of the table");
 
-template <class Key, class T, class Hash, class Pred>
+template <class Key, class T, class Hash, class Pred, class Lock,
+          bool WithExpiry, size_t SlotPerBucket, size_t NumLocks,
+          bool StoreHash>
     const std::out_of_range
-    cuckoohash_map<Key, T, Hash, Pred>::const_iterator::begin_decrement(
+    cuckoohash_map<Key, T, Hash, Pred, Lock, WithExpiry,
+                   SlotPerBucket, NumLocks, StoreHash>::const_iterator::
+    begin_decrement(
         "Cannot decrement: iterator points to the beginning of the table");
 
 #endif
@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <pthread.h>
+#include <type_traits>
 #include "cuckoohash_config.h" // for LIBCUCKOO_DEBUG
 
 #if LIBCUCKOO_DEBUG
@@ -10,4 +11,26 @@
 #  define LIBCUCKOO_DBG(fmt, args...)  do {} while (0)
 #endif
 
+// LIBCUCKOO_STAT runs a statement that updates a statistic, only if
+// LIBCUCKOO_STATS is set.
+#if LIBCUCKOO_STATS
+#  define LIBCUCKOO_STAT(stmt)  do { stmt; } while (0)
+#else
+#  define LIBCUCKOO_STAT(stmt)  do {} while (0)
+#endif
+
+//! cuckoo_is_transparent detects the \p is_transparent member typedef, which
+//! marks a hasher or key equality predicate as able to operate on types other
+//! than the table's key type (for example \p std::string_view for \p
+//! std::string keys).
+template <class... Ts> struct cuckoo_voider { typedef void type; };
+
+template <class F, class = void>
+struct cuckoo_is_transparent : std::false_type {};
+
+template <class F>
+struct cuckoo_is_transparent<
+    F, typename cuckoo_voider<typename F::is_transparent>::type>
+    : std::true_type {};
+
 #endif
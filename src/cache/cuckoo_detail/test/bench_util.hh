@@ -0,0 +1,125 @@
+/* Helpers shared by the cuckoohash_map benchmarks: key distributions,
+ * key scrambling and latency histograms. */
+
+#ifndef _CUCKOO_BENCH_UTIL_HH
+#define _CUCKOO_BENCH_UTIL_HH
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// zipf_generator draws item ranks in [0, n) where the probability of rank
+// i is proportional to 1 / (i + 1)^theta, by binary search on the CDF.
+class zipf_generator {
+    std::vector<double> cdf_;
+    std::uniform_real_distribution<double> uniform_;
+
+public:
+    zipf_generator(size_t n, double theta) : cdf_(n), uniform_(0.0, 1.0) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) {
+            sum += 1.0 / std::pow(i + 1.0, theta);
+            cdf_[i] = sum;
+        }
+        for (size_t i = 0; i < n; i++) {
+            cdf_[i] /= sum;
+        }
+    }
+
+    template <class Gen>
+    size_t operator()(Gen& gen) {
+        const double u = uniform_(gen);
+        return std::min<size_t>(
+            std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin(),
+            cdf_.size() - 1);
+    }
+};
+
+// scramble maps item ranks to keys (splitmix64), so popular keys are spread
+// over the table instead of being consecutive integers.
+inline uint64_t scramble(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// latency_histogram records latencies in nanoseconds in log-linear buckets:
+// each power of two is split in kSubBuckets, so percentiles are accurate to
+// within 1/kSubBuckets of their value, at a fixed memory cost.
+class latency_histogram {
+    static const size_t kSubBits = 5;
+    static const size_t kSubBuckets = 1 << kSubBits;
+    static const size_t kMaxBits = 48;
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+
+    static size_t bucket_of(uint64_t ns) {
+        if (ns < kSubBuckets) {
+            return ns;
+        }
+        const size_t bits = 64 - __builtin_clzll(ns);
+        const size_t shift = bits - kSubBits - 1;
+        return (shift + 1) * kSubBuckets + ((ns >> shift) - kSubBuckets);
+    }
+
+    // bucket_value returns the largest latency that falls in bucket b.
+    static uint64_t bucket_value(size_t b) {
+        if (b < kSubBuckets) {
+            return b;
+        }
+        const size_t shift = b / kSubBuckets - 1;
+        const uint64_t base = (kSubBuckets + b % kSubBuckets) << shift;
+        return base + (uint64_t(1) << shift) - 1;
+    }
+
+public:
+    latency_histogram()
+        : counts_((kMaxBits + 1) * kSubBuckets), total_(0), max_(0) {}
+
+    void record(uint64_t ns) {
+        counts_[std::min(bucket_of(ns), counts_.size() - 1)]++;
+        total_++;
+        max_ = std::max(max_, ns);
+    }
+
+    void merge(const latency_histogram& other) {
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const {
+        return total_;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    // percentile returns the latency below which a fraction p of the
+    // recorded latencies fall.
+    uint64_t percentile(double p) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        const uint64_t rank = std::max<uint64_t>(
+            1, static_cast<uint64_t>(std::ceil(p * total_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(bucket_value(i), max_);
+            }
+        }
+        return max_;
+    }
+};
+
+#endif
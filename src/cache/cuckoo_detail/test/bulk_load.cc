@@ -0,0 +1,116 @@
+/* Checks that bulk_load leaves a table as a loop assigning the same pairs
+ * in order would. Every key appears several times in the input, and the
+ * last pair of a key must win. A quarter of the keys hash to one in 32 of
+ * the buckets, so most of them go to their second bucket, and the ones
+ * whose second bucket is full as well are inserted with cuckoo paths.
+ * The load runs once into an empty table, which places the pairs itself,
+ * and once into a table holding some of the keys already, which inserts
+ * them all the usual way. */
+
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o bulk_load bulk_load.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+const uint64_t num_keys = 20000;
+const uint64_t copies = 3;
+// The keys below num_skewed share a few first buckets
+const uint64_t num_skewed = num_keys / 4;
+
+// skewed_hash clears the bits 3 to 7 of the hash of the skewed keys. Their
+// first bucket, which the low bits of the hash pick, is then one in 32 of
+// the table. Their second bucket, which the bits above the hashpower pick,
+// is spread out.
+struct skewed_hash {
+    static uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdULL;
+        x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return x ^ (x >> 33);
+    }
+
+    size_t operator()(uint64_t x) const {
+        if (x < num_skewed) {
+            return (mix(x) << 8) | (x & 7);
+        }
+        return mix(x);
+    }
+};
+
+typedef cuckoohash_map<uint64_t, uint64_t, skewed_hash> Table;
+typedef std::vector<std::pair<uint64_t, uint64_t> > Pairs;
+
+// check compares table with the map holding what it should, and reports
+// the first difference.
+bool check(const char* name, Table& table,
+           const std::unordered_map<uint64_t, uint64_t>& expected) {
+    if (table.size() != expected.size()) {
+        std::cout << name << ": size " << table.size() << ", expected "
+                  << expected.size() << std::endl;
+        return false;
+    }
+    for (const auto& kv : expected) {
+        uint64_t val;
+        if (!table.find(kv.first, val)) {
+            std::cout << name << ": key " << kv.first << " missing"
+                      << std::endl;
+            return false;
+        }
+        if (val != kv.second) {
+            std::cout << name << ": key " << kv.first << " holds " << val
+                      << ", expected " << kv.second << std::endl;
+            return false;
+        }
+    }
+    std::cout << name << ": " << expected.size() << " keys, hashpower "
+              << table.hashpower() << std::endl;
+    return true;
+}
+
+int main() {
+    // Each round of copies goes through the keys in another order, and the
+    // value tells the copy apart
+    Pairs pairs;
+    for (uint64_t c = 0; c < copies; c++) {
+        for (uint64_t i = 0; i < num_keys; i++) {
+            const uint64_t k = c % 2 ? num_keys - 1 - i : i;
+            pairs.emplace_back(k, k * copies + c);
+        }
+    }
+
+    std::unordered_map<uint64_t, uint64_t> expected;
+    for (const auto& kv : pairs) {
+        expected[kv.first] = kv.second;
+    }
+
+    bool passed = true;
+
+    // An empty table, which bulk_load sizes for all the pairs
+    Table empty(1);
+    empty.bulk_load(pairs.begin(), pairs.end());
+    passed &= check("empty table", empty, expected);
+
+    // Every other key is already in the table, with another value, and
+    // some keys are not in the input at all
+    Table filled(1);
+    std::unordered_map<uint64_t, uint64_t> expected_filled = expected;
+    for (uint64_t k = 0; k < num_keys + 1000; k += 2) {
+        filled.insert(k, 1);
+        expected_filled.insert(std::make_pair(k, 1));
+    }
+    filled.bulk_load(pairs.begin(), pairs.end());
+    passed &= check("filled table", filled, expected_filled);
+
+    // The same loaded through assignment, one pair at a time
+    Table assigned(1);
+    for (const auto& kv : pairs) {
+        assigned[kv.first] = kv.second;
+    }
+    passed &= check("assignment loop", assigned, expected);
+
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+/* Measures the hit ratio of cuckoohash_map in cache mode on a Zipf
+ * distributed cache-aside workload (look the key up, insert it on a
+ * miss), and compares it with an exact LRU cache of the same capacity.
+ * It also reports how many evictions the table performed and that its
+ * size never went past its fixed capacity. */
+
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o cache_bench cache_bench.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+#include "bench_util.hh"
+
+typedef cuckoohash_map<uint64_t, uint64_t> Table;
+
+const size_t num_items = 1 << 20;
+const size_t num_requests = 4000000;
+
+// lru_cache is the exact LRU baseline.
+class lru_cache {
+    size_t capacity_;
+    std::list<uint64_t> order_;
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> index_;
+
+public:
+    explicit lru_cache(size_t capacity) : capacity_(capacity) {
+        index_.reserve(capacity);
+    }
+
+    bool get(uint64_t key) {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+        order_.splice(order_.begin(), order_, it->second);
+        return true;
+    }
+
+    void put(uint64_t key) {
+        if (index_.size() == capacity_) {
+            index_.erase(order_.back());
+            order_.pop_back();
+        }
+        order_.push_front(key);
+        index_[key] = order_.begin();
+    }
+};
+
+void run(double theta, size_t hashpower) {
+    const size_t capacity = (1UL << hashpower) * Table::slot_per_bucket();
+    Table table(capacity);
+    table.set_cache_mode(true);
+    lru_cache lru(capacity);
+
+    zipf_generator zipf(num_items, theta);
+    std::mt19937_64 gen(theta * 1000);
+    size_t table_hits = 0, lru_hits = 0, max_size = 0;
+    uint64_t val;
+    for (size_t i = 0; i < num_requests; i++) {
+        const uint64_t key = scramble(zipf(gen));
+        if (table.find(key, val)) {
+            table_hits++;
+        } else {
+            table.insert(key, key);
+        }
+        if (lru.get(key)) {
+            lru_hits++;
+        } else {
+            lru.put(key);
+        }
+        max_size = std::max(max_size, table.size());
+    }
+
+    std::cout << "theta " << theta << ", capacity " << capacity << " ("
+              << 100.0 * capacity / num_items << "% of items): "
+              << "cuckoo clock hit ratio " << 100.0 * table_hits / num_requests
+              << "%, lru hit ratio " << 100.0 * lru_hits / num_requests
+              << "%, " << table.num_evictions() << " evictions, max load "
+              << 100.0 * max_size / capacity << "%";
+    if (table.hashpower() != hashpower) {
+        std::cout << " (table grew to hashpower " << table.hashpower() << ")";
+    }
+    std::cout << std::endl;
+}
+
+int main() {
+    Table probe(num_items / 16);
+    const size_t hashpower = probe.hashpower();
+    for (double theta : {0.6, 0.8, 0.99, 1.2}) {
+        run(theta, hashpower);
+    }
+}
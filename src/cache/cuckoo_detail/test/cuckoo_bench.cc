@@ -0,0 +1,479 @@
+/* A configurable benchmark of cuckoohash_map. It prefills a table to a
+ * given load factor, runs a mix of reads, inserts, updates and erases
+ * over uniform or Zipf distributed integer or string keys from several
+ * threads, and prints the throughput and latency percentiles of each
+ * operation type as JSON, so runs can be compared across commits. With
+ * --batch, reads and updates go through multi_find and multi_update on
+ * batches of keys.
+ *
+ * Run with --help for the options. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o cuckoo_bench cuckoo_bench.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+#include "bench_util.hh"
+
+enum op_type { op_read, op_insert, op_update, op_erase, num_op_types };
+
+const char* op_names[num_op_types] = {"read", "insert", "update", "erase"};
+
+struct bench_config {
+    // percentages of each operation type, summing to 100
+    size_t mix[num_op_types] = {90, 5, 5, 0};
+    bool zipf = false;
+    double theta = 0.99;
+    bool string_keys = false;
+    size_t key_len = 16;
+    // slots per bucket of the table, 0 for the table's default
+    size_t slots = 0;
+    size_t threads = std::max(1U, std::thread::hardware_concurrency());
+    // the table is created with room for capacity elements, and prefilled
+    // to prefill times that
+    size_t capacity = 1 << 22;
+    double prefill = 0.5;
+    // prefill with bulk_load instead of a loop of inserts
+    bool bulk_prefill = false;
+    // operations draw keys from this many distinct keys; 0 means twice
+    // the number of prefilled keys
+    size_t keys = 0;
+    // keys per read and update, which use multi_find and multi_update when
+    // it is above 1
+    size_t batch = 1;
+    size_t ops = 1000000;
+    uint64_t seed = 1;
+};
+
+void usage() {
+    std::cerr <<
+        "usage: cuckoo_bench [options]\n"
+        "  --mix R:I:U:E      percentages of reads, inserts, updates and\n"
+        "                     erases (default 90:5:5:0)\n"
+        "  --dist uniform|zipf key distribution (default uniform)\n"
+        "  --theta T          Zipf skew (default 0.99)\n"
+        "  --key int|string   key type (default int)\n"
+        "  --key-len N        string key length (default 16)\n"
+        "  --slots 4|8|16     slots per bucket (default: the table's default\n"
+        "                     for the key and value sizes)\n"
+        "  --threads N        worker threads (default: number of cores)\n"
+        "  --capacity N       initial table capacity (default 4194304)\n"
+        "  --prefill F        fraction of capacity to prefill (default 0.5)\n"
+        "  --prefill-mode insert|bulk\n"
+        "                     prefill with a loop of inserts or with\n"
+        "                     bulk_load (default insert)\n"
+        "  --keys N           number of distinct keys operations use\n"
+        "                     (default: twice the prefilled keys)\n"
+        "  --batch N          keys per read and update, done with\n"
+        "                     multi_find and multi_update if N > 1\n"
+        "                     (default 1)\n"
+        "  --ops N            operations per thread (default 1000000)\n"
+        "  --seed N           random seed (default 1)\n";
+}
+
+bench_config parse_args(int argc, char** argv) {
+    bench_config cfg;
+    for (int i = 1; i < argc; i++) {
+        const std::string opt = argv[i];
+        if (opt == "--help" || opt == "-h") {
+            usage();
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("missing value for " + opt);
+        }
+        const std::string val = argv[++i];
+        if (opt == "--mix") {
+            std::istringstream in(val);
+            size_t sum = 0;
+            for (size_t t = 0; t < num_op_types; t++) {
+                char sep;
+                if (!(in >> cfg.mix[t]) || (t + 1 < num_op_types &&
+                                            !(in >> sep))) {
+                    throw std::invalid_argument("bad --mix " + val);
+                }
+                sum += cfg.mix[t];
+            }
+            if (sum != 100) {
+                throw std::invalid_argument("--mix must sum to 100");
+            }
+        } else if (opt == "--dist") {
+            if (val != "uniform" && val != "zipf") {
+                throw std::invalid_argument("bad --dist " + val);
+            }
+            cfg.zipf = val == "zipf";
+        } else if (opt == "--theta") {
+            cfg.theta = std::stod(val);
+        } else if (opt == "--key") {
+            if (val != "int" && val != "string") {
+                throw std::invalid_argument("bad --key " + val);
+            }
+            cfg.string_keys = val == "string";
+        } else if (opt == "--key-len") {
+            cfg.key_len = std::stoul(val);
+        } else if (opt == "--slots") {
+            cfg.slots = std::stoul(val);
+            if (cfg.slots != 4 && cfg.slots != 8 && cfg.slots != 16) {
+                throw std::invalid_argument("bad --slots " + val);
+            }
+        } else if (opt == "--threads") {
+            cfg.threads = std::stoul(val);
+        } else if (opt == "--capacity") {
+            cfg.capacity = std::stoul(val);
+        } else if (opt == "--prefill") {
+            cfg.prefill = std::stod(val);
+        } else if (opt == "--prefill-mode") {
+            if (val != "insert" && val != "bulk") {
+                throw std::invalid_argument("bad --prefill-mode " + val);
+            }
+            cfg.bulk_prefill = val == "bulk";
+        } else if (opt == "--keys") {
+            cfg.keys = std::stoul(val);
+        } else if (opt == "--batch") {
+            cfg.batch = std::stoul(val);
+        } else if (opt == "--ops") {
+            cfg.ops = std::stoul(val);
+        } else if (opt == "--seed") {
+            cfg.seed = std::stoull(val);
+        } else {
+            throw std::invalid_argument("unknown option " + opt);
+        }
+    }
+    if (cfg.threads == 0 || cfg.key_len == 0 || cfg.batch == 0) {
+        throw std::invalid_argument(
+            "--threads, --key-len and --batch must be > 0");
+    }
+    return cfg;
+}
+
+// key_set turns key indices into the keys of the table. Integer keys are
+// scrambled indices. String keys are the index in hex, left-padded to
+// key_len, like "......3f2a". They are built ahead of time, so the benchmark
+// doesn't time their construction.
+template <class Key>
+class key_set;
+
+template <>
+class key_set<uint64_t> {
+public:
+    key_set(const bench_config&, size_t n) : size_(n) {}
+    uint64_t operator[](size_t i) const {
+        return scramble(i);
+    }
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    size_t size_;
+};
+
+template <>
+class key_set<std::string> {
+    std::vector<std::string> keys_;
+
+public:
+    key_set(const bench_config& cfg, size_t n) : keys_(n) {
+        for (size_t i = 0; i < n; i++) {
+            std::ostringstream out;
+            out << std::hex << i;
+            const std::string digits = out.str();
+            if (digits.size() > cfg.key_len) {
+                throw std::invalid_argument(
+                    "--key-len is too short for the number of keys");
+            }
+            keys_[i] = std::string(cfg.key_len - digits.size(), '.') + digits;
+        }
+    }
+    const std::string& operator[](size_t i) const {
+        return keys_[i];
+    }
+    size_t size() const {
+        return keys_.size();
+    }
+};
+
+struct thread_result {
+    latency_histogram latency[num_op_types];
+    // keys found by reads and updates, which count every key of a batch
+    size_t succeeded[num_op_types] = {0, 0, 0, 0};
+};
+
+template <class Table, class Key>
+void run_ops(Table& table, const key_set<Key>& keys,
+             const bench_config& cfg, size_t num_keys, size_t id,
+             std::atomic<size_t>& ready, thread_result& res) {
+    std::mt19937_64 gen(cfg.seed * 1000003 + id);
+    std::uniform_int_distribution<size_t> uniform(0, num_keys - 1);
+    std::uniform_int_distribution<size_t> percent(0, 99);
+    std::unique_ptr<zipf_generator> zipf;
+    if (cfg.zipf) {
+        zipf.reset(new zipf_generator(num_keys, cfg.theta));
+    }
+
+    ready.fetch_add(1);
+    while (ready.load() < cfg.threads) {
+        std::this_thread::yield();
+    }
+
+    uint64_t val;
+    std::vector<Key> batch;
+    std::vector<uint64_t> vals;
+    for (size_t i = 0; i < cfg.ops; i++) {
+        const size_t k = cfg.zipf ? (*zipf)(gen) : uniform(gen);
+        size_t p = percent(gen);
+        size_t type = 0;
+        while (p >= cfg.mix[type]) {
+            p -= cfg.mix[type];
+            type++;
+        }
+        const Key& key = keys[k];
+        const bool batched = cfg.batch > 1 &&
+            (type == op_read || type == op_update);
+        if (batched) {
+            batch.assign(1, key);
+            while (batch.size() < cfg.batch) {
+                batch.push_back(keys[cfg.zipf ? (*zipf)(gen) : uniform(gen)]);
+            }
+        }
+
+        size_t ok = 0;
+        auto start = std::chrono::steady_clock::now();
+        switch (type) {
+        case op_read:
+            ok = batched ? table.multi_find(batch, vals) :
+                table.find(key, val);
+            break;
+        case op_insert:
+            ok = table.insert(key, i);
+            break;
+        case op_update:
+            if (batched) {
+                ok = table.multi_update(
+                    batch, [i](const std::vector<uint64_t*>& v) {
+                        for (uint64_t* p : v) {
+                            if (p != nullptr) {
+                                *p = i;
+                            }
+                        }
+                    });
+            } else {
+                ok = table.update(key, i);
+            }
+            break;
+        default:
+            ok = table.erase(key);
+            break;
+        }
+        const uint64_t ns = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        res.latency[type].record(ns);
+        res.succeeded[type] += ok;
+    }
+}
+
+// max_load_factor fills a table of up to 2^16 buckets with keys until it
+// has to grow, and returns its load factor right before that, or 0 if there
+// are too few keys to fill it.
+template <class Table, class Key>
+double max_load_factor(const key_set<Key>& keys) {
+    size_t hashpower = 16;
+    while (hashpower > 0 &&
+           (Table::slot_per_bucket() << hashpower) > keys.size()) {
+        hashpower--;
+    }
+    Table table(Table::slot_per_bucket() << hashpower);
+    hashpower = table.hashpower();
+    for (size_t i = 0; i < keys.size(); i++) {
+        table.insert(keys[i], i);
+        if (table.hashpower() != hashpower) {
+            return static_cast<double>(i) /
+                (Table::slot_per_bucket() << hashpower);
+        }
+    }
+    return 0;
+}
+
+template <class Key, size_t Slots>
+void run(const bench_config& cfg) {
+    typedef cuckoohash_map<Key, uint64_t, std::hash<Key>, std::equal_to<Key>,
+                           cuckoo_backoff_spinlock, false, Slots> Table;
+    const size_t prefilled = static_cast<size_t>(cfg.capacity * cfg.prefill);
+    const size_t num_keys = cfg.keys ? cfg.keys :
+        std::max<size_t>(2 * prefilled, 1);
+    key_set<Key> keys(cfg, std::max(num_keys, prefilled));
+
+    Table table(cfg.capacity);
+    std::vector<std::thread> threads;
+    std::vector<std::pair<Key, uint64_t> > items;
+    if (cfg.bulk_prefill) {
+        items.reserve(prefilled);
+        for (size_t i = 0; i < prefilled; i++) {
+            items.emplace_back(keys[i], i);
+        }
+    }
+    auto prefill_start = std::chrono::steady_clock::now();
+    if (cfg.bulk_prefill) {
+        table.bulk_load(items.begin(), items.end());
+    } else {
+        for (size_t t = 0; t < cfg.threads; t++) {
+            threads.emplace_back([&, t]() {
+                    for (size_t i = t; i < prefilled; i += cfg.threads) {
+                        table.insert(keys[i], i);
+                    }
+                });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        threads.clear();
+    }
+    const double prefill_secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - prefill_start).count();
+    std::vector<std::pair<Key, uint64_t> >().swap(items);
+    const double prefill_load = table.load_factor();
+
+    std::vector<thread_result> results(cfg.threads);
+    std::atomic<size_t> ready(0);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < cfg.threads; t++) {
+        threads.emplace_back(run_ops<Table, Key>, std::ref(table),
+                             std::cref(keys), std::cref(cfg), num_keys, t,
+                             std::ref(ready), std::ref(results[t]));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    const double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    thread_result total;
+    for (const thread_result& r : results) {
+        for (size_t type = 0; type < num_op_types; type++) {
+            total.latency[type].merge(r.latency[type]);
+            total.succeeded[type] += r.succeeded[type];
+        }
+    }
+
+    std::ostringstream out;
+    out << "{\n  \"config\": {\"mix\": {";
+    for (size_t type = 0; type < num_op_types; type++) {
+        out << (type ? ", " : "") << "\"" << op_names[type] << "\": "
+            << cfg.mix[type];
+    }
+    out << "}, \"dist\": \"" << (cfg.zipf ? "zipf" : "uniform") << "\""
+        << ", \"theta\": " << cfg.theta
+        << ", \"key\": \"" << (cfg.string_keys ? "string" : "int") << "\""
+        << ", \"key_len\": " << (cfg.string_keys ? cfg.key_len : 8)
+        << ", \"threads\": " << cfg.threads
+        << ", \"capacity\": " << cfg.capacity
+        << ", \"prefill\": " << cfg.prefill
+        << ", \"prefill_mode\": \""
+        << (cfg.bulk_prefill ? "bulk" : "insert") << "\""
+        << ", \"keys\": " << num_keys
+        << ", \"batch\": " << cfg.batch
+        << ", \"ops_per_thread\": " << cfg.ops
+        << ", \"seed\": " << cfg.seed << "},\n";
+    out << "  \"table\": {\"slot_per_bucket\": " << Slots
+        << ", \"max_load_factor\": " << max_load_factor<Table>(keys)
+        << ", \"prefill_seconds\": " << prefill_secs
+        << ", \"prefill_mops\": " << prefilled / prefill_secs / 1e6
+        << ", \"prefill_load_factor\": " << prefill_load
+        << ", \"final_load_factor\": " << table.load_factor()
+        << ", \"final_size\": " << table.size()
+        << ", \"hashpower\": " << table.hashpower() << "},\n";
+    // The displacement statistics cover the prefill too, and are all zero
+    // unless the benchmark is built with -DLIBCUCKOO_STATS=1
+    const cuckoo_displacement_stats ds = table.displacement_stats();
+    out << "  \"displacement\": {\"enabled\": "
+        << (LIBCUCKOO_STATS ? "true" : "false")
+        << ", \"searches\": " << ds.searches << ", \"path_length\": [";
+    for (size_t d = 0; d < ds.path_length.size(); d++) {
+        out << (d ? ", " : "") << ds.path_length[d];
+    }
+    out << "], \"search_failures\": " << ds.search_failures
+        << ", \"move_retries\": " << ds.move_retries
+        << ", \"table_full\": " << ds.table_full
+        << ", \"resizes\": " << ds.resizes
+        << ", \"resize_ns\": " << ds.resize_ns
+        << ", \"max_resize_ns\": " << ds.max_resize_ns
+        << ", \"bytes_moved\": " << ds.bytes_moved
+        << ", \"lock_contended\": " << ds.locks.contended
+        << ", \"lock_spins\": " << ds.locks.spins
+        << ", \"lock_sleeps\": " << ds.locks.sleeps << "},\n";
+    out << "  \"total\": {\"ops\": " << cfg.ops * cfg.threads
+        << ", \"seconds\": " << secs
+        << ", \"mops\": " << cfg.ops * cfg.threads / secs / 1e6 << "},\n";
+    out << "  \"ops\": {";
+    bool first = true;
+    for (size_t type = 0; type < num_op_types; type++) {
+        const latency_histogram& h = total.latency[type];
+        if (h.count() == 0) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n") << "    \"" << op_names[type]
+            << "\": {\"count\": " << h.count()
+            << ", \"succeeded\": " << total.succeeded[type]
+            << ", \"mops\": " << h.count() / secs / 1e6
+            << ", \"latency_ns\": {\"p50\": " << h.percentile(0.5)
+            << ", \"p90\": " << h.percentile(0.9)
+            << ", \"p99\": " << h.percentile(0.99)
+            << ", \"p999\": " << h.percentile(0.999)
+            << ", \"max\": " << h.max() << "}}";
+        first = false;
+    }
+    out << "\n  }\n}\n";
+    std::cout << out.str();
+}
+
+template <class Key>
+void run_slots(const bench_config& cfg) {
+    switch (cfg.slots) {
+    case 4:
+        run<Key, 4>(cfg);
+        break;
+    case 8:
+        run<Key, 8>(cfg);
+        break;
+    case 16:
+        run<Key, 16>(cfg);
+        break;
+    default:
+        run<Key, cuckoo_default_slot_per_bucket(
+                sizeof(Key) + sizeof(uint64_t))>(cfg);
+        break;
+    }
+}
+
+int main(int argc, char** argv) {
+    bench_config cfg;
+    try {
+        cfg = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage();
+        return 1;
+    }
+    try {
+        if (cfg.string_keys) {
+            run_slots<std::string>(cfg);
+        } else {
+            run_slots<uint64_t>(cfg);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,147 @@
+/* Measures how long it takes to get a large table back after a restart:
+ * rebuilding it by inserting every element, against loading a dump of it.
+ * The dump is loaded once into a table of the same type, which maps it in
+ * place, and once into a table with another hash function, which falls
+ * back to inserting its elements in parallel. Both must hold every element
+ * afterwards.
+ *
+ * usage: dump_restart [num_keys (default 100M)] [dump path] */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o dump_restart dump_restart.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+typedef cuckoohash_map<uint64_t, uint64_t> Table;
+
+// other_hash hashes keys differently from std::hash, so a dump written by
+// Table cannot be used in place by OtherTable.
+struct other_hash {
+    size_t operator()(uint64_t x) const {
+        x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdULL;
+        x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+        return x ^ (x >> 33);
+    }
+};
+
+typedef cuckoohash_map<uint64_t, uint64_t, other_hash> OtherTable;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs fn(t, thread_num) in thread_num threads.
+template <class Fn>
+void parallel(Fn fn) {
+    const size_t thread_num =
+        std::max(1U, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_num; t++) {
+        threads.emplace_back(fn, t, thread_num);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+// Checks that table holds every key, with its value, and reports how long
+// it took, which for a mapped dump includes reading it in.
+template <class T>
+bool check_all(const T& table, uint64_t num_keys, const char* what) {
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<bool> ok(true);
+    parallel([&](size_t t, size_t thread_num) {
+            uint64_t val;
+            for (uint64_t i = t; i < num_keys; i += thread_num) {
+                if (!table.find(i, val) || val != i * 3) {
+                    ok = false;
+                    return;
+                }
+            }
+        });
+    std::cout << what << ": looked up every key in " << seconds_since(start)
+              << " s" << std::endl;
+    if (!ok || table.size() != num_keys) {
+        std::cout << what << ": elements lost" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const uint64_t num_keys = argc > 1 ? strtoull(argv[1], nullptr, 10) :
+        100000000;
+    const std::string path = argc > 2 ? argv[2] :
+        "/tmp/cuckoo_dump_restart.bin";
+    bool passed = true;
+
+    {
+        Table table(num_keys);
+        auto start = std::chrono::steady_clock::now();
+        parallel([&](size_t t, size_t thread_num) {
+                for (uint64_t i = t; i < num_keys; i += thread_num) {
+                    table.insert(i, i * 3);
+                }
+            });
+        std::cout << "rebuild by insert: " << num_keys << " keys in "
+                  << seconds_since(start) << " s, hashpower "
+                  << table.hashpower() << std::endl;
+
+        start = std::chrono::steady_clock::now();
+        table.dump(path);
+        std::cout << "dump: " << seconds_since(start) << " s" << std::endl;
+    }
+
+    {
+        Table table(1);
+        auto start = std::chrono::steady_clock::now();
+        const bool in_place = table.load(path);
+        std::cout << "load in place: " << seconds_since(start) << " s"
+                  << std::endl;
+        passed &= in_place && check_all(table, num_keys, "load in place");
+    }
+
+    {
+        OtherTable table(1);
+        auto start = std::chrono::steady_clock::now();
+        const bool in_place = table.load(path);
+        std::cout << "load by re-insert: " << seconds_since(start) << " s"
+                  << std::endl;
+        passed &= !in_place && check_all(table, num_keys, "load by re-insert");
+    }
+
+    {
+        // A corrupt hashpower, at its offset in the dump header, must be
+        // rejected before the size of the buckets is computed from it
+        const uint64_t hashpower = 64;
+        const int fd = open(path.c_str(), O_WRONLY);
+        passed &= fd >= 0 && pwrite(fd, &hashpower, sizeof(hashpower), 56) ==
+            static_cast<ssize_t>(sizeof(hashpower));
+        close(fd);
+        Table table(1);
+        try {
+            table.load(path);
+            std::cout << "corrupt dump: loaded" << std::endl;
+            passed = false;
+        } catch (const std::runtime_error& e) {
+            std::cout << "corrupt dump: " << e.what() << std::endl;
+        }
+    }
+
+    unlink(path.c_str());
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/* Checks per-entry expiry in cuckoohash_map: expired entries must look
+ * absent to every operation, operations that run into them reclaim them,
+ * and the background sweeper reclaims the rest in bounded ticks. It then
+ * reports lookup throughput with and without the sweeper running, and
+ * the cost of each sweep tick. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o expiry_sweep expiry_sweep.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+typedef cuckoohash_map<uint64_t, uint64_t, std::hash<uint64_t>,
+                       std::equal_to<uint64_t>, cuckoo_backoff_spinlock,
+                       true> Table;
+
+const size_t num_keys = 1 << 20;
+const size_t sweep_budget = 1024;
+const std::chrono::milliseconds short_ttl(1000);
+
+bool check(bool cond, const char* what) {
+    if (!cond) {
+        std::cout << "check failed: " << what << std::endl;
+    }
+    return cond;
+}
+
+double lookup_mops(const Table& table, size_t thread_num) {
+    const size_t lookups_per_thread = 1000000;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> found(0);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_num; t++) {
+        threads.emplace_back([&table, &found, t]() {
+                std::mt19937_64 gen(t);
+                std::uniform_int_distribution<uint64_t> dist(0, num_keys - 1);
+                size_t n = 0;
+                for (size_t i = 0; i < lookups_per_thread; i++) {
+                    n += table.contains(dist(gen));
+                }
+                found += n;
+            });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    return lookups_per_thread * thread_num / secs / 1e6;
+}
+
+int main() {
+    bool passed = true;
+    const size_t thread_num =
+        std::max(1U, std::thread::hardware_concurrency());
+
+    // Even keys are persistent, odd keys expire after short_ttl
+    Table table(num_keys);
+    for (uint64_t i = 0; i < num_keys; i++) {
+        if (i % 2 == 0) {
+            table.insert(i, i);
+        } else {
+            table.insert(i, i, short_ttl);
+        }
+    }
+    std::chrono::milliseconds ttl;
+    passed &= check(table.ttl(1, ttl) && ttl <= short_ttl, "ttl of key 1");
+    passed &= check(table.ttl(0, ttl) &&
+                    ttl == std::chrono::milliseconds::max(), "ttl of key 0");
+    passed &= check(table.persist(3), "persist key 3");
+    passed &= check(table.expire(4, short_ttl), "expire key 4");
+    const double before_mops = lookup_mops(table, thread_num);
+
+    std::this_thread::sleep_for(short_ttl * 2);
+
+    // Operations treat expired entries as absent and reclaim them
+    uint64_t val;
+    passed &= check(!table.find(1, val), "find of expired key");
+    passed &= check(!table.contains(5), "contains of expired key");
+    passed &= check(!table.update(7, 7), "update of expired key");
+    passed &= check(!table.erase(9), "erase of expired key");
+    passed &= check(!table.find(4, val), "find of key given a ttl");
+    passed &= check(table.find(3, val), "find of persisted key");
+    passed &= check(table.insert(11, 11), "insert over expired key");
+    // The insert also reclaims the other expired entries of its buckets
+    passed &= check(table.expiry_stats().lazy_expired >= 6,
+                    "lazy expiry count");
+
+    // The sweeper reclaims the rest, a bounded number of buckets per tick
+    table.start_sweeper(std::chrono::milliseconds(1), sweep_budget);
+    const double during_mops = lookup_mops(table, thread_num);
+    while (table.size() > num_keys / 2 + 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    table.stop_sweeper();
+
+    cuckoo_expiry_stats st = table.expiry_stats();
+    passed &= check(st.lazy_expired + st.swept_expired == num_keys / 2,
+                    "every expired key reclaimed once");
+    passed &= check(table.size() == num_keys / 2 + 1, "final size");
+    for (uint64_t i = 0; i < num_keys; i += 2) {
+        if (i != 4 && (!table.find(i, val) || val != i)) {
+            passed &= check(false, "persistent key lost");
+            break;
+        }
+    }
+
+    std::cout << "lookups: " << before_mops << " Mops/sec without sweeper, "
+              << during_mops << " Mops/sec with sweeper" << std::endl;
+    std::cout << "sweeper: " << st.swept_expired << " reclaimed in "
+              << st.sweep_ticks << " ticks of " << sweep_budget
+              << " buckets, " << st.buckets_swept << " buckets scanned, "
+              << "last tick " << st.last_tick_ns / 1000.0 << " us, "
+              << "max tick " << st.max_tick_ns / 1000.0 << " us" << std::endl;
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
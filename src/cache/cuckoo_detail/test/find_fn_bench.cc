@@ -0,0 +1,93 @@
+/* Compares lookup throughput of find (which copies the value out),
+ * find_fn (which serializes the value in place into a per-thread
+ * output buffer) and contains (which never touches the value), for
+ * 1 KiB and 64 KiB values. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o find_fn_bench find_fn_bench.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+typedef cuckoohash_map<uint64_t, std::string> Table;
+
+// Total bytes of values stored for each run, so both value sizes touch the
+// same amount of memory.
+const size_t total_bytes = 64 << 20;
+const size_t lookups_per_thread = 200000;
+
+enum lookup_kind { copy_find, visit_find, contains_only };
+
+const char* kind_name(lookup_kind k) {
+    switch (k) {
+    case copy_find: return "find";
+    case visit_find: return "find_fn";
+    default: return "contains";
+    }
+}
+
+void do_lookups(const Table& table, size_t num_keys, size_t value_size,
+                lookup_kind kind, size_t seed, size_t& checksum) {
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<uint64_t> dist(0, num_keys - 1);
+    std::vector<char> out(value_size);
+    size_t sum = 0;
+    for (size_t i = 0; i < lookups_per_thread; i++) {
+        const uint64_t key = dist(gen);
+        if (kind == copy_find) {
+            std::string val;
+            table.find(key, val);
+            memcpy(out.data(), val.data(), val.size());
+            sum += out[i % value_size];
+        } else if (kind == visit_find) {
+            table.find_fn(key, [&out](const std::string& val) {
+                    memcpy(out.data(), val.data(), val.size());
+                });
+            sum += out[i % value_size];
+        } else {
+            sum += table.contains(key);
+        }
+    }
+    checksum = sum;
+}
+
+void run(size_t value_size, size_t thread_num) {
+    const size_t num_keys = total_bytes / value_size;
+    Table table(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+        table.insert(i, std::string(value_size, 'a' + i % 26));
+    }
+
+    for (lookup_kind kind : {copy_find, visit_find, contains_only}) {
+        std::vector<std::thread> threads;
+        std::vector<size_t> checksums(thread_num);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < thread_num; t++) {
+            threads.emplace_back(do_lookups, std::cref(table), num_keys,
+                                 value_size, kind, t, std::ref(checksums[t]));
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        double secs = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cout << value_size / 1024 << " KiB values, "
+                  << kind_name(kind) << ": "
+                  << lookups_per_thread * thread_num / secs / 1e6
+                  << " Mops/sec" << std::endl;
+    }
+}
+
+int main() {
+    const size_t thread_num =
+        std::max(1U, std::thread::hardware_concurrency());
+    run(1 << 10, thread_num);
+    run(64 << 10, thread_num);
+}
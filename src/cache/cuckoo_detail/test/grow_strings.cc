@@ -0,0 +1,88 @@
+/* Measures how long string-key tables take to grow, with and without
+ * stored hashes. For each key length, it inserts the keys into a table
+ * that starts small, so it doubles many times, then doubles it once more
+ * with rehash. Tables that store hashes split their buckets instead of
+ * hashing every key again. Both tables must hold every key afterwards.
+ *
+ * usage: grow_strings [num_keys (default 1M)] */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o grow_strings grow_strings.cc ../city.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+#include <cache/cuckoo_detail/city_hasher.hh>
+#include "bench_util.hh"
+
+typedef cuckoohash_map<std::string, uint64_t, CityHasher<std::string> >
+    Table;
+
+typedef cuckoohash_map<std::string, uint64_t, CityHasher<std::string>,
+                       std::equal_to<std::string>, cuckoo_backoff_spinlock,
+                       false, Table::slot_per_bucket(), DEFAULT_NUM_LOCKS,
+                       true> HashedTable;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// Key i is its scrambled index in hex, left-padded with '.' to len bytes.
+std::vector<std::string> make_keys(size_t num_keys, size_t len) {
+    std::vector<std::string> keys;
+    keys.reserve(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+        std::string hex;
+        for (uint64_t x = scramble(i); x != 0; x >>= 4) {
+            hex.push_back("0123456789abcdef"[x & 0xf]);
+        }
+        keys.push_back(std::string(len - hex.size(), '.') + hex);
+    }
+    return keys;
+}
+
+// Fills a table of type T with keys, reports the time it took and the time
+// of one more doubling, and checks that no key was lost.
+template <class T>
+bool run(const std::vector<std::string>& keys, const char* what) {
+    T table(1 << 10);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+        table.insert(keys[i], i);
+    }
+    const double insert_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    table.rehash(table.hashpower() + 1);
+    const double double_s = seconds_since(start);
+
+    std::cout << "  " << what << ": insert " << insert_s << " s, double "
+              << double_s << " s" << std::endl;
+    uint64_t val;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!table.find(keys[i], val) || val != i) {
+            std::cout << "  " << what << ": lost key " << keys[i]
+                      << std::endl;
+            return false;
+        }
+    }
+    return table.size() == keys.size();
+}
+
+int main(int argc, char** argv) {
+    const size_t num_keys = argc > 1 ? strtoull(argv[1], nullptr, 10) :
+        1000000;
+    bool passed = true;
+    for (size_t len : {32, 64, 128, 256}) {
+        const std::vector<std::string> keys = make_keys(num_keys, len);
+        std::cout << num_keys << " keys of " << len << " bytes" << std::endl;
+        passed &= run<Table>(keys, "rehashing keys");
+        passed &= run<HashedTable>(keys, "stored hashes");
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/* Checks that a table with transparent hashing can be searched with
+ * std::string_view and C string keys, and counts the heap allocations
+ * each lookup performs. Keys are longer than the SSO buffer, so the
+ * std::string path has to allocate once per lookup while the
+ * string_view path must not allocate at all. */
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// g++ -std=c++17 -I <hypocampd>/src -o hetero_lookup hetero_lookup.cc ../city.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+#include <cache/cuckoo_detail/city_hasher.hh>
+
+static std::atomic<size_t> num_allocs(0);
+
+void* operator new(size_t sz) {
+    num_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(sz)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+typedef cuckoohash_map<std::string, size_t, CityHasher<std::string>,
+                       std::equal_to<> > Table;
+
+const size_t num_keys = 100000;
+
+int main() {
+    Table table(num_keys);
+    std::vector<std::string> keys;
+    keys.reserve(num_keys);
+    for (size_t i = 0; i < num_keys; i++) {
+        keys.push_back("session:0123456789abcdef:" + std::to_string(i));
+        table.insert(keys.back(), i);
+    }
+
+    // Pack the keys into one receive-buffer-like block, so lookups can run
+    // on (pointer, length) views into it.
+    std::string buffer;
+    std::vector<std::pair<size_t, size_t> > spans;
+    for (const std::string& k : keys) {
+        spans.emplace_back(buffer.size(), k.size());
+        buffer += k;
+    }
+
+    bool passed = true;
+
+    // Hashing a view must agree with hashing the equivalent string
+    CityHasher<std::string> hasher;
+    for (size_t i = 0; i < num_keys; i++) {
+        std::string_view sv(buffer.data() + spans[i].first, spans[i].second);
+        if (hasher(sv) != hasher(keys[i]) ||
+            hasher(keys[i].c_str()) != hasher(keys[i])) {
+            std::cout << "hash mismatch for " << keys[i] << std::endl;
+            passed = false;
+            break;
+        }
+    }
+
+    size_t val, found = 0;
+    size_t before = num_allocs.load();
+    for (size_t i = 0; i < num_keys; i++) {
+        std::string materialized(buffer.data() + spans[i].first,
+                                 spans[i].second);
+        found += table.find(materialized, val) && val == i;
+    }
+    size_t string_allocs = num_allocs.load() - before;
+
+    before = num_allocs.load();
+    for (size_t i = 0; i < num_keys; i++) {
+        std::string_view sv(buffer.data() + spans[i].first, spans[i].second);
+        found += table.find(sv, val) && val == i;
+    }
+    size_t view_allocs = num_allocs.load() - before;
+
+    before = num_allocs.load();
+    found += table.find(keys[7].c_str(), val) && val == 7;
+    found += table.update(std::string_view(keys[8]), 88);
+    found += table.find(std::string_view(keys[8])) == 88;
+    found += table.erase(std::string_view(keys[9]));
+    found += !table.find(std::string_view(keys[9]), val);
+    size_t other_allocs = num_allocs.load() - before;
+
+    std::cout << "std::string lookups: " << string_allocs / (double)num_keys
+              << " allocations per lookup" << std::endl;
+    std::cout << "string_view lookups: " << view_allocs / (double)num_keys
+              << " allocations per lookup" << std::endl;
+    std::cout << "c string / update / erase: " << other_allocs
+              << " allocations" << std::endl;
+
+    if (found != 2 * num_keys + 5) {
+        std::cout << "lookup results are wrong" << std::endl;
+        passed = false;
+    }
+    if (string_allocs < num_keys || view_allocs != 0 || other_allocs != 0) {
+        std::cout << "unexpected allocation count" << std::endl;
+        passed = false;
+    }
+
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
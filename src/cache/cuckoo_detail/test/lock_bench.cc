@@ -0,0 +1,80 @@
+/* Measures cuckoohash_map throughput with each lock policy when the
+ * machine is oversubscribed with twice as many threads as cores. The
+ * workload keeps the table close to full, so inserts run cuckoo path
+ * moves that hold up to three lock stripes at once. */
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o lock_bench lock_bench.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+const size_t table_slots = 1 << 16;
+// Inserts and erases are equally likely, so about half of the key range is
+// in the table at any time, which is a load factor around 0.9.
+const size_t key_range = table_slots * 185 / 100;
+const size_t ops_per_thread = 1000000;
+
+template <class Table>
+void do_ops(Table& table, size_t seed) {
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<uint64_t> dist(0, key_range - 1);
+    uint64_t val;
+    for (size_t i = 0; i < ops_per_thread; i++) {
+        const uint64_t key = dist(gen);
+        switch (i % 4) {
+        case 0:
+            table.insert(key, key);
+            break;
+        case 1:
+            table.erase(key);
+            break;
+        default:
+            table.find(key, val);
+            break;
+        }
+    }
+}
+
+template <class Lock>
+void run(const char* name, size_t thread_num) {
+    typedef cuckoohash_map<uint64_t, uint64_t, std::hash<uint64_t>,
+                           std::equal_to<uint64_t>, Lock> Table;
+    Table table(table_slots);
+    for (size_t i = 0; i < key_range; i += 2) {
+        table.insert(i, i);
+    }
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t t = 0; t < thread_num; t++) {
+        threads.emplace_back(do_ops<Table>, std::ref(table), t);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    cuckoo_lock_stats st = table.lock_stats();
+    std::cout << name << ": "
+              << ops_per_thread * thread_num / secs / 1e6 << " Mops/sec, "
+              << st.contended << " contended acquisitions, "
+              << st.spins << " spins, " << st.sleeps << " sleeps"
+              << " (load factor " << table.load_factor() << ")" << std::endl;
+}
+
+int main() {
+    const size_t cores = std::max(1U, std::thread::hardware_concurrency());
+    const size_t thread_num = 2 * cores;
+    std::cout << thread_num << " threads on " << cores << " cores"
+              << std::endl;
+    run<cuckoo_spinlock>("test-and-set spinlock", thread_num);
+    run<cuckoo_backoff_spinlock>("ttas backoff spinlock", thread_num);
+    run<cuckoo_adaptive_lock>("adaptive spin-then-futex lock", thread_num);
+}
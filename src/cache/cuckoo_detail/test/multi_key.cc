@@ -0,0 +1,105 @@
+/* Checks that multi_update and multi_find are atomic. Worker threads move
+ * amounts between random accounts with multi_update, which only moves an
+ * amount if the source holds it, while reader threads add up every account
+ * with multi_find, and an inserter grows the table underneath them, which
+ * moves elements around. Every sum must equal the initial total, and no
+ * account may go negative. */
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o multi_key multi_key.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+typedef cuckoohash_map<uint64_t, int64_t> Table;
+
+const size_t num_accounts = 64;
+const int64_t initial_balance = 1000;
+const size_t transfers_per_thread = 200000;
+// The inserter adds keys above the accounts until the workers finish
+const uint64_t first_filler = 1 << 20;
+
+int main() {
+    Table table(1 << 10);
+    std::vector<uint64_t> accounts;
+    for (uint64_t a = 0; a < num_accounts; a++) {
+        table.insert(a, initial_balance);
+        accounts.push_back(a);
+    }
+    const int64_t total = initial_balance * num_accounts;
+
+    const size_t thread_num =
+        std::max(2U, std::thread::hardware_concurrency());
+    std::atomic<size_t> running(thread_num);
+    std::atomic<bool> consistent(true);
+    std::atomic<size_t> sums(0);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < thread_num; t++) {
+        threads.emplace_back([&, t]() {
+                std::mt19937_64 gen(t);
+                std::uniform_int_distribution<uint64_t> account(
+                    0, num_accounts - 1);
+                std::uniform_int_distribution<int64_t> amount(1, 50);
+                for (size_t i = 0; i < transfers_per_thread; i++) {
+                    const int64_t x = amount(gen);
+                    std::vector<uint64_t> keys = {account(gen), account(gen)};
+                    table.multi_update(
+                        keys, [x](const std::vector<int64_t*>& v) {
+                            if (*v[0] >= x) {
+                                *v[0] -= x;
+                                *v[1] += x;
+                            }
+                        });
+                }
+                running.fetch_sub(1);
+            });
+    }
+
+    threads.emplace_back([&]() {
+            std::vector<int64_t> vals;
+            while (running.load() > 0) {
+                if (table.multi_find(accounts, vals) != num_accounts) {
+                    consistent = false;
+                }
+                int64_t sum = 0;
+                for (int64_t v : vals) {
+                    sum += v;
+                    if (v < 0) {
+                        consistent = false;
+                    }
+                }
+                if (sum != total) {
+                    consistent = false;
+                }
+                sums.fetch_add(1);
+            }
+        });
+
+    threads.emplace_back([&]() {
+            for (uint64_t k = first_filler; running.load() > 0; k++) {
+                table.insert(k, 0);
+            }
+        });
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::vector<int64_t> vals;
+    table.multi_find(accounts, vals);
+    int64_t sum = 0;
+    for (int64_t v : vals) {
+        sum += v;
+    }
+    std::cout << sums.load() << " consistent sums checked, final hashpower "
+              << table.hashpower() << std::endl;
+    const bool passed = consistent.load() && sum == total;
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/* Measures the latency of finds and inserts while a full scan of the
+ * table runs in parallel, once with snapshot_table, which locks the
+ * whole table, and once with snapshot_table_weak, which locks one stripe
+ * at a time. It also checks that the weak scan sees every element that
+ * stays in the table exactly once, while concurrent inserts cuckoo
+ * elements around and expand the table. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o scan_latency scan_latency.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+typedef cuckoohash_map<uint64_t, uint64_t> Table;
+
+// Keys below num_stable stay in the table for the whole run, the workers
+// insert and erase keys above it.
+const uint64_t num_stable = 1 << 20;
+const size_t ops_per_thread = 400000;
+
+enum scan_kind { no_scan, locked_scan, weak_scan };
+
+const char* scan_name(scan_kind k) {
+    switch (k) {
+    case no_scan: return "no scan";
+    case locked_scan: return "snapshot_table";
+    default: return "snapshot_table_weak";
+    }
+}
+
+void do_ops(Table& table, size_t seed, std::vector<double>& latencies) {
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<uint64_t> dist(0, num_stable - 1);
+    uint64_t val;
+    latencies.reserve(ops_per_thread);
+    for (size_t i = 0; i < ops_per_thread; i++) {
+        const uint64_t key = dist(gen);
+        auto start = std::chrono::steady_clock::now();
+        if (i % 2 == 0) {
+            table.find(key, val);
+        } else {
+            table.insert(num_stable + seed * ops_per_thread + i, key);
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+                                std::chrono::steady_clock::now() - start)
+                            .count());
+    }
+}
+
+bool run(scan_kind kind, size_t thread_num) {
+    Table table(num_stable);
+    for (uint64_t i = 0; i < num_stable; i++) {
+        table.insert(i, i);
+    }
+
+    std::atomic<bool> done(false);
+    size_t scans = 0;
+    bool exactly_once = true;
+    std::thread scanner([&]() {
+            while (kind != no_scan && !done.load()) {
+                std::vector<std::pair<uint64_t, uint64_t> > items =
+                    kind == locked_scan ? table.snapshot_table() :
+                    table.snapshot_table_weak();
+                std::vector<uint8_t> seen(num_stable);
+                for (const auto& kv : items) {
+                    if (kv.first < num_stable) {
+                        seen[kv.first]++;
+                    }
+                }
+                for (uint8_t n : seen) {
+                    exactly_once &= n == 1;
+                }
+                scans++;
+            }
+        });
+
+    std::vector<std::vector<double> > latencies(thread_num);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < thread_num; t++) {
+        workers.emplace_back(do_ops, std::ref(table), t,
+                             std::ref(latencies[t]));
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    done = true;
+    scanner.join();
+
+    std::vector<double> all;
+    for (const auto& l : latencies) {
+        all.insert(all.end(), l.begin(), l.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto pct = [&all](double p) {
+        return all[std::min(all.size() - 1, size_t(p * all.size()))];
+    };
+    std::cout << scan_name(kind) << ": " << scans << " scans, latency us "
+              << "p50 " << pct(0.5) << ", p99 " << pct(0.99) << ", p99.9 "
+              << pct(0.999) << ", max " << all.back()
+              << " (final hashpower " << table.hashpower() << ")"
+              << std::endl;
+    if (!exactly_once) {
+        std::cout << "a stable key was missed or seen twice" << std::endl;
+    }
+    return exactly_once;
+}
+
+int main() {
+    const size_t thread_num =
+        std::max(1U, std::thread::hardware_concurrency());
+    bool passed = true;
+    for (scan_kind kind : {no_scan, locked_scan, weak_scan}) {
+        passed &= run(kind, thread_num);
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
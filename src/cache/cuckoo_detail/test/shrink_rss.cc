@@ -0,0 +1,138 @@
+/* Fills a table, purges most of it, and shrinks it, reporting resident
+ * memory and operation latency before the purge, after it, while
+ * shrink_to_fit runs, and after it. It then repeats the purge with
+ * automatic shrinking turned on, which should shrink the table until its
+ * load factor is back above the threshold. */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o shrink_rss shrink_rss.cc
+
+#include <cache/cuckoo_detail/cuckoohash_map.hh>
+
+typedef cuckoohash_map<uint64_t, uint64_t> Table;
+
+const uint64_t num_keys = 1 << 22;
+// Keys below num_kept survive the purge
+const uint64_t num_kept = num_keys / 32;
+
+size_t rss_mib() {
+    std::ifstream statm("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    statm >> total >> resident;
+    return resident * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+// Latencies are stored in a buffer allocated up front, so that measuring
+// them doesn't change the resident memory between phases.
+const size_t max_ops = 1000000;
+
+// Runs up to max_ops finds and updates of surviving keys, stopping early if
+// stop is set, and stores their latencies in microseconds in latencies,
+// sorted.
+void do_ops(Table& table, std::atomic<bool>& stop,
+            std::vector<double>& latencies) {
+    std::mt19937_64 gen(latencies.capacity());
+    std::uniform_int_distribution<uint64_t> dist(0, num_kept - 1);
+    latencies.clear();
+    uint64_t val;
+    for (size_t i = 0; i < max_ops && !stop.load(); i++) {
+        const uint64_t key = dist(gen);
+        auto start = std::chrono::steady_clock::now();
+        if (i % 4 == 0) {
+            table.update(key, i);
+        } else {
+            table.find(key, val);
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+                                std::chrono::steady_clock::now() - start)
+                            .count());
+    }
+    std::sort(latencies.begin(), latencies.end());
+}
+
+void report(const char* phase, const Table& table,
+            const std::vector<double>& lat) {
+    std::cout << phase << ": rss " << rss_mib() << " MiB, hashpower "
+              << table.hashpower() << ", load factor " << table.load_factor();
+    if (!lat.empty()) {
+        std::cout << ", latency us p50 " << lat[lat.size() / 2] << ", p99 "
+                  << lat[lat.size() * 99 / 100] << ", max " << lat.back();
+    }
+    std::cout << std::endl;
+}
+
+void purge(Table& table) {
+    for (uint64_t i = num_kept; i < num_keys; i++) {
+        table.erase(i);
+    }
+}
+
+int main() {
+    std::atomic<bool> stop(false);
+    std::vector<double> lat;
+    lat.reserve(max_ops);
+    {
+        Table table(num_kept);
+        for (uint64_t i = 0; i < num_keys; i++) {
+            table.insert(i, i);
+        }
+        do_ops(table, stop, lat);
+        report("filled", table, lat);
+
+        purge(table);
+        do_ops(table, stop, lat);
+        report("purged", table, lat);
+
+        // Measure the operations that run concurrently with the shrink
+        std::thread worker([&]() {
+                do_ops(table, stop, lat);
+            });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        auto start = std::chrono::steady_clock::now();
+        table.shrink_to_fit();
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        stop = true;
+        worker.join();
+        stop = false;
+        std::cout << "shrink_to_fit took " << ms << " ms" << std::endl;
+        report("during shrink", table, lat);
+        do_ops(table, stop, lat);
+        report("shrunk", table, lat);
+    }
+
+    const double threshold = 0.2;
+    Table table(num_kept);
+    table.set_auto_shrink(threshold);
+    for (uint64_t i = 0; i < num_keys; i++) {
+        table.insert(i, i);
+    }
+    const size_t filled_hashpower = table.hashpower();
+    report("auto shrink, filled", table, std::vector<double>());
+    purge(table);
+    do_ops(table, stop, lat);
+    report("auto shrink, purged", table, lat);
+    uint64_t val;
+    for (uint64_t i = 0; i < num_kept; i++) {
+        if (!table.find(i, val)) {
+            std::cout << "lost key " << i << std::endl;
+            std::cout << "FAILED" << std::endl;
+            return 1;
+        }
+    }
+    const bool passed = table.hashpower() < filled_hashpower &&
+        table.load_factor() >= threshold;
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
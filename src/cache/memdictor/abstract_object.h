@@ -1,68 +1,301 @@
 #ifndef HYPOCAMPD_ABSTRACT_OBJECT_H
 #define HYPOCAMPD_ABSTRACT_OBJECT_H
 
-#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "common/mem_pool.h"
+
+// Objects of up to this size are stored in the AObject itself
+#define AOBJ_INLINE_SIZE 8
+
+// Bytes of a large buffer counted as one allocation when estimating
+// the effort to free it, for the pages the system has to unmap
+#define AOBJ_FREE_EFFORT_BYTES (64 * 1024)
 
 namespace hypocampd {
 
+// Type tag of the object held by an AObject
+enum aobj_type_t : uint8_t {
+    AOBJ_NONE = 0,
+    AOBJ_INT,
+    AOBJ_DOUBLE,
+    AOBJ_STRING,
+    AOBJ_SORTED_SET,
+    AOBJ_OTHER,
+};
+
+// Type tag of T. Data structures specialize it for their type.
+template <typename T, typename Enable = void>
+struct aobj_type_of {
+    static const aobj_type_t value = AOBJ_OTHER;
+};
+
+template <typename T>
+struct aobj_type_of<T, typename std::enable_if<
+                           std::is_integral<T>::value>::type> {
+    static const aobj_type_t value = AOBJ_INT;
+};
+
+template <typename T>
+struct aobj_type_of<T, typename std::enable_if<
+                           std::is_floating_point<T>::value>::type> {
+    static const aobj_type_t value = AOBJ_DOUBLE;
+};
+
+class sstring;
+
+template <>
+struct aobj_type_of<sstring> {
+    static const aobj_type_t value = AOBJ_STRING;
+};
+
+// Returns the bytes an object allocated for itself, besides its own
+// size. Data structures owning memory overload it for their type.
+template <typename T>
+size_t aobj_heap_size(const T&) noexcept
+{
+    return 0;
+}
+
+// Returns about the number of allocations freed when destroying an
+// object. Data structures made of many allocations overload it for
+// their type, so that large ones can be freed in the background.
+template <typename T>
+size_t aobj_free_effort(const T&) noexcept
+{
+    return 1;
+}
+
+// True if objects of type T are stored in the AObject itself
+template <typename T>
+struct aobj_is_inline {
+    static const bool value =
+        sizeof(T) <= AOBJ_INLINE_SIZE && alignof(T) <= alignof(void*) &&
+        std::is_nothrow_move_constructible<T>::value;
+};
+
 /*
  * AObject: Abstract Object
  * It is a basic type erasure technique for having
  * a common object notation for all different types
  * of data structures.
+ *
+ * An AObject is 16 bytes: a buffer and a pointer to a table of
+ * the type tag and the functions that destroy and move the held
+ * type. Objects small enough, like integers and pointers, live in
+ * the buffer. Larger ones, like sstring, are allocated from the
+ * memory pool and the buffer holds their address. Either way,
+ * holding an object takes at most one allocation and reaching it
+ * at most one pointer chase.
+ *
+ * Objects are created in place with make_aobject, and reached
+ * with aobj_cast, which checks the type.
  * NOTE :- This is a move only type class.
  */
 class AObject {
 public:
-    AObject() {}
+    AObject() noexcept {}
 
-    template <typename OrigType>
-    AObject(const OrigType* base_obj) : 
-                    mp_holder(new Holder<OrigType>(base_obj))
-    {}
+    ~AObject() {
+        destroy();
+    }
 
     // Move constructor
     AObject(AObject&& other) noexcept {
-        mp_holder.release();
-        mp_holder = std::move(other.mp_holder);
+        take(other);
+    }
+
+    // Move assignment destroys the object held till now
+    AObject& operator=(AObject&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            take(other);
+        }
+        return *this;
     }
 
+    // Copying is not an option
+    AObject(const AObject& other) = delete;
+    AObject& operator=(const AObject& other) = delete;
+
     // If someone wants to manually destroy
     // the AObject rather than relying on RAII
     void destroy() noexcept {
-        mp_holder.release();
+        if (mp_vtable) {
+            mp_vtable->destroy(m_buf);
+            mp_vtable = nullptr;
+        }
     }
 
-    // Copying is not an option
-    AObject(const AObject& other) = delete;
-    void operator=(AObject other) = delete;
+    // Returns true if no object is held
+    bool empty() const noexcept {
+        return mp_vtable == nullptr;
+    }
 
-    struct BaseHolder {
-        BaseHolder() = 0; 
-    };
+    // Returns the type tag of the held object
+    aobj_type_t type() const noexcept {
+        return mp_vtable ? mp_vtable->type : AOBJ_NONE;
+    }
+
+    // Returns the bytes allocated for the held object, and by it,
+    // not counting the AObject itself
+    size_t mem_usage() const noexcept {
+        return mp_vtable ? mp_vtable->mem(m_buf) : 0;
+    }
+
+    // Returns the effort to destroy the held object, see
+    // aobj_free_effort
+    size_t free_effort() const noexcept {
+        return mp_vtable ? mp_vtable->effort(m_buf) : 0;
+    }
 
-    // Holder Object
-    template <typename OrigType>
-    struct Holder: public BaseHolder {
-    public:
-        Holder(const OrigType* base_obj): 
-                        mp_heldobj(std::unique_ptr<OrigType>{base_obj})
-        {}
+private:
+    template <typename T, typename... Args>
+    friend AObject make_aobject(Args&&... args);
 
-        std::unique_ptr<OrigType> mp_heldobj = nullptr;
+    template <typename T>
+    friend T* aobj_cast(const AObject& o) noexcept;
+
+    // The manual vtable of a held type
+    struct VTable {
+        aobj_type_t type;
+        // Destroys the object held in buf, and frees it
+        // if it is not inline
+        void (*destroy)(void* buf);
+        // Moves the object held in src to dst, leaving src
+        // without object. nullptr if copying the buffer does.
+        void (*move)(void* dst, void* src);
+        // Returns the memory of the object held in buf
+        size_t (*mem)(const void* buf);
+        // Returns the effort to destroy the object held in buf
+        size_t (*effort)(const void* buf);
     };
 
-    std::unique_ptr<BaseHolder> mp_holder = nullptr;
+    template <typename T, bool Inline = aobj_is_inline<T>::value>
+    struct Ops;
+
+    template <typename T>
+    static const VTable* vtable_of() noexcept {
+        static const VTable vt = {
+            aobj_type_of<T>::value, &Ops<T>::destroy, Ops<T>::move(),
+            &Ops<T>::mem, &Ops<T>::effort
+        };
+        return &vt;
+    }
+
+    void take(AObject& other) noexcept {
+        mp_vtable = other.mp_vtable;
+        if (!mp_vtable) return;
+
+        if (mp_vtable->move) mp_vtable->move(m_buf, other.m_buf);
+        else std::memcpy(m_buf, other.m_buf, AOBJ_INLINE_SIZE);
+        other.mp_vtable = nullptr;
+    }
+
+private:
+    alignas(void*) unsigned char m_buf[AOBJ_INLINE_SIZE];
+    const VTable* mp_vtable = nullptr;
+};
+
+// Objects stored in the buffer
+template <typename T>
+struct AObject::Ops<T, true> {
+    static T* get(const void* buf) noexcept {
+        return const_cast<T*>(static_cast<const T*>(buf));
+    }
+
+    template <typename... Args>
+    static void create(void* buf, Args&&... args) {
+        new (buf) T(std::forward<Args>(args)...);
+    }
+
+    static void destroy(void* buf) noexcept {
+        get(buf)->~T();
+    }
+
+    static void relocate(void* dst, void* src) noexcept {
+        new (dst) T(std::move(*get(src)));
+        get(src)->~T();
+    }
+
+    static constexpr void (*move())(void*, void*) {
+        return std::is_trivially_copyable<T>::value ? nullptr : &relocate;
+    }
+
+    static size_t mem(const void* buf) noexcept {
+        return aobj_heap_size(*get(buf));
+    }
+
+    static size_t effort(const void* buf) noexcept {
+        return aobj_free_effort(*get(buf));
+    }
+};
+
+// Objects allocated from the pool
+template <typename T>
+struct AObject::Ops<T, false> {
+    static_assert(alignof(T) <= 16, "pool blocks are 16 byte aligned");
+
+    static T* get(const void* buf) noexcept {
+        return *static_cast<T* const*>(buf);
+    }
+
+    template <typename... Args>
+    static void create(void* buf, Args&&... args) {
+        void* p = pool_alloc(sizeof(T));
+        try {
+            new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            pool_free(p, sizeof(T));
+            throw;
+        }
+        *static_cast<void**>(buf) = p;
+    }
+
+    static void destroy(void* buf) noexcept {
+        T* p = get(buf);
+        p->~T();
+        pool_free(p, sizeof(T));
+    }
+
+    // Moving the pointer moves the object
+    static constexpr void (*move())(void*, void*) {
+        return nullptr;
+    }
+
+    static size_t mem(const void* buf) noexcept {
+        return pool_block_size(sizeof(T)) + aobj_heap_size(*get(buf));
+    }
+
+    static size_t effort(const void* buf) noexcept {
+        return aobj_free_effort(*get(buf));
+    }
 };
 
+// Create an AObject holding a T constructed from args
+template <typename T, typename... Args>
+AObject make_aobject(Args&&... args)
+{
+    AObject o;
 
+    AObject::Ops<T>::create(o.m_buf, std::forward<Args>(args)...);
+    o.mp_vtable = AObject::vtable_of<T>();
+
+    return o;
+}
 
-// This is an unsafe cast
+// Returns the object held by o, or nullptr if o
+// does not hold a T
 template <typename T>
-T* aobj_cast(const AObject& o) {
-    return static_cast<T*>( 
-                static_cast<AObject::Holder<T>*>(o.mp_holder.get())->mp_heldobj
-        );
+T* aobj_cast(const AObject& o) noexcept
+{
+    if (o.mp_vtable != AObject::vtable_of<T>()) return nullptr;
+    return AObject::Ops<T>::get(o.m_buf);
 }
 
 }; // End namespace hypocampd
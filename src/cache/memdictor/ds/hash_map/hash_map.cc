@@ -1,6 +1,1079 @@
-#include "ds/hash_map.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cinttypes>
+#include <utility>
+
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+#include "cache/memdictor/lazy_free.h"
+#include "cache/memdictor/shared_integers.h"
 
 namespace hypocampd {
 
+static const uint32_t HASH_MAP_SEED = 5381;
+
+// Returns the smallest power of two at least size,
+// and no less than HASH_MAP_MIN_ENTRIES
+static unsigned long next_power(unsigned long size)
+{
+    unsigned long i = HASH_MAP_MIN_ENTRIES;
+
+    if (size >= LONG_MAX) return LONG_MAX + 1LU;
+    while (i < size) i *= 2;
+
+    return i;
+}
+
+// Returns v with its bits in reverse order
+static unsigned long rev(unsigned long v)
+{
+    unsigned long s = CHAR_BIT * sizeof(v);
+    unsigned long mask = ~0UL;
+
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+
+    return v;
+}
+
+// Returns the scan cursor following cursor in a table of mask + 1
+// buckets: the bits of mask are incremented in reverse order, from
+// the highest one, and the bits above it are left 0
+static unsigned long next_cursor(unsigned long cursor, unsigned long mask)
+{
+    cursor |= ~mask;
+    cursor = rev(cursor);
+    cursor++;
+
+    return rev(cursor);
+}
+
+#define LRU_CLOCK_MAX ((1 << 24) - 1)
+
+// Returns the LRU clock, in ticks of HASH_MAP_LRU_RESOLUTION_MS
+static uint32_t lru_clock()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now);
+
+    return (ms.count() / HASH_MAP_LRU_RESOLUTION_MS) & LRU_CLOCK_MAX;
+}
+
+// Returns the time of the LFU decrements, in minutes on 16 bits
+static uint32_t lfu_minutes()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+
+    return std::chrono::duration_cast<std::chrono::minutes>(now).count() &
+           0xFFFF;
+}
+
+// Returns the LFU counter of lfu, decremented for the time
+// elapsed since its last decrement till now, in LFU minutes
+static uint32_t lfu_decayed(uint32_t lfu, uint32_t now)
+{
+    uint32_t elapsed = (now - (lfu >> 8)) & 0xFFFF;
+    uint32_t periods = elapsed / HASH_MAP_LFU_DECAY_TIME;
+    uint32_t counter = lfu & 255;
+
+    return periods > counter ? 0 : counter - periods;
+}
+
+// ===================================================================
+
+bool
+Entry::get_int(int64_t& v) const noexcept
+{
+    switch (m_enc) {
+    case ENC_INT:
+        v = val.s64;
+        return true;
+    case ENC_UINT:
+        if (val.u64 > uint64_t(INT64_MAX)) return false;
+        v = val.u64;
+        return true;
+    case ENC_DOUBLE:
+        // The range check also fails for NaN
+        if (!(val.d >= -0x1p63 && val.d < 0x1p63)) return false;
+        if (double(int64_t(val.d)) != val.d) return false;
+        v = val.d;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ===================================================================
+
+bool
+Entry::get_uint(uint64_t& v) const noexcept
+{
+    switch (m_enc) {
+    case ENC_INT:
+        if (val.s64 < 0) return false;
+        v = val.s64;
+        return true;
+    case ENC_UINT:
+        v = val.u64;
+        return true;
+    case ENC_DOUBLE:
+        if (!(val.d >= 0 && val.d < 0x1p64)) return false;
+        if (double(uint64_t(val.d)) != val.d) return false;
+        v = val.d;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ===================================================================
+
+bool
+Entry::get_double(double& v) const noexcept
+{
+    switch (m_enc) {
+    case ENC_INT:
+        v = val.s64;
+        return true;
+    case ENC_UINT:
+        v = val.u64;
+        return true;
+    case ENC_DOUBLE:
+        v = val.d;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// ===================================================================
+
+bool
+Entry::incr_by(int64_t delta) noexcept
+{
+    // The builtins store the wrapped result even on overflow
+    if (m_enc == ENC_INT) {
+        int64_t r;
+        if (__builtin_add_overflow(val.s64, delta, &r)) return false;
+        val.s64 = r;
+        return true;
+    }
+    if (m_enc == ENC_UINT) {
+        uint64_t r;
+        // -uint64_t(delta) is the magnitude of a negative delta,
+        // INT64_MIN included
+        bool overflow = delta >= 0 ?
+            __builtin_add_overflow(val.u64, uint64_t(delta), &r) :
+            __builtin_sub_overflow(val.u64, -uint64_t(delta), &r);
+        if (overflow) return false;
+        val.u64 = r;
+        return true;
+    }
+    return false;
+}
+
+// ===================================================================
+
+bool
+Entry::incr_by_double(double delta) noexcept
+{
+    double v;
+    if (!get_double(v)) return false;
+
+    v += delta;
+    if (!std::isfinite(v)) return false;
+    set_double(v);
+
+    return true;
+}
+
+// ===================================================================
+
+size_t
+Entry::mem_usage() const noexcept
+{
+    size_t mem = pool_block_size(sizeof(Entry)) + key.heap_size();
+
+    if (m_enc == ENC_OBJECT) mem += val.value.mem_usage();
+
+    return mem;
+}
+
+// ===================================================================
+
+void
+Entry::set_string(sstring&& s)
+{
+    int64_t v;
+
+    if (string_to_int64(s.c_str(), s.length(), v)) set_int(v);
+    else set_object(make_aobject<sstring>(std::move(s)));
+}
+
+// ===================================================================
+
+const sstring*
+Entry::get_string(sstring& buf) const
+{
+    char tmp[32];
+
+    switch (m_enc) {
+    case ENC_OBJECT:
+        return aobj_cast<sstring>(val.value);
+    case ENC_INT:
+        if (const sstring* shared = shared_integer(val.s64)) return shared;
+        snprintf(tmp, sizeof(tmp), "%" PRId64, val.s64);
+        break;
+    case ENC_UINT:
+        snprintf(tmp, sizeof(tmp), "%" PRIu64, val.u64);
+        break;
+    case ENC_DOUBLE:
+        snprintf(tmp, sizeof(tmp), "%.17g", val.d);
+        break;
+    }
+    buf = sstring(tmp);
+
+    return &buf;
+}
+
+// ===================================================================
+
+HashTable::HashTable(unsigned long size)
+{
+    expand(size);
+}
+
+// ===================================================================
+
+HashTable::~HashTable()
+{
+    clear();
+}
+
+// ===================================================================
+
+uint32_t
+HashTable::hash_key(const sstring& key) noexcept
+{
+    return murmurhash(key.c_str(), key.length(), HASH_MAP_SEED);
+}
+
+// ===================================================================
+
+result_t
+HashTable::expand(unsigned long size)
+{
+    if (is_rehashing() || m_ht[0].m_used > size) return HASH_ERR;
+
+    unsigned long realsize = next_power(size);
+    if (realsize == m_ht[0].m_size) return HASH_ERR;
+
+    Entry** buckets = static_cast<Entry**>(calloc(realsize, sizeof(Entry*)));
+    if (!buckets) throw std::bad_alloc();
+
+    Table& t = m_ht[0].mp_table ? m_ht[1] : m_ht[0];
+    t.mp_table.reset(buckets);
+    t.m_size     = realsize;
+    t.m_sizemask = realsize - 1;
+    t.m_used     = 0;
+
+    // The first allocation needs no rehash
+    if (&t == &m_ht[1]) m_rehashidx = 0;
+
+    return HASH_OK;
+}
+
+// ===================================================================
+
+result_t
+HashTable::resize()
+{
+    if (is_rehashing()) return HASH_ERR;
+    return expand(m_ht[0].m_used);
+}
+
+// ===================================================================
+
+void
+HashTable::expand_if_needed()
+{
+    if (is_rehashing()) return;
+
+    if (m_ht[0].m_used >= m_ht[0].m_size) {
+        expand(m_ht[0].m_used * 2);
+    }
+}
+
+// ===================================================================
+
+bool
+HashTable::rehash(int n)
+{
+    int empty_visits = n * HASH_MAP_EMPTY_VISITS;
+
+    if (!is_rehashing()) return false;
+
+    while (n-- && m_ht[0].m_used != 0) {
+        // m_ht[0].m_used != 0 guarantees that there is a
+        // non-empty bucket at or after m_rehashidx
+        while (m_ht[0].mp_table[m_rehashidx] == nullptr) {
+            m_rehashidx++;
+            if (--empty_visits == 0) return true;
+        }
+
+        Entry* e = m_ht[0].mp_table[m_rehashidx];
+        while (e) {
+            Entry* next = e->next;
+            unsigned long idx = hash_key(e->key) & m_ht[1].m_sizemask;
+
+            e->next = m_ht[1].mp_table[idx];
+            m_ht[1].mp_table[idx] = e;
+            m_ht[0].m_used--;
+            m_ht[1].m_used++;
+            e = next;
+        }
+        m_ht[0].mp_table[m_rehashidx] = nullptr;
+        m_rehashidx++;
+    }
+
+    if (m_ht[0].m_used == 0) {
+        m_ht[0].mp_table = std::move(m_ht[1].mp_table);
+        m_ht[0].m_size     = m_ht[1].m_size;
+        m_ht[0].m_sizemask = m_ht[1].m_sizemask;
+        m_ht[0].m_used     = m_ht[1].m_used;
+        m_ht[1].reset();
+        m_rehashidx = -1;
+        return false;
+    }
+
+    return true;
+}
+
+// ===================================================================
+
+int
+HashTable::rehash_ms(int ms)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(ms);
+    int rehashes = 0;
+
+    while (rehash(HASH_MAP_REHASH_BATCH)) {
+        rehashes += HASH_MAP_REHASH_BATCH;
+        if (std::chrono::steady_clock::now() >= deadline) break;
+    }
+
+    return rehashes;
+}
+
+// ===================================================================
+
+long
+HashTable::key_index(const sstring& key, uint32_t hash)
+{
+    expand_if_needed();
+
+    unsigned long idx = 0;
+    for (int table = 0; table <= 1; table++) {
+        idx = hash & m_ht[table].m_sizemask;
+
+        for (Entry* e = m_ht[table].mp_table[idx]; e; e = e->next) {
+            if (e->key == key) return -1;
+        }
+        // Only the first table is in use unless rehashing
+        if (!is_rehashing()) break;
+    }
+
+    return idx;
+}
+
+// ===================================================================
+
+Entry*
+HashTable::add_entry(sstring&& key, long index)
+{
+    // New entries go to the new table while rehashing, so that
+    // the old one only ever gets smaller
+    Table& t = is_rehashing() ? m_ht[1] : m_ht[0];
+
+    Entry* e = new Entry(std::move(key));
+    e->next = t.mp_table[index];
+    t.mp_table[index] = e;
+    t.m_used++;
+    if (m_maxmemory) {
+        if (m_policy == EVICT_LFU) e->m_lru = lfu_minutes() << 8 |
+                                              HASH_MAP_LFU_INIT_VAL;
+        else                       e->m_lru = lru_clock();
+    }
+    account(e);
+
+    return e;
+}
+
+// ===================================================================
+
+result_t
+HashTable::add(sstring&& key, AObject&& val)
+{
+    evict_if_needed();
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    lookup_live(key, hash);
+    long index = key_index(key, hash);
+    if (index == -1) return HASH_ERR;
+
+    Entry* e = add_entry(std::move(key), index);
+    e->set_object(std::move(val));
+    account(e);
+
+    return HASH_OK;
+}
+
+// ===================================================================
+
+Entry*
+HashTable::add_raw(sstring&& key)
+{
+    evict_if_needed();
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    lookup_live(key, hash);
+    long index = key_index(key, hash);
+    if (index == -1) return nullptr;
+
+    return add_entry(std::move(key), index);
+}
+
+// ===================================================================
+
+Entry*
+HashTable::find_or_add(sstring&& key)
+{
+    evict_if_needed();
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    Entry* e = lookup_live(key, hash);
+    if (e) {
+        touch(e);
+        return e;
+    }
+
+    long index = key_index(key, hash);
+    return add_entry(std::move(key), index);
+}
+
+// ===================================================================
+
+Entry*
+HashTable::incr_by(sstring&& key, int64_t delta)
+{
+    Entry* e = find_or_add(std::move(key));
+
+    return e->incr_by(delta) ? e : nullptr;
+}
+
+// ===================================================================
+
+bool
+HashTable::replace(sstring&& key, AObject&& val)
+{
+    evict_if_needed();
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    lookup_live(key, hash);
+    long index = key_index(key, hash);
+    if (index != -1) {
+        Entry* e = add_entry(std::move(key), index);
+        e->set_object(std::move(val));
+        account(e);
+        return true;
+    }
+
+    Entry* e = lookup(key, hash);
+    drop_value(e);
+    drop_deadline(e);
+    e->set_object(std::move(val));
+    touch(e);
+    account(e);
+
+    return false;
+}
+
+// ===================================================================
+
+Entry*
+HashTable::lookup(const sstring& key, uint32_t hash)
+{
+    for (int table = 0; table <= 1; table++) {
+        unsigned long idx = hash & m_ht[table].m_sizemask;
+
+        for (Entry* e = m_ht[table].mp_table[idx]; e; e = e->next) {
+            if (e->key == key) return e;
+        }
+        if (!is_rehashing()) break;
+    }
+
+    return nullptr;
+}
+
+// ===================================================================
+
+Entry*
+HashTable::find(const sstring& key)
+{
+    if (size() == 0) return nullptr;
+
+    rehash_step();
+
+    Entry* e = lookup_live(key, hash_key(key));
+    if (e) touch(e);
+
+    return e;
+}
+
+// ===================================================================
+
+AObject*
+HashTable::fetch_value(const sstring& key)
+{
+    Entry* e = find(key);
+
+    return e ? e->get_object() : nullptr;
+}
+
+// ===================================================================
+
+result_t
+HashTable::remove(const sstring& key)
+{
+    if (size() == 0) return HASH_ERR;
+
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    Entry* e = lookup(key, hash);
+    if (!e) return HASH_ERR;
+
+    // An expired key is removed, but was not there anymore
+    bool live = !e->m_expires || deadline_of(e) > now_ms();
+    remove_entry(e, hash);
+    if (!live) {
+        m_expire_stats.expired++;
+        m_expire_stats.lazy++;
+    }
+
+    return live ? HASH_OK : HASH_ERR;
+}
+
+// ===================================================================
+
+void
+HashTable::remove_entry(Entry* e, uint32_t hash)
+{
+    for (int table = 0; table <= 1; table++) {
+        unsigned long idx = hash & m_ht[table].m_sizemask;
+        Entry** link = &m_ht[table].mp_table[idx];
+
+        while (*link && *link != e) link = &(*link)->next;
+        if (*link) {
+            *link = e->next;
+            m_ht[table].m_used--;
+            if (e->m_expires) mp_expires->remove(e->key);
+            m_entries_mem -= e->m_mem;
+            drop_value(e);
+            delete e;
+            return;
+        }
+        if (!is_rehashing()) break;
+    }
+}
+
+// ===================================================================
+
+void
+HashTable::drop_value(Entry* e)
+{
+    AObject o = e->take_object();
+
+    e->set_int(0);
+    // Without a lazy free, o is destroyed on return
+    if (mp_lazy_free) mp_lazy_free->free(std::move(o));
+}
+
+// ===================================================================
+
+void
+HashTable::clear_table(Table& t)
+{
+    for (unsigned long i = 0; i < t.m_size && t.m_used > 0; i++) {
+        Entry* e = t.mp_table[i];
+        while (e) {
+            Entry* next = e->next;
+            m_entries_mem -= e->m_mem;
+            delete e;
+            t.m_used--;
+            e = next;
+        }
+        t.mp_table[i] = nullptr;
+    }
+}
+
+// ===================================================================
+
+void
+HashTable::clear()
+{
+    clear_table(m_ht[0]);
+    clear_table(m_ht[1]);
+    m_ht[1].reset();
+    m_rehashidx = -1;
+    m_eviction_pool.clear();
+    if (mp_expires) mp_expires->clear();
+}
+
+// ===================================================================
+
+unsigned long
+HashTable::scan_cursor(unsigned long cursor, const ScanFn& fn,
+                       unsigned long& reported)
+{
+    // Entries of bucket i of a table of size n are in the buckets
+    // i + k * n of any larger table, which all have the low bits
+    // of i. Incrementing the cursor from its highest bit visits
+    // all of those before moving to other low bits, so the buckets
+    // visited before a resize are exactly those whose entries went
+    // to the buckets visited after it, whatever the sizes.
+    int64_t now = expires() ? now_ms() : 0;
+    auto report = [&](Entry* e) {
+        while (e) {
+            Entry* next = e->next;
+            // Expired keys are skipped, not removed, as that
+            // would move the buckets
+            if (!e->m_expires || deadline_of(e) > now) {
+                fn(e);
+                reported++;
+            }
+            e = next;
+        }
+    };
+
+    if (!is_rehashing()) {
+        unsigned long mask = m_ht[0].m_sizemask;
+        report(m_ht[0].mp_table[cursor & mask]);
+        return next_cursor(cursor, mask);
+    }
+
+    // While rehashing, report the bucket of the smaller table, then
+    // all the buckets of the larger one its entries could go to
+    const Table* small = &m_ht[0];
+    const Table* large = &m_ht[1];
+    if (small->m_size > large->m_size) std::swap(small, large);
+    unsigned long mask0 = small->m_sizemask;
+    unsigned long mask1 = large->m_sizemask;
+
+    report(small->mp_table[cursor & mask0]);
+    do {
+        report(large->mp_table[cursor & mask1]);
+        cursor = next_cursor(cursor, mask1);
+    } while (cursor & (mask0 ^ mask1));
+
+    return cursor;
+}
+
+// ===================================================================
+
+unsigned long
+HashTable::scan(unsigned long cursor, unsigned long count, const ScanFn& fn)
+{
+    unsigned long reported = 0;
+    unsigned long visits = count * HASH_MAP_SCAN_VISITS;
+
+    if (size() == 0) return 0;
+
+    // No rehash step here: the buckets must stay where they are
+    // while their entries are reported
+    do {
+        cursor = scan_cursor(cursor, fn, reported);
+    } while (cursor != 0 && reported < count && --visits > 0);
+
+    return cursor;
+}
+
+// ===================================================================
+
+void
+HashTable::set_maxmemory(size_t maxmemory, evict_policy_t policy,
+                         unsigned samples)
+{
+    m_maxmemory = maxmemory;
+    m_policy    = policy;
+    m_samples   = std::max(1U, std::min<unsigned>(
+                                   samples, HASH_MAP_EVICTION_MAX_SAMPLES));
+    m_eviction_pool.clear();
+    m_eviction_pool.reserve(HASH_MAP_EVICTION_POOL);
+
+    evict_if_needed();
+}
+
+// ===================================================================
+
+void
+HashTable::account(Entry* e) noexcept
+{
+    // Values of more than 2GB are accounted as 2GB
+    uint32_t mem = std::min<size_t>(e->mem_usage(), INT32_MAX);
+
+    m_entries_mem += mem;
+    m_entries_mem -= e->m_mem;
+    e->m_mem = mem;
+}
+
+// ===================================================================
+
+uint64_t
+HashTable::random() noexcept
+{
+    // xorshift64*
+    m_random ^= m_random >> 12;
+    m_random ^= m_random << 25;
+    m_random ^= m_random >> 27;
+
+    return m_random * 0x2545F4914F6CDD1DULL;
+}
+
+// ===================================================================
+
+void
+HashTable::touch(Entry* e) noexcept
+{
+    if (m_maxmemory == 0) return;
+
+    if (m_policy != EVICT_LFU) {
+        e->m_lru = lru_clock();
+        return;
+    }
+
+    uint32_t now = lfu_minutes();
+    uint32_t counter = lfu_decayed(e->m_lru, now);
+    if (counter < 255) {
+        double r = (random() >> 11) / 9007199254740992.0; // 2^53
+        double base = counter > HASH_MAP_LFU_INIT_VAL ?
+                      counter - HASH_MAP_LFU_INIT_VAL : 0;
+        if (r < 1.0 / (base * HASH_MAP_LFU_LOG_FACTOR + 1)) counter++;
+    }
+    e->m_lru = now << 8 | counter;
+}
+
+// ===================================================================
+
+unsigned long
+HashTable::idle_score(const Entry* e, uint32_t now) const noexcept
+{
+    if (m_policy == EVICT_LFU) return 255 - lfu_decayed(e->m_lru, now);
+
+    // The clock wraps around
+    unsigned long idle = (now - e->m_lru) & LRU_CLOCK_MAX;
+
+    return idle * HASH_MAP_LRU_RESOLUTION_MS;
+}
+
+// ===================================================================
+
+unsigned
+HashTable::sample(Entry** out, unsigned count)
+{
+    unsigned long mask = std::max(m_ht[0].m_sizemask, m_ht[1].m_sizemask);
+    unsigned long idx = random() & mask;
+    unsigned long steps = count * HASH_MAP_EMPTY_VISITS;
+    unsigned found = 0, empty = 0;
+
+    if (size() == 0) return 0;
+
+    // Like Redis dictGetSomeKeys, walk the buckets from a random
+    // place, jumping to another one after a run of empty buckets
+    while (found < count && steps-- > 0) {
+        for (int table = 0; table <= 1; table++) {
+            const Table& t = m_ht[table];
+
+            // Buckets of the first table below m_rehashidx are
+            // empty, and so is a larger index than the table has
+            if (table == 0 && is_rehashing() &&
+                idx < (unsigned long)m_rehashidx) continue;
+            if (idx >= t.m_size) continue;
+
+            Entry* e = t.mp_table[idx];
+            if (!e) {
+                if (++empty >= 5 && empty > count) {
+                    idx = random() & mask;
+                    empty = 0;
+                }
+                continue;
+            }
+            empty = 0;
+            for (; e && found < count; e = e->next) out[found++] = e;
+            if (found == count) return found;
+
+            if (!is_rehashing()) break;
+        }
+        idx = (idx + 1) & mask;
+    }
+
+    return found;
+}
+
+// ===================================================================
+
+void
+HashTable::populate_eviction_pool()
+{
+    Entry* samples[HASH_MAP_EVICTION_MAX_SAMPLES];
+    unsigned n = sample(samples, m_samples);
+    uint32_t now = m_policy == EVICT_LFU ? lfu_minutes() : lru_clock();
+
+    for (unsigned i = 0; i < n; i++) {
+        unsigned long idle = idle_score(samples[i], now);
+        auto it = std::upper_bound(
+            m_eviction_pool.begin(), m_eviction_pool.end(), idle,
+            [](unsigned long idle, const EvictionCandidate& c) {
+                return idle < c.idle;
+            });
+        size_t pos = it - m_eviction_pool.begin();
+
+        if (m_eviction_pool.size() == HASH_MAP_EVICTION_POOL) {
+            // Worse than all the candidates
+            if (pos == 0) continue;
+            m_eviction_pool.erase(m_eviction_pool.begin());
+            pos--;
+        }
+        m_eviction_pool.insert(m_eviction_pool.begin() + pos,
+                               EvictionCandidate{idle, samples[i]->key});
+    }
+}
+
+// ===================================================================
+
+Entry*
+HashTable::eviction_victim()
+{
+    Entry* e = nullptr;
+
+    // Sampling may only find empty buckets, then it tries again
+    while (size() > 0) {
+        if (m_policy == EVICT_RANDOM) {
+            if (sample(&e, 1)) return e;
+            continue;
+        }
+
+        populate_eviction_pool();
+
+        // Candidates may have been removed since they were sampled
+        while (!m_eviction_pool.empty()) {
+            sstring key = std::move(m_eviction_pool.back().key);
+            m_eviction_pool.pop_back();
+            e = lookup(key, hash_key(key));
+            if (e) return e;
+        }
+    }
+
+    return nullptr;
+}
+
+// ===================================================================
+
+void
+HashTable::evict_if_needed()
+{
+    if (m_maxmemory == 0) return;
+
+    while (used_memory() > m_maxmemory) {
+        Entry* e = eviction_victim();
+        if (!e) break;
+        remove_entry(e, hash_key(e->key));
+        m_evicted++;
+    }
+}
+
+// ===================================================================
+
+int64_t
+HashTable::now_ms() noexcept
+{
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now)
+           .count();
+}
+
+// ===================================================================
+
+int64_t
+HashTable::deadline_of(const Entry* e)
+{
+    int64_t when = 0;
+
+    mp_expires->find(e->key)->get_int(when);
+
+    return when;
+}
+
+// ===================================================================
+
+bool
+HashTable::expire_if_needed(Entry* e, int64_t now)
+{
+    if (deadline_of(e) > now) return false;
+
+    remove_entry(e, hash_key(e->key));
+    m_expire_stats.expired++;
+
+    return true;
+}
+
+// ===================================================================
+
+Entry*
+HashTable::lookup_live(const sstring& key, uint32_t hash)
+{
+    Entry* e = lookup(key, hash);
+
+    if (e && e->m_expires && expire_if_needed(e, now_ms())) {
+        m_expire_stats.lazy++;
+        return nullptr;
+    }
+
+    return e;
+}
+
+// ===================================================================
+
+result_t
+HashTable::expire_at(const sstring& key, int64_t when_ms)
+{
+    Entry* e = find(key);
+    if (!e) return HASH_ERR;
+
+    if (!mp_expires) mp_expires.reset(new HashTable);
+    mp_expires->find_or_add(sstring(key))->set_int(when_ms);
+    e->m_expires = 1;
+    expire_if_needed(e, now_ms());
+
+    return HASH_OK;
+}
+
+// ===================================================================
+
+result_t
+HashTable::expire(const sstring& key, int64_t ttl_ms)
+{
+    return expire_at(key, now_ms() + ttl_ms);
+}
+
+// ===================================================================
+
+int64_t
+HashTable::ttl(const sstring& key)
+{
+    Entry* e = find(key);
+
+    if (!e) return -2;
+    if (!e->m_expires) return -1;
+
+    return std::max<int64_t>(deadline_of(e) - now_ms(), 0);
+}
+
+// ===================================================================
+
+result_t
+HashTable::persist(const sstring& key)
+{
+    Entry* e = find(key);
+    if (!e || !e->m_expires) return HASH_ERR;
+
+    drop_deadline(e);
+
+    return HASH_OK;
+}
+
+// ===================================================================
+
+void
+HashTable::drop_deadline(Entry* e)
+{
+    if (!e->m_expires) return;
+
+    mp_expires->remove(e->key);
+    e->m_expires = 0;
+}
+
+// ===================================================================
+
+unsigned long
+HashTable::active_expire(unsigned long budget_us)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::microseconds(budget_us);
+    unsigned long sampled = 0, expired = 0;
+    Entry* samples[HASH_MAP_EXPIRE_KEYS_PER_LOOP];
+
+    m_expire_stats.cycles++;
+
+    while (expires() > 0) {
+        int64_t now = now_ms();
+        unsigned n = mp_expires->sample(samples,
+                                        HASH_MAP_EXPIRE_KEYS_PER_LOOP);
+        // A small index may be sampled around twice
+        std::sort(samples, samples + n);
+        n = std::unique(samples, samples + n) - samples;
+
+        unsigned long stale = 0;
+        for (unsigned i = 0; i < n; i++) {
+            int64_t when = 0;
+            samples[i]->get_int(when);
+            if (when > now) continue;
+
+            // Removing the key removes samples[i] from the index
+            uint32_t hash = hash_key(samples[i]->key);
+            Entry* e = lookup(samples[i]->key, hash);
+            if (e) remove_entry(e, hash);
+            stale++;
+        }
+        sampled += n;
+        expired += stale;
+
+        // Few expired keys left: not worth another sample. Judged on
+        // all the samples of the cycle, as a run of buckets alone may
+        // be unlucky.
+        if (expired * 100 <= sampled * HASH_MAP_EXPIRE_STALE) break;
+        if (std::chrono::steady_clock::now() >= end) {
+            m_expire_stats.timeouts++;
+            break;
+        }
+    }
+
+    // The index never gets its memory back otherwise, after a wave
+    // of keys expired
+    if (mp_expires && mp_expires->size() * 10 < mp_expires->buckets()) {
+        mp_expires->resize();
+    }
+
+    if (sampled) {
+        m_expire_stats.stale = 0.05 * expired / sampled +
+                               0.95 * m_expire_stats.stale;
+    }
+    m_expire_stats.expired += expired;
+    m_expire_stats.cycle_us +=
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    return expired;
+}
 
 }; // end namespace hypocampd
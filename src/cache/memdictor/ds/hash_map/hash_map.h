@@ -1,62 +1,553 @@
 #ifndef HYPOCAMPD_HASH_MAP_H
-#define HYPOCAMPD_HASH_MAP
+#define HYPOCAMPD_HASH_MAP_H
 
 // This hash map is kind of similar to Redis dict
 
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "common/mem_pool.h"
 #include "common/murmurhash3.h"
+#include "cache/memdictor/abstract_object.h"
+#include "cache/memdictor/ds/simple_string/simple_string.h"
 
 #define HASH_MAP_MIN_ENTRIES 512 // Should be always power of two
 
+// Number of buckets a rehash step may find empty for
+// every bucket it is asked to migrate, before it returns
+#define HASH_MAP_EMPTY_VISITS 10
+
+// Number of buckets rehash_ms migrates between two
+// checks of the clock
+#define HASH_MAP_REHASH_BATCH 100
+
+// Number of buckets a scan may visit for every entry it is
+// asked to report
+#define HASH_MAP_SCAN_VISITS 10
+
+// Entries sampled for every eviction by default, and at most
+#define HASH_MAP_EVICTION_SAMPLES 5
+#define HASH_MAP_EVICTION_MAX_SAMPLES 64
+
+// Best eviction candidates kept between two evictions
+#define HASH_MAP_EVICTION_POOL 16
+
+// Keys with a deadline sampled at once by the active expire cycle.
+// It samples again while more than HASH_MAP_EXPIRE_STALE percent of
+// the keys it sampled had expired.
+#define HASH_MAP_EXPIRE_KEYS_PER_LOOP 20
+#define HASH_MAP_EXPIRE_STALE 10
+
+// Milliseconds per tick of the 24 bit LRU clock of the entries.
+// With 1 second ticks, it wraps after 194 days.
+#ifndef HASH_MAP_LRU_RESOLUTION_MS
+#define HASH_MAP_LRU_RESOLUTION_MS 1000
+#endif
+
+// The LFU counter of an entry grows by one with a probability of
+// 1 / ((counter - HASH_MAP_LFU_INIT_VAL) * HASH_MAP_LFU_LOG_FACTOR + 1)
+// on every access, about logarithmically: with a factor of 10 it
+// takes 1M accesses to reach 255. It drops by one for every
+// HASH_MAP_LFU_DECAY_TIME minutes without access.
+#define HASH_MAP_LFU_LOG_FACTOR 10
+#define HASH_MAP_LFU_DECAY_TIME 1
+// Counter of new entries, so that they get a chance to be accessed
+// before being evicted
+#define HASH_MAP_LFU_INIT_VAL 5
+
 namespace hypocampd {
 
+class LazyFree;
+
 enum result_t {
     HASH_OK = 0,
     HASH_ERR,
 };
 
-struct Entry {
-    AObject key; 
-    union {
+// Encoding of the value of an entry
+enum encoding_t : uint8_t {
+    ENC_OBJECT = 0, // An AObject, possibly empty
+    ENC_INT,        // int64_t stored in place
+    ENC_UINT,       // uint64_t stored in place
+    ENC_DOUBLE,     // double stored in place
+};
+
+// Entries evicted when a table is over its memory limit
+enum evict_policy_t {
+    EVICT_LRU = 0, // The least recently used
+    EVICT_LFU,     // The least frequently used
+    EVICT_RANDOM,  // Any
+};
+
+/*
+ * Entry: A key-value pair of the hash table, chained to the
+ * next entry of its bucket.
+ * The value is either an object owned by the entry, or a number
+ * stored in its place, so that counters and numbers never need
+ * an object. The encoding tells which one, and the accessors keep
+ * it right: setting a number destroys the object held till then.
+ * Entries are allocated from the memory pool.
+ */
+struct Entry: public PoolAllocated {
+    // The entry holds the integer 0
+    Entry(sstring&& k): key(std::move(k)), m_lru(0), m_mem(0),
+                        m_expires(0) {
+        val.s64 = 0;
+    }
+
+    ~Entry() {
+        drop_object();
+    }
+
+    Entry(const Entry& other) = delete;
+    void operator=(const Entry& other) = delete;
+
+    encoding_t encoding() const noexcept {
+        return m_enc;
+    }
+
+    // Setters replace the value, whatever its encoding
+    void set_object(AObject&& o) noexcept {
+        if (m_enc == ENC_OBJECT) {
+            val.value = std::move(o);
+        } else {
+            new (&val.value) AObject(std::move(o));
+            m_enc = ENC_OBJECT;
+        }
+    }
+
+    void set_int(int64_t v) noexcept {
+        drop_object();
+        val.s64 = v;
+        m_enc = ENC_INT;
+    }
+
+    void set_uint(uint64_t v) noexcept {
+        drop_object();
+        val.u64 = v;
+        m_enc = ENC_UINT;
+    }
+
+    void set_double(double v) noexcept {
+        drop_object();
+        val.d = v;
+        m_enc = ENC_DOUBLE;
+    }
+
+    // Store a string value: as an integer if it is one written
+    // the way it formats back (see string_to_int64), so that it
+    // takes no memory of its own, else as an sstring object
+    void set_string(sstring&& s);
+
+    // Returns the value as a string: the sstring object held, the
+    // shared string of a small integer, or the number formatted
+    // in buf. Returns nullptr if the value is another object.
+    const sstring* get_string(sstring& buf) const;
+
+    // Returns the object, or nullptr if the value is a number
+    AObject* get_object() noexcept {
+        return m_enc == ENC_OBJECT ? &val.value : nullptr;
+    }
+
+    // Getters return false if the value is an object, or a
+    // number which the type can not represent exactly
+    bool get_int(int64_t& v) const noexcept;
+    bool get_uint(uint64_t& v) const noexcept;
+    // Integers convert to the nearest double
+    bool get_double(double& v) const noexcept;
+
+    // Add delta to an integer value, in its encoding.
+    // Returns false, leaving the value unchanged, if it is
+    // not an integer or the result would overflow.
+    bool incr_by(int64_t delta) noexcept;
+
+    // Add delta to a number, which becomes a double.
+    // Returns false, leaving the value unchanged, if it is
+    // an object or the result is not finite.
+    bool incr_by_double(double delta) noexcept;
+
+    // Returns the bytes taken by the entry, its key and its value
+    size_t mem_usage() const noexcept;
+
+    sstring key;
+    Entry* next = nullptr;
+
+private:
+    friend class HashTable;
+
+    void drop_object() noexcept {
+        if (m_enc == ENC_OBJECT) val.value.~AObject();
+    }
+
+    // Returns the object, leaving the integer 0
+    AObject take_object() noexcept {
+        AObject o;
+        if (m_enc == ENC_OBJECT) {
+            o = std::move(val.value);
+            val.value.~AObject();
+            val.s64 = 0;
+            m_enc = ENC_INT;
+        }
+        return o;
+    }
+
+    union Value {
+        Value() {}
+        ~Value() {}
+
         AObject value;
         uint64_t u64;
         int64_t s64;
         double d;
     } val;
+    encoding_t m_enc = ENC_INT;
+    // Depending on the eviction policy of the table, the LRU clock
+    // of the last access, or the LFU time of the last decrement in
+    // minutes (16 high bits) and logarithmic access counter (8 low
+    // bits). Takes the padding after the encoding.
+    uint32_t m_lru : 24;
+    // Memory accounted for the entry by its table
+    uint32_t m_mem : 31;
+    // Set if the key has a deadline in the expires index
+    uint32_t m_expires : 1;
+};
 
-    Entry* next = nullptr;
+// Expiration stats of a HashTable
+struct ExpireStats {
+    unsigned long expired  = 0; // Keys removed at their deadline
+    unsigned long lazy     = 0; // Of which when accessed
+    unsigned long cycles   = 0; // Active expire cycles run
+    unsigned long timeouts = 0; // Cycles which used all their budget
+    unsigned long cycle_us = 0; // Time spent in the cycles
+    // Moving average of the fraction of expired keys in the samples
+    // of the cycles, an estimate of the keys with a deadline which
+    // are expired but not removed yet
+    double stale = 0;
 };
 
+/*
+ * HashTable: Chained hash table with incremental rehashing.
+ *
+ * It holds two tables. Normally only the first one is in use.
+ * When the table grows or shrinks, the second one is allocated
+ * with the new size, and the entries are migrated from the first
+ * one bucket by bucket: every add, find, replace and remove
+ * migrates one bucket, and rehash_ms can migrate more when the
+ * server is idle. Lookups search both tables while the migration
+ * runs, and new entries go to the second one. Once the first
+ * table is empty, the second one takes its place.
+ * This way, no single operation ever pays for moving all the
+ * entries, however large the table is.
+ *
+ * The table accounts the memory of its entries and bucket arrays,
+ * and can be given a limit. Writes made over the limit first evict
+ * entries, picked like Redis does: LRU and LFU sample a few entries
+ * from a random place for every eviction, and keep the best
+ * candidates seen in an eviction pool.
+ *
+ * Keys may have a deadline, kept in a separate expires index, a
+ * HashTable of the keys to their deadline in milliseconds since the
+ * epoch, so that keys without one pay nothing. Expired keys are
+ * removed when accessed, or by active_expire, which the server
+ * calls on every tick to reclaim those never accessed again.
+ *
+ * Not thread safe.
+ */
 class HashTable {
 public:
-    HashTable(unsigned long size = HASH_MAP_MIN_ENTRIES):
-                                m_size(size),
-                                m_sizemask(m_size - 1),
-                                mp_table(new Entry*[size])
-    {
-    }
+    HashTable(unsigned long size = HASH_MAP_MIN_ENTRIES);
+
+    ~HashTable();
+
+    HashTable(const HashTable& other) = delete;
+    void operator=(const HashTable& other) = delete;
 
     // Add an element to the hash table
-    result_t add(const AObject&& key, const AObject&& val);
-  
-    // Low level add. This function adds the entry but 
-    // instead of setting a value to the entry, it returs the
-    // entry itself. the user is resposible to set the entry in 
-    // the returned entry. 
-    // This is basically used to take advantage of the union field
-    // inside Entry.
-    // The user in this case can directly store unsigned/signed/double
-    // numeric value instead of storing it as a pointer.
-    // TODO: Check if this functionality can be provided by the class itself.
-    Entry* add_raw(const AObject&& key); 
-
-    Entry* find(const AObject&& key);
-
-    AObject fetch_value(); 
+    // Returns HASH_ERR if the key is already present
+    result_t add(sstring&& key, AObject&& val);
+
+    // Low level add. This function adds the entry, holding the
+    // integer 0, and returns it so that the user sets its value
+    // with the Entry setters, e.g. a number stored in place
+    // instead of an object.
+    // Returns nullptr if the key is already present.
+    Entry* add_raw(sstring&& key);
+
+    // Returns the entry of the key, adding one holding the
+    // integer 0 if it is not present
+    Entry* find_or_add(sstring&& key);
+
+    // Add delta to the integer value of the key, adding the key
+    // with the value delta if it is not present.
+    // Returns the entry, or nullptr if the value is not an
+    // integer or would overflow.
+    Entry* incr_by(sstring&& key, int64_t delta);
+
+    // Add the element, or replace the value of the key if it is
+    // already present, destroying the old value and its deadline,
+    // like SET. find_or_add and incr_by keep the deadline.
+    // Returns true if the key was added, false if it was replaced.
+    bool replace(sstring&& key, AObject&& val);
+
+    // Returns the entry of the key, or nullptr if it is not present
+    Entry* find(const sstring& key);
+
+    // Returns the object stored for the key, or nullptr if the
+    // key is not present or holds a number
+    AObject* fetch_value(const sstring& key);
+
+    // Remove the key and destroy its entry
+    // Returns HASH_ERR if the key is not present
+    result_t remove(const sstring& key);
+
+    // Remove all the entries
+    void clear();
+
+    // Start growing or shrinking the table to the smallest
+    // power of two of at least size buckets.
+    // Returns HASH_ERR if the table is already being rehashed,
+    // would be too small for its entries, or has that size.
+    result_t expand(unsigned long size);
+
+    // Start shrinking the table to the smallest size that holds
+    // all its entries with a load factor of at most 1
+    result_t resize();
+
+    // Migrate n buckets, skipping at most HASH_MAP_EMPTY_VISITS
+    // empty buckets for each one.
+    // Returns true if there are still buckets left to migrate.
+    bool rehash(int n);
+
+    // Migrate buckets for about ms milliseconds.
+    // Meant to use idle time to finish a rehash sooner.
+    // Returns the number of buckets migrated.
+    int rehash_ms(int ms);
+
+    bool is_rehashing() const noexcept {
+        return m_rehashidx != -1;
+    }
+
+    // Called by scan for every entry it reports
+    typedef std::function<void(Entry*)> ScanFn;
+
+    // Report the entries of the buckets at cursor to fn, moving on
+    // to the next cursors until at least count entries have been
+    // reported or count * HASH_MAP_SCAN_VISITS buckets visited.
+    // Returns the cursor to continue from, which is 0 once the whole
+    // table has been scanned. Start with cursor 0.
+    // The table keeps no state for the scan: every entry present
+    // from the first call to the last is reported at least once,
+    // whatever the table grew, shrank or rehashed in between. Some
+    // may be reported twice if the table shrank. Expired keys are
+    // not reported. fn may change the values, but must not add or
+    // remove keys.
+    unsigned long scan(unsigned long cursor, unsigned long count,
+                       const ScanFn& fn);
+
+    // Limit the memory of the table to maxmemory bytes, 0 for no
+    // limit. Over the limit, add, add_raw, find_or_add, incr_by and
+    // replace first evict entries picked by policy until the table
+    // is under it, which invalidates Entry pointers held till then.
+    // LRU and LFU sample samples entries, at most
+    // HASH_MAP_EVICTION_MAX_SAMPLES, for every eviction.
+    void set_maxmemory(size_t maxmemory,
+                       evict_policy_t policy = EVICT_LRU,
+                       unsigned samples = HASH_MAP_EVICTION_SAMPLES);
+
+    // Account the memory of e again, after its value was changed
+    // with the Entry setters
+    void account(Entry* e) noexcept;
+
+    // Hand the values of the entries removed, evicted, expired or
+    // replaced from now on to lazy_free, which frees the large ones
+    // in the background. nullptr, the default, frees them in place.
+    // lazy_free must outlive the table.
+    void set_lazy_free(LazyFree* lazy_free) noexcept {
+        mp_lazy_free = lazy_free;
+    }
+
+    // Drop the value of e, leaving the integer 0. An object goes
+    // through the lazy free if set, else is destroyed in place. For
+    // values about to be overwritten with the Entry setters, which
+    // would free them in place.
+    void drop_value(Entry* e);
+
+    // Returns the memory of the entries, bucket arrays and
+    // expires index
+    size_t used_memory() const noexcept {
+        return m_entries_mem + buckets() * sizeof(Entry*) +
+               (mp_expires ? mp_expires->used_memory() : 0);
+    }
+
+    // Returns the number of entries evicted
+    unsigned long evicted() const noexcept {
+        return m_evicted;
+    }
+
+    // Set the deadline of key, in milliseconds since the epoch.
+    // The key expires at once if it is in the past.
+    // Returns HASH_ERR if the key is not present.
+    result_t expire_at(const sstring& key, int64_t when_ms);
+
+    // Set the deadline of key ttl_ms milliseconds from now
+    result_t expire(const sstring& key, int64_t ttl_ms);
+
+    // Returns the milliseconds key has left, -1 if it has no
+    // deadline, -2 if it is not present
+    int64_t ttl(const sstring& key);
+
+    // Remove the deadline of key.
+    // Returns HASH_ERR if the key is not present or had none.
+    result_t persist(const sstring& key);
+
+    // Remove the deadline of e, if it has one. For values about to
+    // be overwritten with the Entry setters, as replace does.
+    void drop_deadline(Entry* e);
+
+    // Remove expired keys found by sampling the keys with a deadline
+    // for at most budget_us microseconds, as long as the samples show
+    // more than HASH_MAP_EXPIRE_STALE percent of expired keys.
+    // Returns the number of keys removed.
+    unsigned long active_expire(unsigned long budget_us);
+
+    // Returns the number of keys with a deadline
+    unsigned long expires() const noexcept {
+        return mp_expires ? mp_expires->size() : 0;
+    }
+
+    const ExpireStats& expire_stats() const noexcept {
+        return m_expire_stats;
+    }
+
+    // Returns the milliseconds since the epoch, the time deadlines
+    // are compared to
+    static int64_t now_ms() noexcept;
+
+    // Returns the number of entries
+    unsigned long size() const noexcept {
+        return m_ht[0].m_used + m_ht[1].m_used;
+    }
+
+    // Returns the number of buckets of both tables
+    unsigned long buckets() const noexcept {
+        return m_ht[0].m_size + m_ht[1].m_size;
+    }
+
+private:
+    // Bucket arrays come from calloc, which gets large ones as
+    // fresh zero pages from the kernel, so allocating the second
+    // table costs nothing up front even when it is huge.
+    struct BucketsDeleter {
+        void operator()(Entry** buckets) const {
+            free(buckets);
+        }
+    };
+
+    struct Table {
+        std::unique_ptr<Entry*[], BucketsDeleter> mp_table;
+        unsigned long m_size     = 0;
+        unsigned long m_sizemask = 0;
+        unsigned long m_used     = 0;
+
+        void reset() noexcept {
+            mp_table.reset();
+            m_size = m_sizemask = m_used = 0;
+        }
+    };
+
+    static uint32_t hash_key(const sstring& key) noexcept;
+
+    // Migrate one bucket if a rehash is running
+    void rehash_step() {
+        if (is_rehashing()) rehash(1);
+    }
+
+    // Start growing the table if its load factor reached 1
+    void expand_if_needed();
+
+    // Returns the bucket of the table new entries go to where the
+    // key would be added, or -1 if the key is already present.
+    long key_index(const sstring& key, uint32_t hash);
+
+    // Returns the entry of the key, without a rehash step
+    Entry* lookup(const sstring& key, uint32_t hash);
+
+    // Adds an entry for the key, which must not be present
+    Entry* add_entry(sstring&& key, long index);
+
+    // Destroy all the entries of table t
+    void clear_table(Table& t);
+
+    // Report the buckets at cursor, returns the next cursor
+    unsigned long scan_cursor(unsigned long cursor, const ScanFn& fn,
+                              unsigned long& reported);
+
+    // An entry sampled for eviction, and its score
+    struct EvictionCandidate {
+        unsigned long idle;
+        sstring key;
+    };
+
+    uint64_t random() noexcept;
+
+    // Record an access to e, for the eviction policy
+    void touch(Entry* e) noexcept;
+
+    // Returns how good a candidate for eviction e is, the higher
+    // the better. now is the LRU clock, or the LFU time.
+    unsigned long idle_score(const Entry* e, uint32_t now) const noexcept;
+
+    // Fills out with up to count entries from consecutive buckets
+    // at a random place. Returns the number of entries found.
+    unsigned sample(Entry** out, unsigned count);
+
+    // Add sampled entries to the eviction pool
+    void populate_eviction_pool();
+
+    // Returns the next entry to evict
+    Entry* eviction_victim();
+
+    // Evict entries until the table is under its memory limit
+    void evict_if_needed();
+
+    // Unlink e, whose key hashes to hash, and destroy it
+    void remove_entry(Entry* e, uint32_t hash);
+
+    // Returns the deadline of e, which must have one
+    int64_t deadline_of(const Entry* e);
+
+    // Remove e, which must have a deadline, if it is before now.
+    // Returns true if it was removed.
+    bool expire_if_needed(Entry* e, int64_t now);
+
+    // Returns the entry of key, without a rehash step, or nullptr
+    // if it is not present or was removed as expired
+    Entry* lookup_live(const sstring& key, uint32_t hash);
+
 private:
-    unsigned long m_size     = 0;
-    unsigned long m_sizemask = 0;
-    unsigned long m_used     = 0;
-    std::unique_ptr<Entry*[]> mp_table;
+    Table m_ht[2];
+    // Next bucket of m_ht[0] to migrate, or -1 if no rehash
+    // is running
+    long m_rehashidx = -1;
+
+    size_t m_entries_mem    = 0;
+    size_t m_maxmemory      = 0;
+    evict_policy_t m_policy = EVICT_LRU;
+    unsigned m_samples      = HASH_MAP_EVICTION_SAMPLES;
+    unsigned long m_evicted = 0;
+    // Sorted by increasing idle score
+    std::vector<EvictionCandidate> m_eviction_pool;
+    uint64_t m_random       = 0x9e3779b97f4a7c15ULL;
+
+    // Deadlines of the keys, stored as integers
+    std::unique_ptr<HashTable> mp_expires;
+    ExpireStats m_expire_stats;
+
+    LazyFree* mp_lazy_free = nullptr;
 };
 
 }; // End namespace hypocampd
@@ -0,0 +1,520 @@
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cache/memdictor/ds/hash_map/swiss_table.h"
+
+namespace hypocampd {
+
+static const uint32_t HASH_MAP_SEED = 5381;
+
+// Returns the smallest power of two at least size,
+// and no less than HASH_MAP_MIN_ENTRIES
+static unsigned long next_power(unsigned long size)
+{
+    unsigned long i = HASH_MAP_MIN_ENTRIES;
+
+    if (size >= LONG_MAX) return LONG_MAX + 1LU;
+    while (i < size) i *= 2;
+
+    return i;
+}
+
+// Bit i of the result is set if control byte i of the group is b
+static inline uint32_t group_match(const uint8_t* group, uint8_t b)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_SIZE; i++) {
+        mask |= uint32_t(group[i] == b) << i;
+    }
+    return mask;
+#endif
+}
+
+// Bit i of the result is set if slot i of the group is full
+static inline uint32_t group_full(const uint8_t* group)
+{
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(ctrl);
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < SWISS_GROUP_SIZE; i++) {
+        mask |= uint32_t(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+// Control byte of a full slot holding a key of that hash
+static inline uint8_t hash_tag(uint32_t hash)
+{
+    return 0x80 | (hash & 0x7f);
+}
+
+// ===================================================================
+
+SwissHashTable::SwissHashTable(unsigned long size)
+{
+    allocate(next_power(size));
+}
+
+// ===================================================================
+
+SwissHashTable::~SwissHashTable()
+{
+    clear();
+}
+
+// ===================================================================
+
+uint32_t
+SwissHashTable::hash_key(const sstring& key) noexcept
+{
+    return murmurhash(key.c_str(), key.length(), HASH_MAP_SEED);
+}
+
+// ===================================================================
+
+long
+SwissHashTable::find_index(const Table& t, const sstring& key,
+                           uint32_t hash)
+{
+    uint8_t tag = hash_tag(hash);
+    unsigned long g = (hash >> 7) & t.m_groupmask;
+
+    for (unsigned long step = 1; ; step++) {
+        const uint8_t* ctrl = &t.mp_ctrl[g * SWISS_GROUP_SIZE];
+        // Load the slots of the group along with its control bytes,
+        // instead of after them, on a hit
+        __builtin_prefetch(&t.mp_slots[g * SWISS_GROUP_SIZE]);
+
+        for (uint32_t m = group_match(ctrl, tag); m; m &= m - 1) {
+            unsigned long idx = g * SWISS_GROUP_SIZE + __builtin_ctz(m);
+            if (t.mp_slots[idx]->key == key) return idx;
+        }
+        // The key would have been put in this group
+        if (group_match(ctrl, CTRL_EMPTY)) return -1;
+
+        g = (g + step) & t.m_groupmask;
+    }
+}
+
+// ===================================================================
+
+unsigned long
+SwissHashTable::free_index(const Table& t, uint32_t hash)
+{
+    unsigned long g = (hash >> 7) & t.m_groupmask;
+
+    for (unsigned long step = 1; ; step++) {
+        uint32_t m = ~group_full(&t.mp_ctrl[g * SWISS_GROUP_SIZE]) &
+                     ((1U << SWISS_GROUP_SIZE) - 1);
+        if (m) return g * SWISS_GROUP_SIZE + __builtin_ctz(m);
+
+        g = (g + step) & t.m_groupmask;
+    }
+}
+
+// ===================================================================
+
+void
+SwissHashTable::set_slot(Table& t, unsigned long idx, uint32_t hash,
+                         Entry* e)
+{
+    if (t.mp_ctrl[idx] == CTRL_DELETED) t.m_deleted--;
+    t.mp_ctrl[idx]  = hash_tag(hash);
+    t.mp_slots[idx] = e;
+    t.m_used++;
+}
+
+// ===================================================================
+
+void
+SwissHashTable::erase_slot(Table& t, unsigned long idx)
+{
+    const uint8_t* group = &t.mp_ctrl[idx & ~(SWISS_GROUP_SIZE - 1LU)];
+
+    // No probe goes past a group with an empty slot, so the
+    // slot can be made empty again. Otherwise probes may go
+    // past it to a key further away, and it must stay deleted.
+    if (group_match(group, CTRL_EMPTY)) {
+        t.mp_ctrl[idx] = CTRL_EMPTY;
+    } else {
+        t.mp_ctrl[idx] = CTRL_DELETED;
+        t.m_deleted++;
+    }
+    t.m_used--;
+}
+
+// ===================================================================
+
+void
+SwissHashTable::init_table(Table& t, unsigned long size)
+{
+    uint8_t* ctrl = static_cast<uint8_t*>(calloc(size, 1));
+    Entry** slots = static_cast<Entry**>(calloc(size, sizeof(Entry*)));
+    if (!ctrl || !slots) {
+        free(ctrl);
+        free(slots);
+        throw std::bad_alloc();
+    }
+
+    t.mp_ctrl.reset(ctrl);
+    t.mp_slots.reset(slots);
+    t.m_size      = size;
+    t.m_groupmask = size / SWISS_GROUP_SIZE - 1;
+    t.m_used      = 0;
+    t.m_deleted   = 0;
+}
+
+// ===================================================================
+
+void
+SwissHashTable::allocate(unsigned long size)
+{
+    Table& t = m_ht[0].mp_ctrl ? m_ht[1] : m_ht[0];
+    init_table(t, size);
+
+    // The first allocation needs no rehash
+    if (&t == &m_ht[1]) m_rehashidx = 0;
+}
+
+// ===================================================================
+
+void
+SwissHashTable::rebuild(unsigned long size)
+{
+    Table to;
+    init_table(to, size);
+
+    for (int table = 0; table <= 1; table++) {
+        const Table& from = m_ht[table];
+
+        for (unsigned long g = 0; g * SWISS_GROUP_SIZE < from.m_size; g++) {
+            const uint8_t* ctrl = &from.mp_ctrl[g * SWISS_GROUP_SIZE];
+            for (uint32_t m = group_full(ctrl); m; m &= m - 1) {
+                Entry* e = from.mp_slots[g * SWISS_GROUP_SIZE +
+                                         __builtin_ctz(m)];
+                uint32_t hash = hash_key(e->key);
+                set_slot(to, free_index(to, hash), hash, e);
+            }
+        }
+    }
+
+    m_ht[0] = std::move(to);
+    m_ht[1].reset();
+    m_rehashidx = -1;
+}
+
+// ===================================================================
+
+result_t
+SwissHashTable::expand(unsigned long size)
+{
+    unsigned long realsize = next_power(size);
+
+    if (is_rehashing() || m_ht[0].m_used > max_load(realsize)) {
+        return HASH_ERR;
+    }
+    if (realsize == m_ht[0].m_size) return HASH_ERR;
+
+    allocate(realsize);
+
+    return HASH_OK;
+}
+
+// ===================================================================
+
+result_t
+SwissHashTable::resize()
+{
+    if (is_rehashing()) return HASH_ERR;
+    return expand(m_ht[0].m_used + m_ht[0].m_used / 7);
+}
+
+// ===================================================================
+
+void
+SwissHashTable::make_room()
+{
+    if (is_rehashing()) {
+        // The new table must keep room for the entries still to
+        // migrate, or the rehash would probe a full table forever
+        Table& t = m_ht[1];
+        if (t.m_used + t.m_deleted + m_ht[0].m_used < max_load(t.m_size)) {
+            return;
+        }
+
+        // Adds filled the new table faster than the rehash
+        // emptied the old one, which happens when shrinking a
+        // sparse table. Move everything to a larger table.
+        rebuild(next_power(size() * 2));
+        return;
+    }
+
+    Table& t = m_ht[0];
+    if (t.m_used + t.m_deleted >= max_load(t.m_size)) {
+        // With many deleted slots this rehashes to the same
+        // size, which only clears them
+        allocate(next_power(t.m_used * 2));
+    }
+}
+
+// ===================================================================
+
+bool
+SwissHashTable::rehash(int n)
+{
+    int empty_visits = n * HASH_MAP_EMPTY_VISITS;
+
+    if (!is_rehashing()) return false;
+
+    Table& from = m_ht[0];
+    Table& to   = m_ht[1];
+
+    while (n-- && from.m_used != 0) {
+        // from.m_used != 0 guarantees that there is a
+        // non-empty group at or after m_rehashidx
+        uint32_t m;
+        while (!(m = group_full(
+                     &from.mp_ctrl[m_rehashidx * SWISS_GROUP_SIZE]))) {
+            m_rehashidx++;
+            if (--empty_visits == 0) return true;
+        }
+
+        for (; m; m &= m - 1) {
+            unsigned long idx = m_rehashidx * SWISS_GROUP_SIZE +
+                                __builtin_ctz(m);
+            Entry* e = from.mp_slots[idx];
+            uint32_t hash = hash_key(e->key);
+
+            set_slot(to, free_index(to, hash), hash, e);
+            // Deleted, not empty, so that lookups in the old table
+            // still probe past it
+            from.mp_ctrl[idx] = CTRL_DELETED;
+            from.m_used--;
+        }
+        m_rehashidx++;
+    }
+
+    if (from.m_used == 0) {
+        m_ht[0] = std::move(m_ht[1]);
+        m_ht[1].reset();
+        m_rehashidx = -1;
+        return false;
+    }
+
+    return true;
+}
+
+// ===================================================================
+
+int
+SwissHashTable::rehash_ms(int ms)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(ms);
+    int rehashes = 0;
+
+    while (rehash(HASH_MAP_REHASH_BATCH)) {
+        rehashes += HASH_MAP_REHASH_BATCH;
+        if (std::chrono::steady_clock::now() >= deadline) break;
+    }
+
+    return rehashes;
+}
+
+// ===================================================================
+
+Entry*
+SwissHashTable::lookup(const sstring& key, uint32_t hash)
+{
+    for (int table = 0; table <= 1; table++) {
+        const Table& t = m_ht[table];
+        long idx = find_index(t, key, hash);
+        if (idx != -1) return t.mp_slots[idx];
+
+        // Only the first table is in use unless rehashing
+        if (!is_rehashing()) break;
+    }
+
+    return nullptr;
+}
+
+// ===================================================================
+
+Entry*
+SwissHashTable::add_entry(sstring&& key, uint32_t hash)
+{
+    make_room();
+
+    // New entries go to the new table while rehashing, so that
+    // the old one only ever gets smaller
+    Table& t = is_rehashing() ? m_ht[1] : m_ht[0];
+
+    Entry* e = new Entry(std::move(key));
+    set_slot(t, free_index(t, hash), hash, e);
+
+    return e;
+}
+
+// ===================================================================
+
+result_t
+SwissHashTable::add(sstring&& key, AObject&& val)
+{
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    if (lookup(key, hash)) return HASH_ERR;
+
+    Entry* e = add_entry(std::move(key), hash);
+    e->set_object(std::move(val));
+
+    return HASH_OK;
+}
+
+// ===================================================================
+
+Entry*
+SwissHashTable::add_raw(sstring&& key)
+{
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    if (lookup(key, hash)) return nullptr;
+
+    return add_entry(std::move(key), hash);
+}
+
+// ===================================================================
+
+Entry*
+SwissHashTable::find_or_add(sstring&& key)
+{
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    Entry* e = lookup(key, hash);
+    if (e) return e;
+
+    return add_entry(std::move(key), hash);
+}
+
+// ===================================================================
+
+Entry*
+SwissHashTable::incr_by(sstring&& key, int64_t delta)
+{
+    Entry* e = find_or_add(std::move(key));
+
+    return e->incr_by(delta) ? e : nullptr;
+}
+
+// ===================================================================
+
+bool
+SwissHashTable::replace(sstring&& key, AObject&& val)
+{
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+    Entry* e = lookup(key, hash);
+    if (!e) {
+        e = add_entry(std::move(key), hash);
+        e->set_object(std::move(val));
+        return true;
+    }
+
+    e->set_object(std::move(val));
+
+    return false;
+}
+
+// ===================================================================
+
+Entry*
+SwissHashTable::find(const sstring& key)
+{
+    if (size() == 0) return nullptr;
+
+    rehash_step();
+
+    return lookup(key, hash_key(key));
+}
+
+// ===================================================================
+
+AObject*
+SwissHashTable::fetch_value(const sstring& key)
+{
+    Entry* e = find(key);
+
+    return e ? e->get_object() : nullptr;
+}
+
+// ===================================================================
+
+result_t
+SwissHashTable::remove(const sstring& key)
+{
+    if (size() == 0) return HASH_ERR;
+
+    rehash_step();
+
+    uint32_t hash = hash_key(key);
+
+    for (int table = 0; table <= 1; table++) {
+        Table& t = m_ht[table];
+        long idx = find_index(t, key, hash);
+
+        if (idx != -1) {
+            delete t.mp_slots[idx];
+            erase_slot(t, idx);
+            return HASH_OK;
+        }
+        if (!is_rehashing()) break;
+    }
+
+    return HASH_ERR;
+}
+
+// ===================================================================
+
+void
+SwissHashTable::clear_table(Table& t)
+{
+    for (unsigned long g = 0; g * SWISS_GROUP_SIZE < t.m_size; g++) {
+        if (t.m_used == 0) break;
+
+        uint8_t* ctrl = &t.mp_ctrl[g * SWISS_GROUP_SIZE];
+        for (uint32_t m = group_full(ctrl); m; m &= m - 1) {
+            delete t.mp_slots[g * SWISS_GROUP_SIZE + __builtin_ctz(m)];
+            t.m_used--;
+        }
+    }
+    if (t.mp_ctrl) memset(t.mp_ctrl.get(), CTRL_EMPTY, t.m_size);
+    t.m_deleted = 0;
+}
+
+// ===================================================================
+
+void
+SwissHashTable::clear()
+{
+    clear_table(m_ht[0]);
+    clear_table(m_ht[1]);
+    m_ht[1].reset();
+    m_rehashidx = -1;
+}
+
+}; // end namespace hypocampd
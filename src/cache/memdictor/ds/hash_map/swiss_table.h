@@ -0,0 +1,206 @@
+#ifndef HYPOCAMPD_SWISS_TABLE_H
+#define HYPOCAMPD_SWISS_TABLE_H
+
+// This hash map is kind of similar to Abseil's SwissTable
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+#define SWISS_GROUP_SIZE 16 // Slots probed at once, with one SSE2 compare
+
+namespace hypocampd {
+
+/*
+ * SwissHashTable: Open addressing hash table, with the same interface
+ * as HashTable.
+ *
+ * The slots hold pointers to the entries, and a separate array holds
+ * one control byte per slot: either empty, deleted, or the low 7 bits
+ * of the hash of the key in the slot. A lookup compares the control
+ * bytes of a group of 16 slots against the 7 bits of its key at once
+ * (with SSE2, or a plain loop without it), and only looks at the
+ * entries whose bytes match. So a miss usually touches no entry at
+ * all, and a hit one, where the chained table follows one pointer per
+ * key of the bucket. The entries are the ones of HashTable; their
+ * next pointer is unused.
+ *
+ * Groups are probed in triangular order, which visits all of them,
+ * and the table grows when 7/8 of its slots are full or deleted.
+ *
+ * Growing and shrinking is incremental, as with HashTable: entries
+ * are migrated to the second table one group at a time. A migrated
+ * slot is marked deleted so that the probes of the first table
+ * still go past it.
+ *
+ * Not thread safe.
+ */
+class SwissHashTable {
+public:
+    SwissHashTable(unsigned long size = HASH_MAP_MIN_ENTRIES);
+
+    ~SwissHashTable();
+
+    SwissHashTable(const SwissHashTable& other) = delete;
+    void operator=(const SwissHashTable& other) = delete;
+
+    // Add an element to the hash table
+    // Returns HASH_ERR if the key is already present
+    result_t add(sstring&& key, AObject&& val);
+
+    // See HashTable::add_raw
+    // Returns nullptr if the key is already present.
+    Entry* add_raw(sstring&& key);
+
+    // Returns the entry of the key, adding one holding the
+    // integer 0 if it is not present
+    Entry* find_or_add(sstring&& key);
+
+    // See HashTable::incr_by
+    Entry* incr_by(sstring&& key, int64_t delta);
+
+    // Add the element, or replace the value of the key if it is
+    // already present, destroying the old value.
+    // Returns true if the key was added, false if it was replaced.
+    bool replace(sstring&& key, AObject&& val);
+
+    // Returns the entry of the key, or nullptr if it is not present
+    Entry* find(const sstring& key);
+
+    // Returns the object stored for the key, or nullptr if the
+    // key is not present or holds a number
+    AObject* fetch_value(const sstring& key);
+
+    // Remove the key and destroy its entry
+    // Returns HASH_ERR if the key is not present
+    result_t remove(const sstring& key);
+
+    // Remove all the entries
+    void clear();
+
+    // Start growing or shrinking the table to the smallest
+    // power of two of at least size slots.
+    // Returns HASH_ERR if the table is already being rehashed,
+    // would be more than 7/8 full, or has that size.
+    result_t expand(unsigned long size);
+
+    // Start shrinking the table to the smallest size that holds
+    // all its entries with a load factor of at most 7/8
+    result_t resize();
+
+    // Migrate n groups, skipping at most HASH_MAP_EMPTY_VISITS
+    // empty groups for each one.
+    // Returns true if there are still groups left to migrate.
+    bool rehash(int n);
+
+    // Migrate groups for about ms milliseconds.
+    // Returns the number of groups migrated.
+    int rehash_ms(int ms);
+
+    bool is_rehashing() const noexcept {
+        return m_rehashidx != -1;
+    }
+
+    // Returns the number of entries
+    unsigned long size() const noexcept {
+        return m_ht[0].m_used + m_ht[1].m_used;
+    }
+
+    // Returns the number of slots of both tables
+    unsigned long buckets() const noexcept {
+        return m_ht[0].m_size + m_ht[1].m_size;
+    }
+
+private:
+    // Control bytes. Full slots have the high bit set, so that
+    // the control array of a new table can come from calloc.
+    enum : uint8_t {
+        CTRL_EMPTY   = 0x00,
+        CTRL_DELETED = 0x01,
+        CTRL_FULL    = 0x80,
+    };
+
+    struct FreeDeleter {
+        void operator()(void* p) const {
+            free(p);
+        }
+    };
+
+    struct Table {
+        std::unique_ptr<uint8_t[], FreeDeleter> mp_ctrl;
+        std::unique_ptr<Entry*[], FreeDeleter> mp_slots;
+        unsigned long m_size      = 0;
+        unsigned long m_groupmask = 0;
+        unsigned long m_used      = 0;
+        unsigned long m_deleted   = 0;
+
+        void reset() noexcept {
+            mp_ctrl.reset();
+            mp_slots.reset();
+            m_size = m_groupmask = m_used = m_deleted = 0;
+        }
+    };
+
+    // Number of slots that may be full or deleted before the
+    // table must grow
+    static unsigned long max_load(unsigned long size) noexcept {
+        return size - size / 8;
+    }
+
+    static uint32_t hash_key(const sstring& key) noexcept;
+
+    // Returns the slot of the key in table t, or -1
+    static long find_index(const Table& t, const sstring& key,
+                           uint32_t hash);
+
+    // Returns the first slot of the probe sequence of hash
+    // in table t that is empty or deleted
+    static unsigned long free_index(const Table& t, uint32_t hash);
+
+    // Fill slot idx of table t, which must not be full
+    static void set_slot(Table& t, unsigned long idx, uint32_t hash,
+                         Entry* e);
+
+    // Empty slot idx of table t, which must be full
+    static void erase_slot(Table& t, unsigned long idx);
+
+    // Give table t size empty slots
+    static void init_table(Table& t, unsigned long size);
+
+    // Allocate a table of size slots, the first one, or the
+    // second one and start a rehash
+    void allocate(unsigned long size);
+
+    // Move the entries of both tables to a new one of size slots,
+    // at once, ending the rehash if one is running
+    void rebuild(unsigned long size);
+
+    // Migrate one group if a rehash is running
+    void rehash_step() {
+        if (is_rehashing()) rehash(1);
+    }
+
+    // Make sure the table new entries go to has room for one more
+    void make_room();
+
+    // Returns the entry of the key, without a rehash step
+    Entry* lookup(const sstring& key, uint32_t hash);
+
+    // Adds an entry for the key, which must not be present
+    Entry* add_entry(sstring&& key, uint32_t hash);
+
+    // Destroy all the entries of table t
+    void clear_table(Table& t);
+
+private:
+    Table m_ht[2];
+    // Next group of m_ht[0] to migrate, or -1 if no rehash
+    // is running
+    long m_rehashidx = -1;
+};
+
+}; // End namespace hypocampd
+
+#endif
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o churn_bench churn_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+// Add -DHYPOCAMPD_POOL_ALLOC=0 to the same command to measure glibc malloc.
+
+/*
+ * SET/DEL churn on a HashTable: loads num_keys keys, then runs num_ops
+ * operations on random keys out of twice as many, half of them SETs
+ * of a string value of 8 to 120 bytes, half DELs. Finally deletes 90%
+ * of the keys. Reports the throughput of the churn and the resident
+ * memory after each phase, and the pool report when the pool is used.
+ *
+ * usage: churn_bench [num_keys (default 1M)] [num_ops (default 10M)]
+ */
+
+using namespace hypocampd;
+
+static size_t rss_mb()
+{
+    long pages = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%*d %ld", &pages) != 1) pages = 0;
+        fclose(f);
+    }
+    return pages * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static sstring make_key(unsigned long i)
+{
+    // Keys of 3 to 23 bytes: two thirds fit in the inline buffer
+    static const char* prefixes[] = {"k:", "user:", "sess:tok:abcdef:"};
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%lu", prefixes[i % 3], i);
+    return sstring(buf);
+}
+
+static AObject make_value(std::mt19937_64& gen)
+{
+    static const std::string chars(120, 'v');
+    return make_aobject<sstring>(chars.c_str() + gen() % 113);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long num_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) :
+                             1000000;
+    unsigned long num_ops = argc > 2 ? strtoul(argv[2], nullptr, 10) :
+                            10000000;
+
+    std::cout << (HYPOCAMPD_POOL_ALLOC ? "pool" : "malloc") << ": "
+              << num_keys << " keys, " << num_ops << " ops" << std::endl;
+
+    std::mt19937_64 gen(7);
+    HashTable ht;
+    for (unsigned long i = 0; i < num_keys; i++) {
+        ht.add(make_key(i), make_value(gen));
+    }
+    std::cout << "loaded: rss " << rss_mb() << " MB" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < num_ops; i++) {
+        unsigned long k = gen() % (2 * num_keys);
+        if (gen() & 1) {
+            ht.replace(make_key(k), make_value(gen));
+        } else {
+            ht.remove(make_key(k));
+        }
+    }
+    double secs = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start).count();
+    std::cout << "churn: " << static_cast<unsigned long>(num_ops / secs)
+              << " ops/s, " << ht.size() << " keys, rss " << rss_mb()
+              << " MB" << std::endl;
+
+    for (unsigned long k = 0; k < 2 * num_keys; k++) {
+        if (k % 10) ht.remove(make_key(k));
+    }
+    ht.resize();
+    while (ht.rehash(1000));
+    std::cout << "90% deleted: " << ht.size() << " keys, rss " << rss_mb()
+              << " MB" << std::endl;
+
+    if (HYPOCAMPD_POOL_ALLOC) pool_report(std::cout);
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -DHASH_MAP_LRU_RESOLUTION_MS=1 -I <hypocampd>/src -o evict_bench evict_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * A HashTable used as a cache of num_keys keys with a memory limit
+ * for about a tenth of them. Every operation reads a key picked
+ * with a power law, the lower keys being the most popular, and sets
+ * it with a 20 byte string when it misses.
+ * For every eviction policy, reports the hit ratio, and the one of
+ * an exact LRU cache of as many keys, on the same operations, and
+ * the time per hit and per miss, the miss including the evictions.
+ * The run without limit shows the cost of a miss without eviction.
+ * Built with a 1 ms LRU clock, to be finer than the time a key
+ * takes to fall out of the cache.
+ *
+ * usage: evict_bench [num_keys (default 1M)] [num_ops (default 10M)]
+ */
+
+using namespace hypocampd;
+
+// Exact LRU cache of keys, holding at most capacity keys
+class ExactLru {
+public:
+    explicit ExactLru(size_t capacity): m_capacity(capacity) {}
+
+    // Returns true if key was cached, caches it otherwise
+    bool access(uint32_t key) {
+        auto it = m_map.find(key);
+        if (it != m_map.end()) {
+            m_list.splice(m_list.begin(), m_list, it->second);
+            return true;
+        }
+        if (m_map.size() == m_capacity) {
+            m_map.erase(m_list.back());
+            m_list.pop_back();
+        }
+        m_list.push_front(key);
+        m_map[key] = m_list.begin();
+        return false;
+    }
+
+private:
+    size_t m_capacity;
+    std::list<uint32_t> m_list;
+    std::unordered_map<uint32_t, std::list<uint32_t>::iterator> m_map;
+};
+
+static void run(const char* name, const std::vector<uint32_t>& ops,
+                const std::vector<sstring>& keys, size_t maxmemory,
+                evict_policy_t policy, unsigned samples)
+{
+    typedef std::chrono::duration<double, std::nano> ns;
+    typedef std::chrono::steady_clock clock;
+    HashTable ht;
+    ht.set_maxmemory(maxmemory, policy, samples);
+    const sstring val("a value of 20 bytes.");
+
+    // Warm up with the first half of the operations
+    size_t half = ops.size() / 2;
+    unsigned long hits = 0, misses = 0;
+    double hit_ns = 0, miss_ns = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        const sstring& key = keys[ops[i]];
+
+        auto start = clock::now();
+        bool hit = ht.find(key) != nullptr;
+        if (!hit) {
+            Entry* e = ht.find_or_add(sstring(key));
+            e->set_string(sstring(val));
+            ht.account(e);
+        }
+        double t = ns(clock::now() - start).count();
+
+        if (i < half) continue;
+        if (hit) {
+            hits++;
+            hit_ns += t;
+        } else {
+            misses++;
+            miss_ns += t;
+        }
+    }
+
+    // The exact LRU caches as many keys as the table holds
+    unsigned long exact_hits = 0;
+    ExactLru lru(ht.size());
+    for (size_t i = 0; i < ops.size(); i++) {
+        bool hit = lru.access(ops[i]);
+        if (i >= half) exact_hits += hit;
+    }
+
+    printf("%-9s %7lu keys, hits %5.2f%% (exact LRU %5.2f%%), "
+           "hit %4.0f ns, miss %5.0f ns, %lu evicted\n", name, ht.size(),
+           100.0 * hits / (ops.size() - half),
+           100.0 * exact_hits / (ops.size() - half),
+           hits ? hit_ns / hits : 0, misses ? miss_ns / misses : 0,
+           ht.evicted());
+}
+
+int main(int argc, char** argv)
+{
+    size_t num_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t num_ops = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000000;
+
+    std::vector<sstring> keys;
+    keys.reserve(num_keys);
+    char buf[32];
+    for (size_t i = 0; i < num_keys; i++) {
+        snprintf(buf, sizeof(buf), "key:%zu", i);
+        keys.emplace_back(buf);
+    }
+
+    std::mt19937_64 gen(11);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<uint32_t> ops(num_ops);
+    for (uint32_t& k : ops) k = num_keys * std::pow(uniform(gen), 5);
+
+    // Memory of a tenth of the keys, with their bucket array
+    HashTable probe;
+    Entry* e = probe.add_raw(sstring(keys[num_keys - 1]));
+    e->set_string(sstring("a value of 20 bytes."));
+    size_t cached = num_keys / 10;
+    size_t maxmemory = cached * e->mem_usage() + cached * sizeof(Entry*);
+
+    printf("%zu keys, %zu operations, %zu bytes for the cache\n",
+           num_keys, num_ops, maxmemory);
+    run("no limit", ops, keys, 0, EVICT_LRU, 5);
+    run("lru 5", ops, keys, maxmemory, EVICT_LRU, 5);
+    run("lru 10", ops, keys, maxmemory, EVICT_LRU, 10);
+    run("lfu 5", ops, keys, maxmemory, EVICT_LFU, 5);
+    run("random", ops, keys, maxmemory, EVICT_RANDOM, 5);
+    return 0;
+}
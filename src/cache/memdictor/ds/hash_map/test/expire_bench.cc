@@ -0,0 +1,105 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o expire_bench expire_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * A HashTable of session like keys, all set with a TTL of 0.5 to
+ * 1.5 seconds and never read again. Every 10 ms tick sets adds keys,
+ * then runs the active expiration cycle with a budget of budget_us,
+ * the run with budget 0 relying on lazy expiry only, which never
+ * happens here.
+ * After a warm up of 3 seconds, reports the keys expired but not
+ * reclaimed yet and their memory, averaged over the ticks, and the
+ * share of the time the cycle took.
+ *
+ * usage: expire_bench [adds per tick (default 1000)] [seconds (6)]
+ */
+
+using namespace hypocampd;
+
+static const int TICK_MS = 10;
+
+static void run(unsigned long adds, int seconds, unsigned long budget_us)
+{
+    typedef std::chrono::steady_clock clock;
+    HashTable ht;
+    std::mt19937_64 gen(7);
+    std::uniform_int_distribution<int64_t> ttl(500, 1500);
+    // Deadlines of the keys set, to count the live ones
+    std::priority_queue<int64_t, std::vector<int64_t>,
+                        std::greater<int64_t>> deadlines;
+    const sstring val("a value of 20 bytes.");
+    char buf[32];
+    unsigned long next_key = 0, ticks = 0;
+    double stale = 0, stale_mem = 0, tick_ms = 0;
+
+    auto start = clock::now();
+    auto tick = start;
+    auto warm = start + std::chrono::seconds(3);
+    auto end = warm + std::chrono::seconds(seconds);
+    unsigned long cycle_us = 0;
+
+    while (tick < end) {
+        auto begin = clock::now();
+        for (unsigned long i = 0; i < adds; i++) {
+            snprintf(buf, sizeof(buf), "session:%lu", next_key++);
+            sstring key(buf);
+            Entry* e = ht.find_or_add(sstring(key));
+            e->set_string(sstring(val));
+            ht.account(e);
+            int64_t when = HashTable::now_ms() + ttl(gen);
+            ht.expire_at(key, when);
+            deadlines.push(when);
+        }
+
+        auto cycle = clock::now();
+        if (budget_us) ht.active_expire(budget_us);
+        auto done = clock::now();
+
+        int64_t now = HashTable::now_ms();
+        while (!deadlines.empty() && deadlines.top() <= now) deadlines.pop();
+
+        if (cycle >= warm) {
+            unsigned long expired = ht.size() - deadlines.size();
+            size_t per_key = ht.size() ? (ht.used_memory() -
+                             ht.buckets() * sizeof(Entry*)) / ht.size() : 0;
+            stale += expired;
+            stale_mem += expired * per_key;
+            cycle_us += std::chrono::duration_cast<
+                std::chrono::microseconds>(done - cycle).count();
+            tick_ms += std::chrono::duration<double, std::milli>(
+                done - begin).count();
+            ticks++;
+        }
+
+        tick += std::chrono::milliseconds(TICK_MS);
+        std::this_thread::sleep_until(tick);
+    }
+
+    const ExpireStats& st = ht.expire_stats();
+    printf("budget %5lu us: %8.0f stale keys (%6.1f MB), "
+           "%7lu keys, cycle %5.2f%% CPU, %.2f ms per tick, "
+           "%lu timeouts\n",
+           budget_us, stale / ticks, stale_mem / ticks / 1e6, ht.size(),
+           100.0 * cycle_us / (ticks * TICK_MS * 1000.0), tick_ms / ticks,
+           st.timeouts);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long adds = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+    int seconds = argc > 2 ? atoi(argv[2]) : 6;
+
+    printf("%lu keys per %d ms tick, TTL 0.5 to 1.5 s\n", adds, TICK_MS);
+    for (unsigned long budget : {0UL, 250UL, 1000UL, 2500UL}) {
+        run(adds, seconds, budget);
+    }
+    return 0;
+}
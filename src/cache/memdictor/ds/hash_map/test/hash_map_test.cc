@@ -0,0 +1,447 @@
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+#include "cache/memdictor/ds/hash_map/swiss_table.h"
+#include "cache/memdictor/shared_integers.h"
+#include "common/test/test_check.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o hash_map_test hash_map_test.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../swiss_table.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+using namespace hypocampd;
+
+static sstring make_key(int i) {
+    return sstring(("key:" + std::to_string(i)).c_str());
+}
+
+template <typename Table>
+static int value_of(Table& ht, int i) {
+    AObject* o = ht.fetch_value(make_key(i));
+    return o ? *aobj_cast<int>(*o) : -1;
+}
+
+// Keys added and looked up while the table grows must all be
+// found, in whichever of the two tables they are
+template <typename Table>
+void test_grow() {
+    std::cout << "Testing growth" << std::endl;
+    Table ht;
+    const int n = 100000;
+    bool seen_rehash = false;
+    for (int i = 0; i < n; i++) {
+        check(ht.add(make_key(i), make_aobject<int>(i)) == HASH_OK, "add");
+        seen_rehash |= ht.is_rehashing();
+        if (i % 97 == 0) {
+            check(value_of(ht, i / 2) == i / 2, "find while growing");
+        }
+    }
+    check(seen_rehash, "rehash ran");
+    check(ht.size() == (unsigned long)n, "size");
+    check(ht.add(make_key(7), make_aobject<int>(0)) == HASH_ERR,
+          "duplicate add");
+    for (int i = 0; i < n; i++) {
+        check(value_of(ht, i) == i, "find after growth");
+    }
+    check(ht.find(make_key(n)) == nullptr, "missing key");
+}
+
+template <typename Table>
+void test_replace_remove() {
+    std::cout << "Testing replace and remove" << std::endl;
+    Table ht;
+    for (int i = 0; i < 10000; i++) {
+        ht.add(make_key(i), make_aobject<int>(i));
+    }
+    check(!ht.replace(make_key(5), make_aobject<int>(50)), "replace existing");
+    check(value_of(ht, 5) == 50, "replaced value");
+    check(ht.replace(make_key(20000), make_aobject<int>(1)), "replace new");
+    for (int i = 0; i < 10000; i += 2) {
+        check(ht.remove(make_key(i)) == HASH_OK, "remove");
+    }
+    check(ht.remove(make_key(0)) == HASH_ERR, "remove twice");
+    check(ht.size() == 5001, "size after remove");
+    for (int i = 1; i < 10000; i += 2) {
+        check(value_of(ht, i) == (i == 5 ? 50 : i), "kept keys");
+    }
+}
+
+template <typename Table>
+void test_numbers() {
+    std::cout << "Testing numbers" << std::endl;
+    Table ht;
+    Entry* e = ht.add_raw(sstring("counter"));
+    check(e && e->encoding() == ENC_INT, "add_raw");
+    e->set_int(-42);
+    check(ht.add_raw(sstring("counter")) == nullptr, "duplicate add_raw");
+
+    int64_t i = 0;
+    uint64_t u = 0;
+    double d = 0;
+    check(ht.find(sstring("counter"))->get_int(i) && i == -42, "int value");
+    check(!e->get_uint(u), "negative int as uint");
+    check(e->get_double(d) && d == -42, "int as double");
+    check(ht.fetch_value(sstring("counter")) == nullptr, "int fetch_value");
+
+    // Replacing numbers and objects by each other
+    ht.replace(sstring("counter"), make_aobject<int>(3));
+    check(*aobj_cast<int>(*ht.fetch_value(sstring("counter"))) == 3,
+          "int replaced by object");
+    e = ht.find(sstring("counter"));
+    check(!e->get_int(i) && !e->incr_by(1), "object is not a number");
+    e->set_double(2.5);
+    check(e->encoding() == ENC_DOUBLE && e->get_object() == nullptr,
+          "object replaced by double");
+    check(!e->get_int(i) && !e->incr_by(1), "fractional double");
+    check(e->incr_by_double(0.5) && e->get_int(i) && i == 3,
+          "incr_by_double");
+
+    // Integer increments keep their encoding and never overflow
+    check(ht.incr_by(sstring("hits"), 5)->get_int(i) && i == 5,
+          "incr_by adds");
+    check(ht.incr_by(sstring("hits"), -7)->get_int(i) && i == -2,
+          "incr_by");
+    ht.find(sstring("hits"))->set_int(INT64_MAX);
+    check(ht.incr_by(sstring("hits"), 1) == nullptr, "int overflow");
+    check(ht.find(sstring("hits"))->get_int(i) && i == INT64_MAX,
+          "unchanged on overflow");
+
+    e = ht.find_or_add(sstring("bytes"));
+    e->set_uint(UINT64_MAX - 1);
+    check(e->incr_by(1) && e->get_uint(u) && u == UINT64_MAX, "uint incr");
+    check(!e->incr_by(1) && !e->get_int(i), "uint overflow");
+    check(e->incr_by(INT64_MIN) && e->get_uint(u) &&
+          u == UINT64_MAX - (1ULL << 63), "uint decr");
+    e->set_uint(0);
+    check(!e->incr_by(-1) && e->encoding() == ENC_UINT, "uint underflow");
+    check(ht.find_or_add(sstring("bytes")) == e, "find_or_add finds");
+    check(ht.size() == 3, "size");
+}
+
+// Strings which are integers are stored as numbers, and read
+// back as the same strings
+void test_strings() {
+    std::cout << "Testing string values" << std::endl;
+    const char* ints[] = {"0", "7", "9999", "10000", "-1", "-42",
+                          "9223372036854775807", "-9223372036854775808"};
+    const char* strs[] = {"", "-", "-0", "007", "+1", " 1", "1 ", "1.5",
+                          "abc", "9223372036854775808",
+                          "-9223372036854775809", "99999999999999999999",
+                          "184467440737095516160"};
+    int64_t v;
+    sstring buf;
+
+    for (const char* s : ints) {
+        Entry e((sstring(s)));
+        e.set_string(sstring(s));
+        check(e.encoding() == ENC_INT, s);
+        const sstring* back = e.get_string(buf);
+        check(back && *back == sstring(s), "integer string round trip");
+    }
+    for (const char* s : strs) {
+        check(!string_to_int64(s, strlen(s), v), s);
+        Entry e((sstring(s)));
+        e.set_string(sstring(s));
+        check(e.encoding() == ENC_OBJECT, s);
+        const sstring* back = e.get_string(buf);
+        check(back && *back == sstring(s) && back != &buf,
+              "string round trip");
+    }
+
+    // Small integers read back as the shared strings
+    Entry e((sstring("flag")));
+    e.set_string(sstring("1"));
+    check(e.get_string(buf) == shared_integer(1), "shared integer");
+    check(shared_integer(HYPOCAMPD_SHARED_INTEGERS) == nullptr &&
+          shared_integer(-1) == nullptr, "shared range");
+    e.set_object(make_aobject<int>(1));
+    check(e.get_string(buf) == nullptr, "object is not a string");
+}
+
+// Shrinking, and finishing a rehash with the idle-time budget
+template <typename Table>
+void test_shrink() {
+    std::cout << "Testing shrink" << std::endl;
+    Table ht;
+    for (int i = 0; i < 50000; i++) {
+        ht.add(make_key(i), make_aobject<int>(i));
+    }
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    unsigned long grown = ht.buckets();
+    for (int i = 100; i < 50000; i++) {
+        ht.remove(make_key(i));
+    }
+    check(ht.resize() == HASH_OK, "resize");
+    check(ht.is_rehashing(), "shrink rehashes");
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    check(ht.buckets() < grown, "table shrank");
+    check(ht.buckets() == HASH_MAP_MIN_ENTRIES, "shrank to minimum");
+    for (int i = 0; i < 100; i++) {
+        check(value_of(ht, i) == i, "kept keys after shrink");
+    }
+}
+
+// Adds while a shrink runs, with the new table too small for the
+// keys still to migrate once the adds fill it
+template <typename Table>
+void test_shrink_full() {
+    std::cout << "Testing shrink while adding" << std::endl;
+    Table ht(65536);
+    for (int i = 0; i < 400; i++) {
+        ht.add(make_key(i), make_aobject<int>(i));
+    }
+    check(ht.resize() == HASH_OK && ht.is_rehashing(), "shrink started");
+    for (int i = 400; i < 1000; i++) {
+        check(ht.add(make_key(i), make_aobject<int>(i)) == HASH_OK,
+              "add while shrinking");
+    }
+    check(ht.size() == 1000, "size after adds");
+    for (int i = 0; i < 1000; i++) {
+        check(value_of(ht, i) == i, "keys after adds");
+    }
+}
+
+// Adds while a shrink runs, and a long run of adds and removes of
+// distinct keys, which leaves deleted slots behind in SwissHashTable
+template <typename Table>
+void test_churn() {
+    std::cout << "Testing churn" << std::endl;
+    Table ht;
+    for (int i = 0; i < 50000; i++) {
+        ht.add(make_key(i), make_aobject<int>(i));
+    }
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    for (int i = 100; i < 50000; i++) {
+        ht.remove(make_key(i));
+    }
+    ht.resize();
+    for (int i = 50000; i < 60000; i++) {
+        check(ht.add(make_key(i), make_aobject<int>(i)) == HASH_OK,
+              "add while shrinking");
+    }
+    for (int i = 60000; i < 400000; i++) {
+        ht.add(make_key(i), make_aobject<int>(i));
+        check(ht.remove(make_key(i - 10000)) == HASH_OK, "churn remove");
+    }
+    check(ht.size() == 10100, "size after churn");
+    check(ht.buckets() <= 65536, "bounded after churn");
+    for (int i = 0; i < 100; i++) {
+        check(value_of(ht, i) == i, "kept keys after churn");
+    }
+    for (int i = 390000; i < 400000; i++) {
+        check(value_of(ht, i) == i, "churned keys");
+    }
+}
+
+// Every key present for the whole scan is reported, while the table
+// grows, shrinks and rehashes between the calls. Only HashTable scans.
+void test_scan() {
+    std::cout << "Testing scan" << std::endl;
+    HashTable ht;
+    const int n = 20000;
+    std::vector<int> seen(n * 4);
+    auto count = [&](Entry* e) { seen[*aobj_cast<int>(*e->get_object())]++; };
+
+    for (int i = 0; i < n; i++) ht.add(make_key(i), make_aobject<int>(i));
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    unsigned long cursor = 0, calls = 0;
+    do {
+        cursor = ht.scan(cursor, 10, count);
+        calls++;
+    } while (cursor != 0);
+    bool once = true;
+    for (int i = 0; i < n; i++) once &= seen[i] == 1;
+    check(once, "stable table scanned once");
+    check(calls > 1 && calls <= (unsigned long)n / 10 + 1, "calls");
+
+    // Grow: adds of new keys between the calls start rehashes
+    std::fill(seen.begin(), seen.end(), 0);
+    int next = n;
+    bool seen_rehash = false;
+    do {
+        cursor = ht.scan(cursor, 10, count);
+        for (int j = 0; j < 20 && next < n * 4; j++, next++) {
+            ht.add(make_key(next), make_aobject<int>(next));
+        }
+        seen_rehash |= ht.is_rehashing();
+    } while (cursor != 0);
+    bool all = seen_rehash;
+    for (int i = 0; i < n; i++) all &= seen[i] >= 1;
+    check(all, "scan while growing");
+
+    // Shrink: the new keys are removed and the table resized
+    // in the middle of the scan
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    std::fill(seen.begin(), seen.end(), 0);
+    unsigned long grown = ht.buckets();
+    for (int i = 0; i < 3; i++) cursor = ht.scan(cursor, 100, count);
+    for (int i = n; i < next; i++) ht.remove(make_key(i));
+    check(ht.resize() == HASH_OK, "resize");
+    do {
+        cursor = ht.scan(cursor, 10, count);
+        ht.rehash(100);
+    } while (cursor != 0);
+    check(!ht.is_rehashing() && ht.buckets() < grown, "shrank during scan");
+    all = true;
+    for (int i = 0; i < n; i++) all &= seen[i] >= 1;
+    check(all, "scan while shrinking");
+
+    HashTable empty;
+    check(empty.scan(0, 10, count) == 0, "empty table");
+}
+
+// Memory accounting, and eviction under a memory limit.
+// Only HashTable has them.
+void test_memory() {
+    std::cout << "Testing memory" << std::endl;
+    HashTable ht;
+    const size_t empty = ht.used_memory();
+    const char* str = "a value long enough to be on the heap";
+    check(empty == ht.buckets() * sizeof(Entry*), "empty table");
+
+    for (int i = 0; i < 1000; i++) {
+        ht.add(make_key(i), make_aobject<sstring>(str));
+    }
+    size_t total = ht.buckets() * sizeof(Entry*);
+    ht.scan(0, ~0UL, [&](Entry* e) { total += e->mem_usage(); });
+    check(ht.used_memory() == total, "accounted entries");
+    check(ht.find(make_key(1))->mem_usage() ==
+          pool_block_size(sizeof(Entry)) + pool_block_size(sizeof(sstring))
+          + sstring(str).heap_size(), "entry memory");
+
+    size_t before = ht.used_memory();
+    Entry* e = ht.find(make_key(1));
+    e->set_int(1);
+    ht.account(e);
+    check(ht.used_memory() < before, "account a smaller value");
+    for (int i = 0; i < 1000; i++) ht.remove(make_key(i));
+    check(ht.used_memory() == ht.buckets() * sizeof(Entry*), "all freed");
+
+    // Hot keys survive LFU eviction of keys never read again
+    ht.set_maxmemory(ht.used_memory() + 1000 * 100, EVICT_LFU);
+    for (int i = 0; i < 100; i++) {
+        ht.add(make_key(i), make_aobject<sstring>(str));
+        for (int j = 0; j < 100; j++) ht.find(make_key(i));
+    }
+    bool under = true;
+    for (int i = 100; i < 20000; i++) {
+        ht.add(make_key(i), make_aobject<sstring>(str));
+        under &= ht.used_memory() <= ht.buckets() * sizeof(Entry*) +
+                                     1000 * 100 + 200;
+    }
+    check(under, "LFU under the limit");
+    check(ht.evicted() > 10000, "LFU evicted");
+    int hot = 0;
+    for (int i = 0; i < 100; i++) hot += ht.find(make_key(i)) != nullptr;
+    check(hot >= 90, "hot keys kept");
+
+    // Lowering the limit evicts at once
+    for (evict_policy_t policy : {EVICT_LRU, EVICT_RANDOM}) {
+        size_t limit = ht.used_memory() / 2;
+        ht.set_maxmemory(limit, policy);
+        check(ht.used_memory() <= limit, "evicted to the new limit");
+        for (int i = 0; i < 5000; i++) {
+            ht.find_or_add(make_key(20000 + i))->set_int(i);
+        }
+        check(ht.used_memory() <= limit + 200, "under the limit");
+    }
+    ht.set_maxmemory(0);
+    unsigned long evicted = ht.evicted();
+    for (int i = 0; i < 1000; i++) ht.add_raw(make_key(30000 + i));
+    check(ht.evicted() == evicted, "no limit");
+}
+
+// Keys with a deadline disappear on access once it passed, or
+// from the active cycle if never accessed again
+void test_expire() {
+    std::cout << "Testing expire" << std::endl;
+    HashTable ht;
+
+    for (int i = 0; i < 1000; i++) ht.find_or_add(make_key(i))->set_int(i);
+    check(ht.expire(make_key(1000), 100) == HASH_ERR, "expire missing");
+    check(ht.ttl(make_key(1000)) == -2, "ttl missing");
+    check(ht.ttl(make_key(1)) == -1, "ttl no deadline");
+    check(ht.expire(make_key(1), 100000) == HASH_OK, "expire");
+    int64_t ttl = ht.ttl(make_key(1));
+    check(ttl > 99000 && ttl <= 100000, "ttl");
+    check(ht.persist(make_key(1)) == HASH_OK && ht.ttl(make_key(1)) == -1,
+          "persist");
+    check(ht.persist(make_key(1)) == HASH_ERR, "persist no deadline");
+    check(ht.expires() == 0, "persisted out of the index");
+
+    // A deadline in the past removes the key at once
+    ht.expire_at(make_key(2), HashTable::now_ms() - 1);
+    check(!ht.find(make_key(2)) && ht.size() == 999, "past deadline");
+
+    for (int i = 0; i < 500; i++) ht.expire(make_key(i), 20);
+    ht.expire(make_key(500), 100000);
+    check(ht.expires() == 500, "index size");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    check(!ht.find(make_key(3)), "lazy expiry");
+    check(ht.expire_stats().lazy == 1, "lazy counted");
+    check(ht.remove(make_key(4)) == HASH_ERR, "remove expired");
+    check(ht.expire_stats().lazy == 2, "remove counted");
+    check(ht.add(make_key(5), make_aobject<int>(5)) == HASH_OK &&
+          ht.ttl(make_key(5)) == -1, "add over expired");
+    unsigned long seen = 0;
+    ht.scan(0, ~0UL, [&](Entry*) { seen++; });
+    check(seen == 501, "scan skips expired");
+
+    while (ht.active_expire(1000000) > 0) {}
+    check(ht.size() == 501 && ht.expires() == 1, "active expiry");
+    check(ht.expire_stats().expired == 500, "expired counted");
+    check(ht.find(make_key(500)) != nullptr, "live deadline kept");
+
+    check(ht.remove(make_key(500)) == HASH_OK && ht.expires() == 0,
+          "remove out of the index");
+
+    // Overwriting drops the deadline, like SET, updating keeps it
+    ht.expire(make_key(600), 100000);
+    ht.replace(make_key(600), make_aobject<int>(1));
+    check(ht.ttl(make_key(600)) == -1 && ht.expires() == 0,
+          "replace drops the deadline");
+    ht.expire(make_key(600), 100000);
+    ht.find_or_add(make_key(600))->set_int(2);
+    ht.incr_by(make_key(600), 1);
+    check(ht.ttl(make_key(600)) > 0, "update keeps the deadline");
+
+    // Without a lazy free, the object is destroyed in place
+    Entry* e = ht.find(make_key(600));
+    e->set_object(make_aobject<sstring>("a string"));
+    ht.drop_value(e);
+    int64_t v = -1;
+    check(e->encoding() == ENC_INT && e->get_int(v) && v == 0,
+          "value dropped");
+    size_t total = ht.buckets() * sizeof(Entry*);
+    ht.scan(0, ~0UL, [&](Entry* e) { total += e->mem_usage(); });
+    check(ht.used_memory() > total, "index accounted");
+}
+
+int main() {
+    test_strings();
+
+    std::cout << "HashTable" << std::endl;
+    test_grow<HashTable>();
+    test_replace_remove<HashTable>();
+    test_numbers<HashTable>();
+    test_shrink<HashTable>();
+    test_shrink_full<HashTable>();
+    test_churn<HashTable>();
+    test_scan();
+    test_memory();
+    test_expire();
+
+    std::cout << "SwissHashTable" << std::endl;
+    test_grow<SwissHashTable>();
+    test_replace_remove<SwissHashTable>();
+    test_numbers<SwissHashTable>();
+    test_shrink<SwissHashTable>();
+    test_shrink_full<SwissHashTable>();
+    test_churn<SwissHashTable>();
+
+    return test_result();
+}
@@ -0,0 +1,133 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o incr_bench incr_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * INCR on a HashTable of counters, with the counters stored in place
+ * in the entries (incr_by), and boxed in an AObject holding an
+ * int64_t, reached through fetch_value and aobj_cast, as they would
+ * be without the encoding.
+ * The first pass creates num_keys counters, then num_ops increments
+ * go to random counters. Reports the time per operation, and the
+ * allocations and bytes (pool and global new) per counter.
+ *
+ * usage: incr_bench [num_keys (default 1M)] [num_ops (default 20M)]
+ */
+
+using namespace hypocampd;
+
+static size_t g_news = 0;
+
+void* operator new(size_t size)
+{
+    g_news++;
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static size_t pool_requested()
+{
+    size_t requested = 0;
+    for (const MemPoolStats& s : pool_stats()) requested += s.requested;
+    return requested;
+}
+
+struct Inline {
+    static void incr(HashTable& ht, const sstring& k) {
+        ht.incr_by(sstring(k), 1);
+    }
+    static int64_t get(HashTable& ht, const sstring& k) {
+        int64_t v = 0;
+        ht.find(k)->get_int(v);
+        return v;
+    }
+};
+
+struct Boxed {
+    static void incr(HashTable& ht, const sstring& k) {
+        sstring key(k);
+        AObject* o = ht.fetch_value(key);
+        if (o) {
+            ++*aobj_cast<int64_t>(*o);
+        } else {
+            ht.add(std::move(key), make_aobject<int64_t>(1));
+        }
+    }
+    static int64_t get(HashTable& ht, const sstring& k) {
+        return *aobj_cast<int64_t>(*ht.fetch_value(k));
+    }
+};
+
+template <typename Mode>
+static void run(const char* name, const std::vector<sstring>& keys,
+                unsigned long num_ops)
+{
+    typedef std::chrono::duration<double, std::nano> ns;
+    HashTable ht(keys.size());
+    std::mt19937_64 gen(3);
+
+    size_t news = g_news;
+    size_t requested = pool_requested();
+    auto start = std::chrono::steady_clock::now();
+    for (const sstring& k : keys) {
+        Mode::incr(ht, k);
+    }
+    double create_ns = ns(std::chrono::steady_clock::now() - start).count() /
+                       keys.size();
+    // Key copies made by the loop are freed by now
+    double allocs = double(g_news - news) / keys.size();
+    double bytes = double(pool_requested() - requested) / keys.size();
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < num_ops; i++) {
+        Mode::incr(ht, keys[gen() % keys.size()]);
+    }
+    double incr_ns = ns(std::chrono::steady_clock::now() - start).count() /
+                     num_ops;
+
+    int64_t total = 0;
+    for (const sstring& k : keys) total += Mode::get(ht, k);
+    if (total != int64_t(keys.size() + num_ops)) {
+        std::cout << "lost increments" << std::endl;
+        exit(1);
+    }
+
+    printf("%-7s create %4.0f ns, incr %4.0f ns, "
+           "%.1f global new and %.0f pool bytes per counter\n",
+           name, create_ns, incr_ns, allocs, bytes);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long num_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) :
+                             1000000;
+    unsigned long num_ops = argc > 2 ? strtoul(argv[2], nullptr, 10) :
+                            20000000;
+
+    std::vector<sstring> keys;
+    keys.reserve(num_keys);
+    char buf[32];
+    for (unsigned long i = 0; i < num_keys; i++) {
+        snprintf(buf, sizeof(buf), "cnt:%lu", i);
+        keys.emplace_back(buf);
+    }
+
+    std::cout << num_keys << " counters, " << num_ops << " increments"
+              << std::endl;
+    run<Inline>("inline", keys, num_ops);
+    run<Boxed>("boxed", keys, num_ops);
+    return 0;
+}
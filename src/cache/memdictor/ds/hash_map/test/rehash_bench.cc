@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o rehash_bench rehash_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * Grows a HashTable from empty to num_keys entries and reports the
+ * latency of each add. Incremental mode is the table as it is: every
+ * add migrates one bucket. Blocking mode finishes each rehash inside
+ * the add that started it, which is what a table that rehashes all at
+ * once would do. The worst add of incremental mode must stay far below
+ * the one of blocking mode.
+ *
+ * usage: rehash_bench [num_keys (default 20M)]
+ */
+
+using namespace hypocampd;
+
+// Adds num_keys keys and returns the latencies of the adds
+// in nanoseconds, sorted
+static std::vector<float> grow(unsigned long num_keys, bool blocking,
+                               unsigned long& rehashes)
+{
+    HashTable ht;
+    std::vector<float> lat;
+    lat.reserve(num_keys);
+    rehashes = 0;
+
+    char buf[32];
+    for (unsigned long i = 0; i < num_keys; i++) {
+        snprintf(buf, sizeof(buf), "key:%lu", i);
+        sstring key(buf);
+        unsigned long buckets = ht.buckets();
+
+        auto start = std::chrono::steady_clock::now();
+        ht.add_raw(std::move(key))->set_uint(i);
+        if (blocking) {
+            while (ht.rehash(1000));
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        // Starting a rehash adds the buckets of the new table
+        rehashes += ht.buckets() > buckets;
+        lat.push_back(std::chrono::duration<float, std::nano>(
+                          end - start).count());
+    }
+    if (ht.size() != num_keys) {
+        std::cout << "lost keys" << std::endl;
+        exit(1);
+    }
+    std::sort(lat.begin(), lat.end());
+    return lat;
+}
+
+static void report(const char* mode, const std::vector<float>& lat,
+                   unsigned long rehashes)
+{
+    auto pct = [&lat](double p) {
+        return static_cast<unsigned long>(
+            lat[std::min(lat.size() - 1, size_t(p * lat.size()))]);
+    };
+    std::cout << mode << ": " << rehashes << " rehashes, add latency ns"
+              << " p50 " << pct(0.5) << ", p99 " << pct(0.99)
+              << ", p99.99 " << pct(0.9999) << ", max " << pct(1)
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long num_keys = argc > 1 ? strtoul(argv[1], nullptr, 10) :
+                             20000000;
+    unsigned long rehashes;
+
+    std::vector<float> lat = grow(num_keys, false, rehashes);
+    report("incremental", lat, rehashes);
+    float incremental_max = lat.back();
+
+    lat = grow(num_keys, true, rehashes);
+    report("blocking", lat, rehashes);
+
+    bool passed = incremental_max * 10 < lat.back();
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
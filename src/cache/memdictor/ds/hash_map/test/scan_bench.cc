@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o scan_bench scan_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * Full scans of a HashTable of num_keys entries, 10 entries per
+ * call, with writes between the calls:
+ *   none    no writes
+ *   grow    20 adds of new keys per call, which rehash the table
+ *           to twice its size or more during the scan
+ *   shrink  the keys of the grow scan removed and the table resized
+ *           before the scan, then 20 updates of existing keys per
+ *           call, which rehash the table back down during the scan
+ * Reports the number of calls, the latency of a call (mean, p99
+ * and p99.9, writes excluded), and the entries reported more than
+ * once.
+ *
+ * usage: scan_bench [num_keys (default 1M)]
+ */
+
+using namespace hypocampd;
+
+static sstring make_key(unsigned long i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key:%lu", i);
+    return sstring(buf);
+}
+
+template <typename Writes>
+static void run(const char* name, HashTable& ht, unsigned long num_ids,
+                Writes writes)
+{
+    typedef std::chrono::duration<double, std::nano> ns;
+    typedef std::chrono::steady_clock clock;
+    std::vector<uint8_t> seen(num_ids);
+    std::vector<float> lat;
+    auto count = [&](Entry* e) {
+        int64_t id;
+        e->get_int(id);
+        if (seen[id] < 255) seen[id]++;
+    };
+
+    unsigned long cursor = 0;
+    do {
+        auto start = clock::now();
+        cursor = ht.scan(cursor, 10, count);
+        lat.push_back(ns(clock::now() - start).count());
+        writes();
+    } while (cursor != 0);
+
+    unsigned long twice = 0;
+    for (uint8_t s : seen) twice += s > 1;
+    double sum = 0;
+    for (float l : lat) sum += l;
+    std::sort(lat.begin(), lat.end());
+
+    printf("%-7s %7zu calls, mean %5.0f ns, p99 %6.0f ns, "
+           "p99.9 %6.0f ns, %lu reported twice\n", name, lat.size(),
+           sum / lat.size(), lat[lat.size() * 99 / 100],
+           lat[lat.size() * 999 / 1000], twice);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    HashTable ht;
+
+    for (unsigned long i = 0; i < n; i++) {
+        ht.add_raw(make_key(i))->set_int(i);
+    }
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    printf("%lu keys, %lu buckets\n", n, ht.buckets());
+
+    run("none", ht, n * 4, [] {});
+
+    unsigned long next = n;
+    run("grow", ht, n * 4, [&] {
+        for (int i = 0; i < 20 && next < n * 4; i++, next++) {
+            ht.add_raw(make_key(next))->set_int(next);
+        }
+    });
+
+    while (ht.is_rehashing()) ht.rehash_ms(1);
+    printf("%lu keys, %lu buckets\n", ht.size(), ht.buckets());
+    for (unsigned long i = n; i < next; i++) ht.remove(make_key(i));
+    ht.resize();
+
+    std::mt19937_64 gen(7);
+    run("shrink", ht, n * 4, [&] {
+        for (int i = 0; i < 20; i++) {
+            unsigned long id = gen() % n;
+            ht.find_or_add(make_key(id))->set_int(id);
+        }
+    });
+    printf("%lu keys, %lu buckets, %s\n", ht.size(), ht.buckets(),
+           ht.is_rehashing() ? "rehashing" : "rehashed");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o set_bench set_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * SET and GET of string values on a HashTable, half of which are
+ * small integers (0 to 9999) and half 8 to 40 byte strings.
+ * "strings" stores every value as an sstring object, "encoded" uses
+ * Entry::set_string, which stores integers in place, and reads them
+ * back through the shared integer strings.
+ * Reports the time per SET and GET, and the pool bytes per key.
+ * Each mode runs in its own process, as a second table would reuse
+ * the pool blocks freed by the first in scattered order.
+ *
+ * usage: set_bench strings|encoded [num_keys (default 2M)]
+ */
+
+using namespace hypocampd;
+
+static size_t pool_requested()
+{
+    size_t requested = 0;
+    for (const MemPoolStats& s : pool_stats()) requested += s.requested;
+    return requested;
+}
+
+static void run(const char* name, bool encoded,
+                const std::vector<sstring>& keys,
+                const std::vector<sstring>& vals)
+{
+    typedef std::chrono::duration<double, std::nano> ns;
+    typedef std::chrono::steady_clock clock;
+    size_t n = keys.size();
+    HashTable ht(n);
+
+    size_t requested = pool_requested();
+    auto start = clock::now();
+    for (size_t i = 0; i < n; i++) {
+        Entry* e = ht.find_or_add(sstring(keys[i]));
+        if (encoded) e->set_string(sstring(vals[i]));
+        else         e->set_object(make_aobject<sstring>(vals[i]));
+    }
+    double set_ns = ns(clock::now() - start).count() / n;
+    double bytes = double(pool_requested() - requested) / n;
+
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    sstring buf;
+    size_t total = 0;
+    start = clock::now();
+    for (uint32_t i : order) {
+        total += ht.find(keys[i])->get_string(buf)->length();
+    }
+    double get_ns = ns(clock::now() - start).count() / n;
+
+    size_t expected = 0;
+    for (const sstring& v : vals) expected += v.length();
+    if (total != expected) {
+        printf("wrong values\n");
+        exit(1);
+    }
+
+    printf("%-8s SET %4.0f ns, GET %4.0f ns, %5.1f pool bytes per key\n",
+           name, set_ns, get_ns, bytes);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: set_bench strings|encoded [num_keys]\n");
+        return 1;
+    }
+    bool encoded = strcmp(argv[1], "encoded") == 0;
+    size_t n = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2000000;
+    std::mt19937_64 gen(5);
+    std::vector<sstring> keys, vals;
+    keys.reserve(n);
+    vals.reserve(n);
+
+    char buf[64];
+    for (size_t i = 0; i < n; i++) {
+        snprintf(buf, sizeof(buf), "obj:%zu", i);
+        keys.emplace_back(buf);
+        if (gen() & 1) {
+            snprintf(buf, sizeof(buf), "%d", int(gen() % 10000));
+        } else {
+            size_t len = 8 + gen() % 33;
+            for (size_t j = 0; j < len; j++) buf[j] = 'a' + gen() % 26;
+            buf[len] = '\0';
+        }
+        vals.emplace_back(buf);
+    }
+
+    printf("%zu keys, half of the values small integers\n", n);
+    run(argv[1], encoded, keys, vals);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+#include "cache/memdictor/ds/hash_map/swiss_table.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o swiss_bench swiss_bench.cc ../hash_map.cc ../../../shared_integers.cc ../../../lazy_free.cc ../swiss_table.cc ../../../../../common/murmurhash3.cc ../../../../../common/mem_pool.cc
+
+/*
+ * Compares HashTable and SwissHashTable on hits, misses and inserts,
+ * with both tables presized to the same number of slots (buckets for
+ * HashTable), at load factors from 0.5 to 0.875, so that neither
+ * rehashes during the measure.
+ *
+ * Keys follow a mix of sizes typical of a cache keyspace: half of them
+ * fit in the sstring inline buffer (up to 15 bytes, "u:<id>"), a third
+ * are 20 to 40 bytes ("session:<id>:<hex>") and the rest 60 to 100
+ * bytes (composite keys with a path). Long keys only cost both tables
+ * the same string compare, on the entry found.
+ *
+ * Insert is the time of the last SWISS_BENCH_INSERTS adds, which land
+ * at about the measured load factor. Hit and miss look up every key,
+ * in random order.
+ *
+ * usage: swiss_bench [log2 of slots (default 21)]
+ */
+
+using namespace hypocampd;
+
+#define SWISS_BENCH_INSERTS 65536UL
+
+static std::string make_key(std::mt19937_64& gen, unsigned long id)
+{
+    std::string key;
+    unsigned long kind = gen() % 6;
+
+    if (kind < 3) {
+        key = "u:" + std::to_string(id);
+    } else if (kind < 5) {
+        key = "session:" + std::to_string(id) + ":";
+        unsigned long len = 20 + gen() % 21;
+        while (key.size() < len) key += "0123456789abcdef"[gen() % 16];
+    } else {
+        key = "tenant:" + std::to_string(gen() % 1000) + "/obj/" +
+              std::to_string(id) + "/";
+        unsigned long len = 60 + gen() % 41;
+        while (key.size() < len) key += 'a' + gen() % 26;
+    }
+    return key;
+}
+
+struct Result {
+    double insert_ns, hit_ns, miss_ns;
+};
+
+template <typename Table>
+static Result run(unsigned long slots, const std::vector<sstring>& keys,
+                  unsigned long n, const std::vector<sstring>& misses)
+{
+    typedef std::chrono::duration<double, std::nano> ns;
+    Table ht(slots);
+    Result r;
+
+    unsigned long first_timed = n - std::min(n, SWISS_BENCH_INSERTS);
+    for (unsigned long i = 0; i < first_timed; i++) {
+        ht.add_raw(sstring(keys[i]))->set_uint(i);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = first_timed; i < n; i++) {
+        ht.add_raw(sstring(keys[i]))->set_uint(i);
+    }
+    r.insert_ns = ns(std::chrono::steady_clock::now() - start).count() /
+                  (n - first_timed);
+
+    if (ht.size() != n || ht.is_rehashing() || ht.buckets() != slots) {
+        std::cout << "table did not stay at its size" << std::endl;
+        exit(1);
+    }
+
+    // Shuffled order of the keys, so that lookups do not walk
+    // the entries in allocation order
+    std::vector<unsigned long> order(n);
+    for (unsigned long i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(1));
+
+    uint64_t sum = 0, v = 0;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i : order) {
+        ht.find(keys[i])->get_uint(v);
+        sum += v;
+    }
+    r.hit_ns = ns(std::chrono::steady_clock::now() - start).count() / n;
+
+    unsigned long found = 0;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < n; i++) {
+        found += ht.find(misses[order[i]]) != nullptr;
+    }
+    r.miss_ns = ns(std::chrono::steady_clock::now() - start).count() / n;
+
+    if (sum != uint64_t(n) * (n - 1) / 2 || found != 0) {
+        std::cout << "wrong lookups" << std::endl;
+        exit(1);
+    }
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long slots = 1UL << (argc > 1 ? atoi(argv[1]) : 21);
+    unsigned long max_keys = slots - slots / 8;
+
+    std::mt19937_64 gen(42);
+    std::vector<sstring> keys, misses;
+    keys.reserve(max_keys);
+    misses.reserve(max_keys);
+    for (unsigned long i = 0; i < max_keys; i++) {
+        keys.emplace_back(make_key(gen, i).c_str());
+    }
+    for (unsigned long i = 0; i < max_keys; i++) {
+        misses.emplace_back(make_key(gen, max_keys + i).c_str());
+    }
+
+    std::cout << slots << " slots, ns per op" << std::endl;
+    std::cout << "load   | chained insert/hit/miss | swiss insert/hit/miss"
+              << std::endl;
+
+    bool passed = true;
+    for (double load : {0.5, 0.625, 0.75, 0.875}) {
+        // SwissHashTable grows when it reaches 7/8, stay just below
+        unsigned long n = std::min(max_keys - 1,
+                                   static_cast<unsigned long>(load * slots));
+        Result c = run<HashTable>(slots, keys, n, misses);
+        Result s = run<SwissHashTable>(slots, keys, n, misses);
+
+        printf("%.3f  | %6.0f %6.0f %6.0f      | %6.0f %6.0f %6.0f\n",
+               load, c.insert_ns, c.hit_ns, c.miss_ns,
+               s.insert_ns, s.hit_ns, s.miss_ns);
+        passed &= s.miss_ns < c.miss_ns;
+    }
+
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
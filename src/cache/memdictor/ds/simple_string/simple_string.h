@@ -2,16 +2,22 @@
 #define HYPOCAMPD_SIMPLE_STRING_H
 
 #include <cstring>
+#include <cstdint>
 #include <cassert>
+#include <iostream>
 #include <memory>
 #include <utility>
 #include <algorithm>
 
+#include "common/mem_pool.h"
+#include "cache/memdictor/abstract_object.h"
+
 namespace hypocampd {
 
 static const short string_hdr_len = sizeof(uint32_t) +  // len_
                                     sizeof(uint32_t) +  // free_
-                                    sizeof(char*);      // buf_
+                                    sizeof(char*)    +  // buf_
+                                    sizeof(uint64_t);   // size_
 
 static const double GROWTH_FACTOR = 1.5;
 
@@ -77,13 +83,11 @@ public:
 
     // Copy c'tor
     sstring(const sstring& other) {
-        init_new_srep_struct(other.mp_srep->len_);
+        init_new_srep_struct(other.length());
         if (m_sso) 
-            sstring_copy(other.mp_srep->buf_, sso_buf_, 
-                         other.mp_srep->len_);
+            sstring_copy(other.c_str(), sso_buf_, other.length());
         else
-            sstring_copy(other.mp_srep->buf_, mp_srep->buf_, 
-                         other.mp_srep->len_);
+            sstring_copy(other.c_str(), mp_srep->buf_, other.length());
     }
 
     // Move c'tor
@@ -114,9 +118,13 @@ public:
 
     // Move assignment operator
     const sstring& operator=(sstring&& other) {
+        if (this == &other) return *this;
         if (other.m_sso) {
-            this->clear();
+            // Frees the heap buffer held till now, if any, and
+            // zeroes the old short string, for the terminator
+            mp_srep.reset();
             m_sso = true;
+            clear();
             sstring_copy(other.sso_buf_, sso_buf_, other.length());
             return *this;
         }
@@ -150,6 +158,12 @@ public:
         return length() + free_space();
     }
 
+    // Returns the bytes allocated for the buffer, 0 for
+    // short strings
+    size_t heap_size() const noexcept {
+        return mp_srep ? pool_block_size(mp_srep->size_) : 0;
+    }
+
     // Clear the buffer area
     void clear() noexcept {
         if (m_sso) {
@@ -246,12 +260,22 @@ protected:
 
 private: // Private Member Functions
 
+    // The string_rep and buffer of heap strings come zeroed from
+    // the memory pool. The size of the allocation is kept in the
+    // header, to give it back.
+    static char* alloc_rep(size_t size) {
+        char* buf = static_cast<char*>(pool_alloc(size));
+        memset(buf, 0, size);
+        reinterpret_cast<string_rep*>(buf)->size_ = size;
+        return buf;
+    }
+
     void init_new_srep_struct(uint32_t length, bool do_sso = true) {
         if (do_sso && length <= SSO_SIZE) {
             m_sso = true; 
             return;
         }
-        char* buf = new char[sizeof(string_rep) + length + 1]();
+        char* buf = alloc_rep(sizeof(string_rep) + length + 1);
         mp_srep.reset(reinterpret_cast<string_rep*>(buf));    
         mp_srep->buf_ = buf + string_hdr_len;
         mp_srep->len_ = 0;
@@ -264,7 +288,7 @@ private: // Private Member Functions
         // this function will always be called when there is 
         // real need of expansion. Therefore, it is not required
         // to assert if the expansion is really required or not
-        char* buf = new char[sizeof(string_rep) + new_size + 1]();
+        char* buf = alloc_rep(sizeof(string_rep) + new_size + 1);
         string_rep* str = reinterpret_cast<string_rep*>(buf);
 
         str->buf_  = buf + string_hdr_len;
@@ -286,6 +310,8 @@ private: // Private Data Members
         uint32_t len_  = 0;
         uint32_t free_ = 0;
         char* buf_ = nullptr;  
+        // Size of the allocation
+        uint64_t size_ = 0;
     };
 
     // For short string optimization
@@ -294,8 +320,7 @@ private: // Private Data Members
 
     struct StringDeleter {
         void operator()(string_rep* resource) const {
-            char* buf = reinterpret_cast<char*>(resource);
-            delete[] buf;
+            pool_free(resource, resource->size_);
         }
     };
 
@@ -303,6 +328,18 @@ private: // Private Data Members
 };
 
 
+// Memory of a string held by an AObject, see abstract_object.h
+inline size_t aobj_heap_size(const sstring& s) noexcept
+{
+    return s.heap_size();
+}
+
+// A string is one buffer, but a large one takes time to unmap
+inline size_t aobj_free_effort(const sstring& s) noexcept
+{
+    return 1 + s.heap_size() / AOBJ_FREE_EFFORT_BYTES;
+}
+
 // ===================================================================
 // Member function implementation
 
@@ -310,7 +347,8 @@ inline const sstring&
 sstring::operator=(const sstring& other) 
 {
     if (other.m_sso) {
-        mp_srep.release();
+        // Frees the heap buffer held till now, if any
+        mp_srep.reset();
         m_sso = true;
         clear();
         sstring_copy(other.sso_buf_, sso_buf_, other.length());
@@ -319,14 +357,16 @@ sstring::operator=(const sstring& other)
     // Cannot use init_new_srep_struct here. If used this
     // function would not be exception neutral 
 
-    char* buf = new char[sizeof(string_rep) + other.mp_srep->len_ + 1](); 
+    char* buf = alloc_rep(sizeof(string_rep) + other.mp_srep->len_ + 1); 
     sstring_copy(other.mp_srep->buf_, buf + sizeof(string_rep), 
                  other.mp_srep->len_, false); 
 
     mp_srep.reset(reinterpret_cast<string_rep*>(buf));
+    m_sso = false;
 
+    // The copy only has room for the string
     mp_srep->len_  = other.mp_srep->len_;
-    mp_srep->free_ = other.mp_srep->free_;
+    mp_srep->free_ = 0;
     mp_srep->buf_  = buf + string_hdr_len;
 
     return *this;
@@ -404,7 +444,7 @@ sstring::substr(int s_pos, int e_pos)
 
 // ===================================================================
 
-const sstring& 
+inline const sstring& 
 sstring::trim_mem_eff(const char* tset) 
 {
     char* c = nullptr; char* e = nullptr;
@@ -424,9 +464,8 @@ sstring::trim_mem_eff(const char* tset)
         e--;
     }
 
-    char* buf = new char[sizeof(string_rep) + (e - c + 1) + 1];
+    char* buf = alloc_rep(sizeof(string_rep) + (e - c + 1) + 1);
     sstring_copy(c, buf + string_hdr_len, (e - c + 1));
-    mp_srep.release();
     mp_srep.reset(reinterpret_cast<string_rep*>(buf));
     mp_srep->buf_ = buf + string_hdr_len;
 
@@ -484,7 +523,6 @@ sstring::append(const char* str)
             m_sso = false;
         } else {
             char* buf = __expand__(new_size);
-            mp_srep.release();
             mp_srep.reset(reinterpret_cast<string_rep*>(buf));
         }
     }
@@ -511,7 +549,7 @@ sstring::shrink_to_fit()
     if (strlen(data) == capacity()) return;
 
     uint32_t clen = length();
-    char* new_buf = new char[sizeof(string_rep) + length() + 1]();
+    char* new_buf = alloc_rep(sizeof(string_rep) + length() + 1);
     sstring_copy(data, new_buf + string_hdr_len, length(), false);
     mp_srep.reset(reinterpret_cast<string_rep*>(new_buf));
 
@@ -1,6 +1,7 @@
 #ifndef SKIP_LIST_INCLUDED
 #define SKIP_LIST_INCLUDED
 
+#include <array>
 #include <memory>
 #include <type_traits>
 #include <cassert>
@@ -8,6 +9,8 @@
 #include <ctime>
 #include <iostream>
 
+#include "cache/memdictor/abstract_object.h"
+
 namespace hypocampd {
 
 // Maximum possible height for the skip list
@@ -168,6 +171,24 @@ public:
         for (int i = 0; i < m_max_height; ++i) {
             mp_head->mp_fwd_nodes[i] = mp_tail.get();
         }
+        m_links = 2 * m_max_height;
+    }
+
+    // Deletes all the nodes, one by one
+    ~SkipListImpl();
+
+    SkipListImpl(const self_type& other) = delete;
+    void operator=(const self_type& other) = delete;
+
+    // Returns the number of elements
+    size_t size() const noexcept {
+        return m_size;
+    }
+
+    // Returns the number of forward links of all the nodes, head
+    // and tail included, for the memory they take
+    size_t links() const noexcept {
+        return m_links;
     }
 
     // Get the head of the list
@@ -222,9 +243,24 @@ private:
     std::unique_ptr<node_type> mp_tail;
     uint8_t m_curr_height = 0;
     std::unique_ptr<HeightHelper> mp_hthelper = nullptr;
+    size_t m_size  = 0;
+    size_t m_links = 0;
 };
 
 
+template <typename Key_T, typename Value_T>
+SkipListImpl<Key_T, Value_T>::~SkipListImpl()
+{
+    node_type* tmp = mp_head->mp_fwd_nodes[0];
+
+    while (tmp != mp_tail.get()) {
+        node_type* next = tmp->mp_fwd_nodes[0];
+        delete tmp;
+        tmp = next;
+    }
+}
+
+
 template <typename Key_T, typename Value_T>
 void SkipListImpl<Key_T, Value_T>::find_nearest(const Key_T* key, const Key_T*& cmp_key,
                         node_type*& tmp,
@@ -284,6 +320,8 @@ bool SkipListImpl<Key_T, Value_T>::insert(const Key_T* key, const Value_T* val)
             tmp->mp_fwd_nodes[j] = tracker[j]->mp_fwd_nodes[j];
             tracker[j]->mp_fwd_nodes[j] = tmp;
         }
+        m_size++;
+        m_links += lvl + 1;
     }
 
     return true;
@@ -305,6 +343,8 @@ bool SkipListImpl<Key_T, Value_T>::remove(const Key_T* key)
             if (tracker[i]->mp_fwd_nodes[i] != tmp) break;
             tracker[i]->mp_fwd_nodes[i] = tmp->mp_fwd_nodes[i];
         }
+        m_size--;
+        m_links -= tmp->get_height();
         delete tmp;
 
         while ( (m_curr_height > 0) &&
@@ -455,6 +495,33 @@ public:
 
 };
 
+
+template <typename Key_T, typename Value_T>
+struct aobj_type_of<SkipList<Key_T, Value_T>> {
+    static const aobj_type_t value = AOBJ_SORTED_SET;
+};
+
+// Memory of a skip list held by an AObject, see abstract_object.h.
+// Counts the nodes, their links, keys and values, not what the keys
+// and values allocate themselves.
+template <typename Key_T, typename Value_T>
+size_t aobj_heap_size(const SkipList<Key_T, Value_T>& l) noexcept
+{
+    using node_type = SkipListNode<Key_T, Value_T>;
+
+    return (l.size() + 2) * sizeof(node_type) +
+           l.links() * sizeof(node_type*) +
+           l.size() * (sizeof(Key_T) + sizeof(Value_T)) +
+           sizeof(HeightHelper);
+}
+
+// One per node, freed with its links, key and value
+template <typename Key_T, typename Value_T>
+size_t aobj_free_effort(const SkipList<Key_T, Value_T>& l) noexcept
+{
+    return 1 + l.size();
+}
+
 }; // end namespace hypocampd
 
 #endif // SKIP_LIST_INCLUDED
@@ -0,0 +1,121 @@
+#include "cache/memdictor/lazy_free.h"
+
+namespace hypocampd {
+
+LazyFree::LazyFree(size_t threshold)
+    : m_threshold(threshold), m_head(&m_stub), mp_tail(&m_stub)
+{
+    m_thread = std::thread(&LazyFree::run, this);
+}
+
+// ===================================================================
+
+LazyFree::~LazyFree()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+}
+
+// ===================================================================
+
+void
+LazyFree::free(AObject&& o)
+{
+    if (o.free_effort() <= m_threshold) {
+        o.destroy();
+        return;
+    }
+
+    Node* n = new Node;
+    n->obj = std::move(o);
+
+    // Counted before it is queued, so that the thread never counts
+    // down a node not counted yet. It only sleeps with nothing
+    // pending, and is notified under the lock, so that it can not
+    // check before the increment and sleep after the notification.
+    bool wake = m_pending.fetch_add(1, std::memory_order_release) == 0;
+    push(n);
+    if (wake) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cv.notify_one();
+    }
+}
+
+// ===================================================================
+
+void
+LazyFree::push(Node* n) noexcept
+{
+    n->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+    // Until this store, the consumer sees the queue end at prev
+    prev->next.store(n, std::memory_order_release);
+}
+
+// ===================================================================
+
+LazyFree::Node*
+LazyFree::pop() noexcept
+{
+    Node* tail = mp_tail;
+    Node* next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &m_stub) {
+        if (!next) return nullptr;
+        mp_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        mp_tail = next;
+        return tail;
+    }
+
+    // tail is the last node: put the stub back behind it, to
+    // take tail without leaving the queue empty
+    if (tail != m_head.load(std::memory_order_acquire)) return nullptr;
+    push(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        mp_tail = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+// ===================================================================
+
+void
+LazyFree::run()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] {
+                return m_stop ||
+                       m_pending.load(std::memory_order_acquire) > 0;
+            });
+            if (m_stop && m_pending.load() == 0) return;
+        }
+
+        while (m_pending.load(std::memory_order_acquire) > 0) {
+            Node* n = pop();
+            if (!n) {
+                // A producer counted its node and did not queue it
+                // yet, or is between its exchange and its store
+                std::this_thread::yield();
+                continue;
+            }
+            delete n;
+            m_freed.fetch_add(1, std::memory_order_relaxed);
+            m_pending.fetch_sub(1, std::memory_order_release);
+        }
+    }
+}
+
+}; // End namespace hypocampd
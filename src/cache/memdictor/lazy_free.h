@@ -0,0 +1,101 @@
+#ifndef HYPOCAMPD_LAZY_FREE_H
+#define HYPOCAMPD_LAZY_FREE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include "cache/memdictor/abstract_object.h"
+
+// Objects with a free effort above this are freed in the background,
+// see aobj_free_effort
+#ifndef LAZY_FREE_THRESHOLD
+#define LAZY_FREE_THRESHOLD 64
+#endif
+
+namespace hypocampd {
+
+/*
+ * LazyFree: A background thread destroying the objects too large to
+ * be destroyed while serving a request, such as a sorted set of
+ * millions of elements, which takes as many deletes.
+ *
+ * The keyspace unlinks the object at once, and hands it over with
+ * free(): a small one is destroyed in place, a large one is queued
+ * to the thread. The queue is a lock free intrusive MPSC queue
+ * (Vyukov's), so that the workers of several shards hand objects
+ * over without waiting for each other or for the thread. The thread
+ * sleeps when the queue is empty, and the free() which makes it non
+ * empty wakes it up.
+ *
+ * What the objects point to must not be shared with the keyspace,
+ * as it is freed concurrently.
+ * Thread safe.
+ */
+class LazyFree {
+public:
+    explicit LazyFree(size_t threshold = LAZY_FREE_THRESHOLD);
+
+    // Frees the objects still queued, and stops the thread
+    ~LazyFree();
+
+    LazyFree(const LazyFree& other) = delete;
+    void operator=(const LazyFree& other) = delete;
+
+    // Destroy o, in the background if its free effort is above
+    // the threshold
+    void free(AObject&& o);
+
+    // Returns the number of objects queued and not freed yet
+    size_t pending() const noexcept {
+        return m_pending.load(std::memory_order_relaxed);
+    }
+
+    // Returns the number of objects freed in the background
+    unsigned long freed() const noexcept {
+        return m_freed.load(std::memory_order_relaxed);
+    }
+
+    size_t threshold() const noexcept {
+        return m_threshold;
+    }
+
+private:
+    struct Node: public PoolAllocated {
+        std::atomic<Node*> next{nullptr};
+        AObject obj;
+    };
+
+    // Producers: append n
+    void push(Node* n) noexcept;
+
+    // Consumer: returns the oldest node, or nullptr if there is
+    // none, or if a push is half done
+    Node* pop() noexcept;
+
+    void run();
+
+private:
+    size_t m_threshold;
+
+    // Producers exchange the head, the consumer pops at the tail.
+    // The stub stays in the queue, so that it is never empty.
+    std::atomic<Node*> m_head;
+    Node* mp_tail;
+    Node m_stub;
+
+    std::atomic<size_t> m_pending{0};
+    std::atomic<unsigned long> m_freed{0};
+
+    // Only for the thread to sleep on
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+}; // End namespace hypocampd
+
+#endif
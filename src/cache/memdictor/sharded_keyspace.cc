@@ -0,0 +1,329 @@
+#include <algorithm>
+
+#include "cache/memdictor/sharded_keyspace.h"
+#include "common/murmurhash3.h"
+
+namespace hypocampd {
+
+static const uint32_t SHARD_SEED = 5381;
+
+// ===================================================================
+
+void
+ShardedKeyspace::Latch::count_down()
+{
+    // Notified under the lock: the waiter may destroy the latch
+    // as soon as it sees the count at 0
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_count == 0) m_cv.notify_all();
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::Latch::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_count == 0; });
+}
+
+// ===================================================================
+
+ShardedKeyspace::ShardedKeyspace(unsigned num_shards, ks_mode_t mode)
+    : m_mode(mode)
+{
+    if (num_shards == 0) {
+        num_shards = std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    for (unsigned i = 0; i < num_shards; i++) {
+        m_shards.emplace_back(new Shard);
+        m_shards.back()->table.set_lazy_free(&m_lazy_free);
+        if (m_mode == KS_SHARE_NOTHING) {
+            Shard* shard = m_shards.back().get();
+            shard->worker = std::thread(worker_loop, shard);
+        }
+    }
+}
+
+// ===================================================================
+
+ShardedKeyspace::~ShardedKeyspace()
+{
+    if (m_mode != KS_SHARE_NOTHING) return;
+
+    for (auto& shard : m_shards) {
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->stop = true;
+        }
+        shard->cv.notify_one();
+    }
+    for (auto& shard : m_shards) shard->worker.join();
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::worker_loop(Shard* shard)
+{
+    std::vector<Task> tasks;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(shard->mutex);
+            shard->cv.wait(lock, [shard] {
+                return shard->stop || !shard->queue.empty();
+            });
+            if (shard->queue.empty()) return;
+            // Take the whole queue, so that callers queue the next
+            // operations while these run
+            tasks.swap(shard->queue);
+        }
+
+        for (Task& t : tasks) {
+            (*t.fn)(shard->table);
+            t.done->count_down();
+        }
+        tasks.clear();
+    }
+}
+
+// ===================================================================
+
+unsigned
+ShardedKeyspace::shard_of(const sstring& key) const noexcept
+{
+    uint32_t hash = murmurhash(key.c_str(), key.length(), SHARD_SEED);
+
+    // The high bits of hash * num_shards / 2^32
+    return (uint64_t(hash) * m_shards.size()) >> 32;
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::dispatch(Shard& shard, const ShardFn& fn, Latch& done)
+{
+    if (m_mode == KS_LOCKED) {
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            fn(shard.table);
+        }
+        done.count_down();
+        return;
+    }
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // The worker only waits with an empty queue
+        wake = shard.queue.empty();
+        shard.queue.push_back(Task{&fn, &done});
+    }
+    if (wake) shard.cv.notify_one();
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::dispatch_all(const std::vector<unsigned>& shards,
+                              const std::function<void(unsigned,
+                                                       HashTable&)>& fn)
+{
+    Latch done(shards.size());
+    // The tasks point to these until done
+    std::vector<ShardFn> fns;
+
+    fns.reserve(shards.size());
+    for (unsigned i : shards) {
+        fns.emplace_back([&fn, i](HashTable& t) { fn(i, t); });
+        dispatch(*m_shards[i], fns.back(), done);
+    }
+
+    done.wait();
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::group_by_shard(const std::vector<sstring>& keys,
+                                std::vector<std::vector<uint32_t>>& by_shard,
+                                std::vector<unsigned>& shards) const
+{
+    by_shard.assign(m_shards.size(), std::vector<uint32_t>());
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        unsigned s = shard_of(keys[i]);
+        if (by_shard[s].empty()) shards.push_back(s);
+        by_shard[s].push_back(i);
+    }
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::execute(const sstring& key, const ShardFn& fn)
+{
+    Latch done(1);
+
+    dispatch(*m_shards[shard_of(key)], fn, done);
+    done.wait();
+}
+
+// ===================================================================
+
+// Copies the string value of e to val
+static bool copy_string(const Entry* e, sstring& val)
+{
+    if (!e) return false;
+
+    const sstring* s = e->get_string(val);
+    if (!s) return false;
+    if (s != &val) val = *s;
+
+    return true;
+}
+
+// ===================================================================
+
+bool
+ShardedKeyspace::get(const sstring& key, sstring& val)
+{
+    bool found = false;
+
+    execute(key, [&](HashTable& t) {
+        found = copy_string(t.find(key), val);
+    });
+
+    return found;
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::set(sstring&& key, sstring&& val)
+{
+    // The shard is chosen before fn takes the key
+    execute(key, [&](HashTable& t) {
+        Entry* e = t.find_or_add(std::move(key));
+        t.drop_value(e);
+        t.drop_deadline(e);
+        e->set_string(std::move(val));
+        t.account(e);
+    });
+}
+
+// ===================================================================
+
+result_t
+ShardedKeyspace::remove(const sstring& key)
+{
+    result_t res = HASH_ERR;
+
+    execute(key, [&](HashTable& t) { res = t.remove(key); });
+
+    return res;
+}
+
+// ===================================================================
+
+unsigned long
+ShardedKeyspace::mget(const std::vector<sstring>& keys,
+                      std::vector<sstring>& vals,
+                      std::vector<uint8_t>& found)
+{
+    std::vector<std::vector<uint32_t>> by_shard;
+    std::vector<unsigned> shards;
+
+    group_by_shard(keys, by_shard, shards);
+
+    vals.resize(keys.size());
+    found.assign(keys.size(), 0);
+    // Shards write the values of distinct keys
+    dispatch_all(shards, [&](unsigned s, HashTable& t) {
+        for (uint32_t i : by_shard[s]) {
+            found[i] = copy_string(t.find(keys[i]), vals[i]);
+        }
+    });
+
+    return std::count(found.begin(), found.end(), 1);
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::mset(std::vector<sstring>&& keys,
+                      std::vector<sstring>&& vals)
+{
+    std::vector<std::vector<uint32_t>> by_shard;
+    std::vector<unsigned> shards;
+
+    group_by_shard(keys, by_shard, shards);
+
+    dispatch_all(shards, [&](unsigned s, HashTable& t) {
+        for (uint32_t i : by_shard[s]) {
+            Entry* e = t.find_or_add(std::move(keys[i]));
+            t.drop_value(e);
+            t.drop_deadline(e);
+            e->set_string(std::move(vals[i]));
+            t.account(e);
+        }
+    });
+}
+
+// ===================================================================
+
+unsigned long
+ShardedKeyspace::size()
+{
+    std::vector<unsigned long> sizes(m_shards.size());
+    std::vector<unsigned> shards;
+
+    for (unsigned i = 0; i < m_shards.size(); i++) shards.push_back(i);
+    dispatch_all(shards, [&](unsigned s, HashTable& t) {
+        sizes[s] = t.size();
+    });
+
+    unsigned long total = 0;
+    for (unsigned long n : sizes) total += n;
+
+    return total;
+}
+
+// ===================================================================
+
+void
+ShardedKeyspace::set_maxmemory(size_t maxmemory, evict_policy_t policy)
+{
+    std::vector<unsigned> shards;
+    size_t per_shard = maxmemory / m_shards.size();
+
+    // A limit below the shard count is still a limit, not 0
+    if (maxmemory != 0 && per_shard == 0) per_shard = 1;
+
+    for (unsigned i = 0; i < m_shards.size(); i++) shards.push_back(i);
+    dispatch_all(shards, [&](unsigned, HashTable& t) {
+        t.set_maxmemory(per_shard, policy);
+    });
+}
+
+// ===================================================================
+
+size_t
+ShardedKeyspace::used_memory()
+{
+    std::vector<size_t> used(m_shards.size());
+    std::vector<unsigned> shards;
+
+    for (unsigned i = 0; i < m_shards.size(); i++) shards.push_back(i);
+    dispatch_all(shards, [&](unsigned s, HashTable& t) {
+        used[s] = t.used_memory();
+    });
+
+    size_t total = 0;
+    for (size_t n : used) total += n;
+
+    return total;
+}
+
+}; // End namespace hypocampd
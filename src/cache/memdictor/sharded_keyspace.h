@@ -0,0 +1,170 @@
+#ifndef HYPOCAMPD_SHARDED_KEYSPACE_H
+#define HYPOCAMPD_SHARDED_KEYSPACE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+#include "cache/memdictor/ds/simple_string/simple_string.h"
+#include "cache/memdictor/lazy_free.h"
+
+namespace hypocampd {
+
+// How the shards of a ShardedKeyspace are accessed
+enum ks_mode_t {
+    KS_SHARE_NOTHING = 0, // Each shard is owned by a worker thread
+    KS_LOCKED,            // Callers lock the shard themselves
+};
+
+/*
+ * ShardedKeyspace: A keyspace split into independent HashTable
+ * shards, for servers running on several cores.
+ *
+ * The shard of a key is chosen by the high bits of its murmurhash,
+ * so that the keys of a shard still spread over all the buckets of
+ * its table, which use the low bits.
+ *
+ * In share nothing mode, every shard has a worker thread, the only
+ * one ever touching its table. Operations are queued to the worker
+ * and the caller waits for them. The keys of a multi-key command
+ * are grouped by shard, and the groups are queued to all their
+ * workers at once, which run them in parallel.
+ * In locked mode, there are no workers: the caller runs operations
+ * itself holding the lock of the shard, taken once per shard for
+ * the keys of a multi-key command.
+ *
+ * Either way a multi-key command is atomic on each shard, not
+ * across shards.
+ * Large values removed or overwritten are freed in the background
+ * by a LazyFree shared by the shards.
+ * Thread safe.
+ */
+class ShardedKeyspace {
+public:
+    // Runs with exclusive access to the table of a shard
+    typedef std::function<void(HashTable&)> ShardFn;
+
+    // num_shards 0 means one shard per core
+    ShardedKeyspace(unsigned num_shards = 0,
+                    ks_mode_t mode = KS_SHARE_NOTHING);
+
+    // Stops the workers, after the operations queued to them
+    ~ShardedKeyspace();
+
+    ShardedKeyspace(const ShardedKeyspace& other) = delete;
+    void operator=(const ShardedKeyspace& other) = delete;
+
+    // Run fn on the table of the shard of key.
+    // fn must not call the keyspace itself.
+    void execute(const sstring& key, const ShardFn& fn);
+
+    // Copies the string value of key to val.
+    // Returns false if the key is not present or its value is not
+    // a string or a number.
+    bool get(const sstring& key, sstring& val);
+
+    // Sets the string value of key, see Entry::set_string, and
+    // removes its deadline
+    void set(sstring&& key, sstring&& val);
+
+    // Returns HASH_ERR if the key is not present
+    result_t remove(const sstring& key);
+
+    // Gets the values of keys, like get: vals[i] and found[i]
+    // for keys[i]. Returns the number of keys found.
+    unsigned long mget(const std::vector<sstring>& keys,
+                       std::vector<sstring>& vals,
+                       std::vector<uint8_t>& found);
+
+    // Sets vals[i] for keys[i], taking both, like set
+    void mset(std::vector<sstring>&& keys, std::vector<sstring>&& vals);
+
+    // Returns the number of entries of all the shards
+    unsigned long size();
+
+    // Split a memory limit evenly between the shards,
+    // see HashTable::set_maxmemory
+    void set_maxmemory(size_t maxmemory, evict_policy_t policy = EVICT_LRU);
+
+    // Returns the memory used by all the shards
+    size_t used_memory();
+
+    unsigned num_shards() const noexcept {
+        return m_shards.size();
+    }
+
+    ks_mode_t mode() const noexcept {
+        return m_mode;
+    }
+
+    // Returns the shard of key
+    unsigned shard_of(const sstring& key) const noexcept;
+
+    const LazyFree& lazy_free() const noexcept {
+        return m_lazy_free;
+    }
+
+private:
+    // Counts down the shards a command was sent to
+    class Latch {
+    public:
+        explicit Latch(unsigned count): m_count(count) {}
+
+        void count_down();
+        void wait();
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        unsigned m_count;
+    };
+
+    // An operation queued to a worker, owned by the waiting caller
+    struct Task {
+        const ShardFn* fn;
+        Latch* done;
+    };
+
+    struct Shard {
+        HashTable table;
+        // Locked mode: guards the table.
+        // Share nothing mode: guards the queue.
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<Task> queue;
+        bool stop = false;
+        std::thread worker;
+    };
+
+    // Run fn on shard, counting down done once it ran: in place
+    // in locked mode, on the worker in share nothing mode
+    void dispatch(Shard& shard, const ShardFn& fn, Latch& done);
+
+    // Run fn(i, table of shard i) for every shard i in shards, in
+    // parallel in share nothing mode, and wait for all of them
+    void dispatch_all(const std::vector<unsigned>& shards,
+                      const std::function<void(unsigned, HashTable&)>& fn);
+
+    // Sets by_shard[s] to the indexes of the keys of shard s, and
+    // shards to the shards having keys
+    void group_by_shard(const std::vector<sstring>& keys,
+                        std::vector<std::vector<uint32_t>>& by_shard,
+                        std::vector<unsigned>& shards) const;
+
+    static void worker_loop(Shard* shard);
+
+private:
+    // Outlives the tables, which hand it their values
+    LazyFree m_lazy_free;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    ks_mode_t m_mode;
+};
+
+}; // End namespace hypocampd
+
+#endif
@@ -0,0 +1,71 @@
+#include <cstdio>
+
+#include "cache/memdictor/shared_integers.h"
+
+namespace hypocampd {
+
+// The strings are created on first use and never destroyed, so
+// that they outlive the keyspaces which could be static objects
+static const sstring* shared_integers()
+{
+    static const sstring* table = [] {
+        sstring* t = new sstring[HYPOCAMPD_SHARED_INTEGERS];
+        char buf[24];
+        for (int i = 0; i < HYPOCAMPD_SHARED_INTEGERS; i++) {
+            snprintf(buf, sizeof(buf), "%d", i);
+            t[i] = sstring(buf);
+        }
+        return t;
+    }();
+    return table;
+}
+
+// ===================================================================
+
+const sstring*
+shared_integer(int64_t v) noexcept
+{
+    if (v < 0 || v >= HYPOCAMPD_SHARED_INTEGERS) return nullptr;
+    return &shared_integers()[v];
+}
+
+// ===================================================================
+
+bool
+string_to_int64(const char* s, size_t len, int64_t& v) noexcept
+{
+    const char* end = s + len;
+    bool negative = false;
+
+    if (len == 0 || len > 20) return false;
+    if (*s == '-') {
+        negative = true;
+        if (++s == end) return false;
+    }
+    // "0" is the only number starting with 0, and it has no sign
+    if (*s == '0') {
+        if (len != 1) return false;
+        v = 0;
+        return true;
+    }
+
+    // Accumulate the magnitude, which may be 2^63 for INT64_MIN
+    uint64_t n = 0;
+    for (; s != end; s++) {
+        if (*s < '0' || *s > '9') return false;
+        unsigned digit = *s - '0';
+        if (n > (UINT64_MAX - digit) / 10) return false;
+        n = n * 10 + digit;
+    }
+
+    if (negative) {
+        if (n > uint64_t(INT64_MAX) + 1) return false;
+        v = int64_t(0 - n);
+    } else {
+        if (n > uint64_t(INT64_MAX)) return false;
+        v = int64_t(n);
+    }
+    return true;
+}
+
+}; // End namespace hypocampd
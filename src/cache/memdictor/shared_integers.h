@@ -0,0 +1,40 @@
+#ifndef HYPOCAMPD_SHARED_INTEGERS_H
+#define HYPOCAMPD_SHARED_INTEGERS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cache/memdictor/ds/simple_string/simple_string.h"
+
+// Integers in [0, HYPOCAMPD_SHARED_INTEGERS) have a shared string
+#ifndef HYPOCAMPD_SHARED_INTEGERS
+#define HYPOCAMPD_SHARED_INTEGERS 10000
+#endif
+
+namespace hypocampd {
+
+/*
+ * Integer values of the keyspace.
+ *
+ * Values set as strings which are integers are stored as numbers in
+ * their entry (see Entry::set_string), so they take no memory of
+ * their own. Reading them back as strings needs them formatted,
+ * except for the small integers most values are (flags, counters,
+ * enum values), whose strings are preallocated once for the whole
+ * process. The shared strings are immutable and never freed, so
+ * they are used without any reference count.
+ */
+
+// Returns the shared string of v, or nullptr if v is not
+// in [0, HYPOCAMPD_SHARED_INTEGERS)
+const sstring* shared_integer(int64_t v) noexcept;
+
+// Parses the len bytes of s as an integer written the way it
+// would be formatted back: an optional minus sign and digits
+// without leading zeros, which fit an int64_t.
+// Returns false, leaving v unchanged, otherwise.
+bool string_to_int64(const char* s, size_t len, int64_t& v) noexcept;
+
+}; // End namespace hypocampd
+
+#endif
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+#include "cache/memdictor/abstract_object.h"
+#include "cache/memdictor/ds/simple_string/simple_string.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o aobject_bench aobject_bench.cc ../../../common/mem_pool.cc
+
+/*
+ * Compares AObject with the handle it replaced, a unique_ptr to a
+ * heap holder with a virtual destructor, owning the object through
+ * another unique_ptr, both from global new.
+ * For num_objects int64_t and sstring values, reports the
+ * allocations per object, and the time to create them, to read them
+ * in random order through the cast, and to destroy them.
+ *
+ * usage: aobject_bench [num_objects (default 2M)]
+ */
+
+using namespace hypocampd;
+
+static size_t g_news = 0;
+
+void* operator new(size_t size)
+{
+    g_news++;
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static size_t pool_used()
+{
+    size_t used = 0;
+    for (const MemPoolStats& s : pool_stats()) used += s.used;
+    return used;
+}
+
+struct LegacyAObject {
+    struct BaseHolder {
+        virtual ~BaseHolder() {}
+    };
+
+    template <typename T>
+    struct Holder: public BaseHolder {
+        Holder(T* p): mp_heldobj(p) {}
+        std::unique_ptr<T> mp_heldobj;
+    };
+
+    template <typename T>
+    LegacyAObject(T* p): mp_holder(new Holder<T>(p)) {}
+
+    std::unique_ptr<BaseHolder> mp_holder;
+};
+
+struct Legacy {
+    typedef LegacyAObject handle;
+
+    template <typename T, typename... Args>
+    static handle make(Args&&... args) {
+        return handle(new T(std::forward<Args>(args)...));
+    }
+
+    template <typename T>
+    static T* cast(const handle& o) {
+        return static_cast<handle::Holder<T>*>(
+                   o.mp_holder.get())->mp_heldobj.get();
+    }
+};
+
+struct Current {
+    typedef AObject handle;
+
+    template <typename T, typename... Args>
+    static handle make(Args&&... args) {
+        return make_aobject<T>(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    static T* cast(const handle& o) {
+        return aobj_cast<T>(o);
+    }
+};
+
+static uint64_t value_of(const int64_t* v) { return *v; }
+static uint64_t value_of(const sstring* s) { return s->length(); }
+
+template <typename Mode, typename T, typename Arg>
+static void run(const char* name, const char* type, size_t n, Arg arg)
+{
+    typedef std::chrono::duration<double, std::nano> ns;
+    typedef std::chrono::steady_clock clock;
+    std::vector<typename Mode::handle> objects;
+    objects.reserve(n);
+
+    size_t news = g_news, used = pool_used();
+    auto start = clock::now();
+    for (size_t i = 0; i < n; i++) {
+        objects.push_back(Mode::template make<T>(arg));
+    }
+    double create = ns(clock::now() - start).count() / n;
+    double allocs = double(g_news - news + pool_used() - used) / n;
+
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+    uint64_t sum = 0;
+    start = clock::now();
+    for (uint32_t i : order) {
+        sum += value_of(Mode::template cast<T>(objects[i]));
+    }
+    double read = ns(clock::now() - start).count() / n;
+
+    start = clock::now();
+    objects.clear();
+    double destroy = ns(clock::now() - start).count() / n;
+
+    printf("%-8s %-8s %4.1f allocs, create %5.1f ns, read %5.1f ns, "
+           "destroy %5.1f ns (%lu)\n", name, type, allocs, create, read,
+           destroy, static_cast<unsigned long>(sum % 10));
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+    // Long enough for the sstring to have a heap buffer
+    const char* str = "a string value of 28 bytes..";
+
+    run<Legacy, int64_t>("legacy", "int64_t", n, 42);
+    run<Current, int64_t>("current", "int64_t", n, 42);
+    run<Legacy, sstring>("legacy", "sstring", n, str);
+    run<Current, sstring>("current", "sstring", n, str);
+    return 0;
+}
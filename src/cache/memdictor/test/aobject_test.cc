@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "cache/memdictor/abstract_object.h"
+#include "cache/memdictor/ds/simple_string/simple_string.h"
+#include "common/test/test_check.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o aobject_test aobject_test.cc ../../../common/mem_pool.cc
+
+using namespace hypocampd;
+
+static int alive = 0;
+
+// Fits inline, but needs its move constructor and destructor
+struct Small {
+    explicit Small(int v): p(new int(v)) { alive++; }
+    Small(Small&& o) noexcept: p(o.p) { o.p = nullptr; alive++; }
+    ~Small() { delete p; alive--; }
+    int* p;
+};
+
+// Goes to the pool
+struct Big {
+    explicit Big(int v) { x[0] = v; alive++; }
+    ~Big() { alive--; }
+    long x[8];
+};
+
+void test_inline() {
+    std::cout << "Testing inline objects" << std::endl;
+    static_assert(sizeof(AObject) == 16, "AObject is 16 bytes");
+    static_assert(aobj_is_inline<int64_t>::value, "int64_t inline");
+    static_assert(aobj_is_inline<Small>::value, "Small inline");
+    static_assert(!aobj_is_inline<Big>::value, "Big in the pool");
+    static_assert(!aobj_is_inline<sstring>::value, "sstring in the pool");
+
+    AObject a = make_aobject<int64_t>(42);
+    check(a.type() == AOBJ_INT && *aobj_cast<int64_t>(a) == 42, "int");
+    check(aobj_cast<int>(a) == nullptr, "cast to another type");
+
+    {
+        AObject s = make_aobject<Small>(7);
+        AObject t(std::move(s));
+        check(s.empty() && *aobj_cast<Small>(t)->p == 7, "moved inline");
+        check(alive == 1, "one Small after move");
+        s = std::move(t);
+        check(*aobj_cast<Small>(s)->p == 7, "move assigned inline");
+    }
+    check(alive == 0, "Small destroyed");
+}
+
+void test_pool() {
+    std::cout << "Testing pool objects" << std::endl;
+    AObject s = make_aobject<sstring>("a string too long to be inline");
+    check(s.type() == AOBJ_STRING, "string type");
+    check(s.mem_usage() == pool_block_size(sizeof(sstring)) +
+                           aobj_cast<sstring>(s)->heap_size() &&
+          make_aobject<int64_t>(1).mem_usage() == 0, "memory usage");
+    const char* before = aobj_cast<sstring>(s)->c_str();
+
+    std::vector<AObject> v;
+    v.push_back(std::move(s));
+    v.push_back(make_aobject<Big>(3));
+    v.push_back(make_aobject<Small>(4));
+    v.reserve(100);
+    check(aobj_cast<sstring>(v[0])->c_str() == before,
+          "moving does not move a pool object");
+    check(aobj_cast<Big>(v[1])->x[0] == 3 && v[1].type() == AOBJ_OTHER,
+          "big");
+    check(alive == 2, "alive");
+
+    // Assigning destroys the held object
+    v[1] = make_aobject<Big>(5);
+    check(alive == 2 && aobj_cast<Big>(v[1])->x[0] == 5, "reassigned");
+    v[1].destroy();
+    check(v[1].empty() && v[1].type() == AOBJ_NONE && alive == 1,
+          "destroyed");
+    v[2] = std::move(v[2]);
+    check(*aobj_cast<Small>(v[2])->p == 4, "self move");
+    v.clear();
+    check(alive == 0, "all destroyed");
+}
+
+int main() {
+    test_inline();
+    test_pool();
+
+    return test_result();
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+#include "cache/memdictor/lazy_free.h"
+#include "cache/memdictor/ds/hash_map/hash_map.h"
+#include "cache/memdictor/ds/sorted_set/skip_list.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o lazy_free_bench lazy_free_bench.cc ../lazy_free.cc ../ds/hash_map/hash_map.cc ../shared_integers.cc ../../../common/murmurhash3.cc ../../../common/mem_pool.cc
+
+/*
+ * Latency of small GETs while large sorted sets are deleted, with
+ * the sets freed in place, then in the background by a LazyFree.
+ * A HashTable of 100k small strings and num_big sorted sets of
+ * big_size elements serves GETs arriving every 5 us for 2 seconds,
+ * like the loop of a server, and deletes one set every 200 ms.
+ * The latency of a request counts from its arrival, so that GETs
+ * waiting behind a delete see it.
+ * Reports the latency percentiles of the GETs, the time of the
+ * deletes, and the objects freed in the background.
+ * The thread of the LazyFree needs a core of its own: on a single
+ * core, it takes the time slices of the serving thread.
+ *
+ * usage: lazy_free_bench [big_size (default 200k)] [num_big (10)]
+ */
+
+using namespace hypocampd;
+
+typedef SkipList<int64_t, int64_t> ZList;
+typedef std::chrono::steady_clock Clock;
+
+static const int NUM_SMALL = 100000;
+static const int GET_EVERY_NS = 5000;
+static const int DEL_EVERY_MS = 200;
+
+static sstring make_key(const char* prefix, long i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s:%ld", prefix, i);
+    return sstring(buf);
+}
+
+static void run(const char* name, bool lazy, long big_size, int num_big)
+{
+    LazyFree lf;
+    HashTable ht;
+    if (lazy) ht.set_lazy_free(&lf);
+
+    for (int i = 0; i < NUM_SMALL; i++) {
+        ht.find_or_add(make_key("key", i))->set_string(
+            sstring("a value of 20 bytes."));
+    }
+    std::mt19937_64 gen(3);
+    for (int i = 0; i < num_big; i++) {
+        AObject o = make_aobject<ZList>(16, 0.5f, new int64_t(INT64_MAX));
+        ZList* l = aobj_cast<ZList>(o);
+        for (long j = 0; j < big_size; j++) {
+            l->insert(new int64_t(gen() >> 1), new int64_t(j));
+        }
+        ht.add(make_key("zset", i), std::move(o));
+    }
+
+    std::vector<double> get_us;
+    std::vector<double> del_us;
+    long gets = 2 * 1000000000L / GET_EVERY_NS;
+    long del_every = DEL_EVERY_MS * 1000000L / GET_EVERY_NS;
+    sstring buf;
+    get_us.reserve(gets);
+
+    auto start = Clock::now();
+    for (long i = 0; i < gets; i++) {
+        auto arrival = start + std::chrono::nanoseconds(i * GET_EVERY_NS);
+        while (Clock::now() < arrival) {}
+
+        if (i % del_every == del_every - 1 && i / del_every < num_big) {
+            auto t = Clock::now();
+            ht.remove(make_key("zset", i / del_every));
+            del_us.push_back(std::chrono::duration<double, std::micro>(
+                Clock::now() - t).count());
+        }
+
+        Entry* e = ht.find(make_key("key", gen() % NUM_SMALL));
+        e->get_string(buf);
+        get_us.push_back(std::chrono::duration<double, std::micro>(
+            Clock::now() - arrival).count());
+    }
+
+    while (lf.pending() > 0) std::this_thread::yield();
+    std::sort(get_us.begin(), get_us.end());
+    auto pct = [&](double p) { return get_us[size_t(p * (gets - 1))]; };
+    double del_max = del_us.empty() ? 0 :
+                     *std::max_element(del_us.begin(), del_us.end());
+    printf("%-8s GET p50 %6.1f us, p99 %8.1f us, p99.9 %8.1f us, "
+           "max %8.1f us, delete max %8.1f us, %lu freed lazily\n",
+           name, pct(0.5), pct(0.99), pct(0.999), get_us.back(), del_max,
+           lf.freed());
+}
+
+int main(int argc, char** argv)
+{
+    long big_size = argc > 1 ? strtol(argv[1], nullptr, 10) : 200000;
+    int num_big = argc > 2 ? atoi(argv[2]) : 10;
+
+    printf("%d sorted sets of %ld elements, a GET every %d ns, "
+           "%u cores\n", num_big, big_size, GET_EVERY_NS,
+           std::thread::hardware_concurrency());
+    run("in place", false, big_size, num_big);
+    run("lazy", true, big_size, num_big);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cache/memdictor/lazy_free.h"
+#include "cache/memdictor/sharded_keyspace.h"
+#include "cache/memdictor/ds/sorted_set/skip_list.h"
+#include "common/test/test_check.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o lazy_free_test lazy_free_test.cc ../lazy_free.cc ../sharded_keyspace.cc ../ds/hash_map/hash_map.cc ../shared_integers.cc ../../../common/murmurhash3.cc ../../../common/mem_pool.cc
+
+using namespace hypocampd;
+
+typedef SkipList<int64_t, int64_t> ZList;
+
+static std::atomic<int> alive(0);
+
+// Destroyed with an effort of its choice
+struct Costly {
+    explicit Costly(size_t e): effort(e) { alive++; }
+    ~Costly() { alive--; }
+    size_t effort;
+    long pad[4];
+};
+
+// Found by argument dependent lookup
+size_t aobj_free_effort(const Costly& c) noexcept
+{
+    return c.effort;
+}
+
+static sstring make_key(int i) {
+    return sstring(("key:" + std::to_string(i)).c_str());
+}
+
+static AObject make_zlist(int n) {
+    AObject o = make_aobject<ZList>(16, 0.5f, new int64_t(INT64_MAX));
+    ZList* l = aobj_cast<ZList>(o);
+    for (int i = 0; i < n; i++) l->insert(new int64_t(i), new int64_t(i));
+    return o;
+}
+
+// Wait for the thread to free what was queued
+static void drain(const LazyFree& lf) {
+    for (int i = 0; i < 10000 && lf.pending() > 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void test_skip_list() {
+    std::cout << "Testing skip list" << std::endl;
+    AObject o = make_zlist(1000);
+    ZList* l = aobj_cast<ZList>(o);
+    check(o.type() == AOBJ_SORTED_SET, "sorted set type");
+    check(l->size() == 1000, "size");
+    int64_t k = 500;
+    l->remove(&k);
+    check(l->size() == 999, "size after remove");
+    check(o.free_effort() == 1000, "effort of the nodes");
+    check(o.mem_usage() > 999 * (sizeof(SkipListNode<int64_t, int64_t>) +
+                                 2 * sizeof(int64_t)), "memory");
+}
+
+void test_free() {
+    std::cout << "Testing free" << std::endl;
+    LazyFree lf;
+
+    lf.free(make_aobject<Costly>(LAZY_FREE_THRESHOLD));
+    check(alive == 0 && lf.freed() == 0, "small freed in place");
+    lf.free(AObject());
+    check(lf.freed() == 0, "empty object");
+
+    lf.free(make_aobject<Costly>(LAZY_FREE_THRESHOLD + 1));
+    lf.free(make_zlist(1000));
+    lf.free(make_aobject<sstring>(std::string(1 << 23, 'x').c_str()));
+    drain(lf);
+    check(alive == 0 && lf.freed() == 3, "large freed in the background");
+
+    // Queued ones are freed before the thread stops
+    {
+        LazyFree other;
+        for (int i = 0; i < 100; i++) {
+            other.free(make_aobject<Costly>(LAZY_FREE_THRESHOLD + 1));
+        }
+    }
+    check(alive == 0, "freed on destruction");
+}
+
+// Several threads hand objects over at once
+void test_producers() {
+    std::cout << "Testing producers" << std::endl;
+    LazyFree lf(0);
+    const int num_threads = 4, n = 20000;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&lf] {
+            for (int i = 0; i < n; i++) lf.free(make_aobject<Costly>(1));
+        });
+    }
+    for (auto& t : threads) t.join();
+    drain(lf);
+    check(lf.freed() == num_threads * n && alive == 0, "all freed");
+}
+
+// Removed, replaced, evicted and expired values go to the lazy free
+void test_table() {
+    std::cout << "Testing table" << std::endl;
+    LazyFree lf;
+    HashTable ht;
+    ht.set_lazy_free(&lf);
+
+    for (int i = 0; i < 4; i++) ht.add(make_key(i), make_zlist(100));
+    ht.add(make_key(4), make_aobject<sstring>("small"));
+    ht.remove(make_key(0));
+    ht.replace(make_key(1), make_aobject<sstring>("small"));
+    ht.expire(make_key(2), -1);
+    ht.drop_value(ht.find(make_key(3)));
+    ht.remove(make_key(4));
+    check(ht.size() == 2 && !ht.find(make_key(2)), "unlinked at once");
+    drain(lf);
+    check(lf.freed() == 4, "large values freed in the background");
+
+    ht.add(make_key(5), make_zlist(100));
+    ht.set_maxmemory(1);
+    ht.add_raw(make_key(6));
+    drain(lf);
+    check(lf.freed() == 5, "evicted value");
+}
+
+void test_keyspace() {
+    std::cout << "Testing keyspace" << std::endl;
+    ShardedKeyspace ks(2, KS_SHARE_NOTHING);
+    std::string big(1 << 23, 'x');
+
+    ks.set(make_key(1), sstring(big.c_str()));
+    ks.set(make_key(1), sstring("small"));
+    ks.set(make_key(2), sstring(big.c_str()));
+    check(ks.remove(make_key(2)) == HASH_OK, "remove");
+    drain(ks.lazy_free());
+    check(ks.lazy_free().freed() == 2, "overwritten and removed");
+    sstring val;
+    check(ks.get(make_key(1), val) && val == sstring("small"), "new value");
+}
+
+int main() {
+    test_skip_list();
+    test_free();
+    test_producers();
+    test_table();
+    test_keyspace();
+
+    return test_result();
+}
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+#include "cache/memdictor/sharded_keyspace.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o sharded_bench sharded_bench.cc ../sharded_keyspace.cc ../lazy_free.cc ../ds/hash_map/hash_map.cc ../shared_integers.cc ../../../common/murmurhash3.cc ../../../common/mem_pool.cc
+
+/*
+ * GET/SET throughput of a ShardedKeyspace of num_keys keys, from 1
+ * to max_threads client threads, in both modes.
+ * Clients send batches of batch random keys, 90% with mget and 10%
+ * with mset, for half a second. A batch of 1 key is a plain GET or
+ * SET.
+ * Share nothing mode has one shard and worker per client, locked
+ * mode four shards per client, so that clients seldom wait for
+ * each other's locks.
+ * Reports the keys per second, and the speedup over one client.
+ * Only meaningful with at least twice as many cores as clients in
+ * share nothing mode, and as many in locked mode.
+ *
+ * usage: sharded_bench [max_threads (default cores)] [batch (16)]
+ *                      [num_keys (1M)]
+ */
+
+using namespace hypocampd;
+
+static sstring make_key(unsigned long i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "key:%lu", i);
+    return sstring(buf);
+}
+
+static double run(ks_mode_t mode, unsigned threads, unsigned batch,
+                  unsigned long num_keys)
+{
+    unsigned shards = mode == KS_SHARE_NOTHING ? threads : threads * 4;
+    ShardedKeyspace ks(shards, mode);
+
+    for (unsigned long i = 0; i < num_keys; i += 1000) {
+        std::vector<sstring> keys, vals;
+        for (unsigned long j = i; j < std::min(num_keys, i + 1000); j++) {
+            keys.push_back(make_key(j));
+            vals.push_back(sstring("a value of 20 bytes."));
+        }
+        ks.mset(std::move(keys), std::move(vals));
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long> total(0);
+    std::vector<std::thread> clients;
+    for (unsigned t = 0; t < threads; t++) {
+        clients.emplace_back([&, t] {
+            std::mt19937_64 gen(t);
+            std::vector<sstring> keys, vals;
+            std::vector<uint8_t> found;
+            unsigned long done = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                keys.clear();
+                for (unsigned i = 0; i < batch; i++) {
+                    keys.push_back(make_key(gen() % num_keys));
+                }
+                if (gen() % 10 == 0) {
+                    vals.assign(batch, sstring("a new value, 20 bytes"));
+                    ks.mset(std::move(keys), std::move(vals));
+                } else {
+                    ks.mget(keys, vals, found);
+                }
+                done += batch;
+            }
+            total += done;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    stop = true;
+    for (auto& c : clients) c.join();
+    std::chrono::duration<double> secs =
+        std::chrono::steady_clock::now() - start;
+
+    return total / secs.count();
+}
+
+int main(int argc, char** argv)
+{
+    unsigned max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) :
+                           std::max(1U, std::thread::hardware_concurrency());
+    unsigned batch = argc > 2 ? strtoul(argv[2], nullptr, 10) : 16;
+    unsigned long num_keys = argc > 3 ? strtoul(argv[3], nullptr, 10) :
+                             1000000;
+
+    printf("%lu keys, batches of %u, %u cores\n", num_keys, batch,
+           std::thread::hardware_concurrency());
+    const char* names[] = {"share nothing", "locked"};
+    for (ks_mode_t mode : {KS_SHARE_NOTHING, KS_LOCKED}) {
+        double base = 0;
+        for (unsigned t = 1; t <= max_threads; t *= 2) {
+            double rate = run(mode, t, batch, num_keys);
+            if (t == 1) base = rate;
+            printf("%-13s %2u clients %6.2f M keys/s, x%.2f\n",
+                   names[mode], t, rate / 1e6, rate / base);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cache/memdictor/sharded_keyspace.h"
+#include "common/test/test_check.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o sharded_keyspace_test sharded_keyspace_test.cc ../sharded_keyspace.cc ../lazy_free.cc ../ds/hash_map/hash_map.cc ../shared_integers.cc ../../../common/murmurhash3.cc ../../../common/mem_pool.cc
+
+using namespace hypocampd;
+
+static sstring make_key(int i) {
+    return sstring(("key:" + std::to_string(i)).c_str());
+}
+
+static sstring make_val(int i) {
+    return sstring(("val:" + std::to_string(i)).c_str());
+}
+
+void test_commands(ks_mode_t mode) {
+    std::cout << "Testing commands" << std::endl;
+    ShardedKeyspace ks(4, mode);
+    sstring val;
+
+    ks.set(make_key(1), make_val(1));
+    ks.set(make_key(2), sstring("42"));
+    check(ks.get(make_key(1), val) && val == make_val(1), "get string");
+    check(ks.get(make_key(2), val) && val == sstring("42"), "get int");
+    check(!ks.get(make_key(3), val), "get missing");
+    check(ks.remove(make_key(1)) == HASH_OK, "remove");
+    check(ks.remove(make_key(1)) == HASH_ERR, "remove missing");
+
+    ks.execute(make_key(2), [](HashTable& t) {
+        t.incr_by(make_key(2), 8);
+    });
+    check(ks.get(make_key(2), val) && val == sstring("50"), "execute");
+
+    // set drops the deadline
+    int64_t ttl = 0;
+    ks.execute(make_key(2), [](HashTable& t) { t.expire(make_key(2), 1000); });
+    ks.set(make_key(2), sstring("51"));
+    ks.execute(make_key(2), [&](HashTable& t) { ttl = t.ttl(make_key(2)); });
+    check(ttl == -1, "set drops the deadline");
+
+    std::vector<sstring> keys, vals;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(make_key(i));
+        vals.push_back(make_val(i));
+    }
+    ks.mset(std::move(keys), std::move(vals));
+    check(ks.size() == 1000, "size after mset");
+
+    keys.clear();
+    for (int i = 500; i < 1500; i++) keys.push_back(make_key(i));
+    std::vector<uint8_t> found;
+    check(ks.mget(keys, vals, found) == 500, "mget found");
+    bool right = vals.size() == 1000;
+    for (int i = 0; i < 1000 && right; i++) {
+        right = found[i] == (i < 500) && (i >= 500 || vals[i] ==
+                                          make_val(i + 500));
+    }
+    check(right, "mget values");
+
+    // Every shard may go over its part by the entry it last set
+    size_t limit = ks.used_memory() / 2;
+    ks.set_maxmemory(limit);
+    for (int i = 1000; i < 5000; i++) ks.set(make_key(i), make_val(i));
+    check(ks.used_memory() <= limit + ks.num_shards() * 200,
+          "memory limit");
+
+    // Less than a byte per shard still evicts everything
+    ks.set_maxmemory(ks.num_shards() - 1);
+    check(ks.size() == 0, "tiny memory limit");
+}
+
+// Shards get about the same number of keys
+void test_spread() {
+    std::cout << "Testing spread" << std::endl;
+    ShardedKeyspace ks(7, KS_LOCKED);
+    std::vector<int> counts(ks.num_shards());
+    const int n = 70000;
+    for (int i = 0; i < n; i++) counts[ks.shard_of(make_key(i))]++;
+    bool even = true;
+    for (int c : counts) even &= c > n / 7 * 9 / 10 && c < n / 7 * 11 / 10;
+    check(even, "even spread");
+}
+
+// Threads increment the same counters and set their own keys
+void test_threads(ks_mode_t mode) {
+    std::cout << "Testing threads" << std::endl;
+    ShardedKeyspace ks(4, mode);
+    const int num_threads = 4, n = 20000;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&ks, t] {
+            for (int i = 0; i < n; i++) {
+                sstring counter = make_key(i % 100);
+                ks.execute(counter, [&counter](HashTable& ht) {
+                    ht.incr_by(std::move(counter), 1);
+                });
+                ks.set(make_key(1000 + t * n + i), make_val(i));
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    check(ks.size() == 100 + num_threads * n, "size");
+    bool counted = true;
+    sstring val;
+    for (int i = 0; i < 100; i++) {
+        counted &= ks.get(make_key(i), val) &&
+                   val == sstring(std::to_string(num_threads * n / 100)
+                                  .c_str());
+    }
+    check(counted, "no lost increments");
+    check(ks.get(make_key(1000 + 3 * n + 7), val) && val == make_val(7),
+          "thread key");
+}
+
+// get and mget copy into strings the caller reuses, which may hold
+// a heap string when the value is short, and the other way round
+void test_reuse_val(ks_mode_t mode) {
+    std::cout << "Testing reused values" << std::endl;
+    ShardedKeyspace ks(2, mode);
+    sstring heap("a value of more than fifteen bytes, on the heap");
+
+    ks.set(make_key(1), sstring(heap));
+    ks.set(make_key(2), sstring("short"));
+    sstring val;
+    check(ks.get(make_key(1), val) && val == heap, "get heap");
+    check(ks.get(make_key(2), val) && val == sstring("short"),
+          "get short into heap");
+    check(ks.get(make_key(1), val) && val == heap, "get heap into short");
+
+    // Integers not shared are formatted into a string moved into val
+    ks.set(make_key(3), sstring("-5"));
+    ks.set(make_key(4), sstring("123456"));
+    check(ks.get(make_key(2), val) && ks.get(make_key(1), val) &&
+          ks.get(make_key(3), val) && val == sstring("-5") &&
+          val.heap_size() == 0, "get integer into heap");
+    check(ks.get(make_key(2), val) && ks.get(make_key(4), val) &&
+          val == sstring("123456"), "get integer into short");
+
+    std::vector<sstring> keys, vals;
+    std::vector<uint8_t> found;
+    keys.push_back(make_key(1));
+    keys.push_back(make_key(2));
+    check(ks.mget(keys, vals, found) == 2, "mget");
+    std::swap(keys[0], keys[1]);
+    check(ks.mget(keys, vals, found) == 2 && vals[0] == sstring("short") &&
+          vals[1] == heap, "mget reused");
+}
+
+int main() {
+    std::cout << "Share nothing" << std::endl;
+    test_commands(KS_SHARE_NOTHING);
+    test_reuse_val(KS_SHARE_NOTHING);
+    test_threads(KS_SHARE_NOTHING);
+
+    std::cout << "Locked" << std::endl;
+    test_commands(KS_LOCKED);
+    test_reuse_val(KS_LOCKED);
+    test_threads(KS_LOCKED);
+
+    test_spread();
+
+    return test_result();
+}
@@ -0,0 +1,363 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <set>
+
+#include "common/mem_pool.h"
+#include "common/spin_lock.h"
+
+namespace hypocampd {
+
+#if HYPOCAMPD_POOL_ALLOC
+
+#define MEM_POOL_CLASSES 12
+
+// Returns the size class of an allocation of size bytes
+static inline int size_class(size_t size)
+{
+    if (size <= 128) return size == 0 ? 0 : (size - 1) / 16;
+    return 8 + (size - 129) / 32;
+}
+
+// Returns the block size of size class cls
+static inline size_t class_size(int cls)
+{
+    if (cls < 8) return (cls + 1) * 16;
+    return 128 + (cls - 7) * 32;
+}
+
+// A free block, chained to the next free one
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+/*
+ * SizeClass: The slabs and the free blocks of one size class.
+ * All members are protected by m_lock.
+ */
+struct SizeClass {
+    SpinLock m_lock;
+    FreeBlock* mp_free = nullptr;
+    // Rest of the last slab, not carved into blocks yet
+    char* mp_bump = nullptr;
+    char* mp_bump_end = nullptr;
+
+    size_t m_slabs  = 0;
+    size_t m_blocks = 0;
+    // Blocks in thread caches or allocated
+    size_t m_out = 0;
+    // Bytes requested by threads which have exited and by
+    // frees done without a thread cache
+    long m_requested = 0;
+
+    // Returns a free block, carving it out of a new slab if needed
+    void* get(size_t block_size) {
+        if (mp_free) {
+            FreeBlock* b = mp_free;
+            mp_free = b->next;
+            m_out++;
+            return b;
+        }
+        if (mp_bump + block_size > mp_bump_end) {
+            char* slab = static_cast<char*>(malloc(MEM_POOL_SLAB_SIZE));
+            if (!slab) return nullptr;
+            mp_bump = slab;
+            mp_bump_end = slab + MEM_POOL_SLAB_SIZE;
+            m_slabs++;
+        }
+        void* b = mp_bump;
+        mp_bump += block_size;
+        m_blocks++;
+        m_out++;
+        return b;
+    }
+
+    void put(void* p) {
+        FreeBlock* b = static_cast<FreeBlock*>(p);
+        b->next = mp_free;
+        mp_free = b;
+        m_out--;
+    }
+};
+
+// Size classes are never destroyed, so that blocks can still be
+// freed by the destructors of static objects
+static SizeClass* size_classes()
+{
+    static SizeClass* classes = new SizeClass[MEM_POOL_CLASSES];
+    return classes;
+}
+
+/*
+ * ThreadCache: Free blocks kept by a thread, per size class.
+ * Only the owning thread changes the counters, pool_stats reads
+ * them from other threads, hence the relaxed atomics.
+ */
+struct ThreadCache {
+    ThreadCache();
+    ~ThreadCache();
+
+    // Moves a batch of blocks from size class cls to the cache
+    bool refill(int cls);
+
+    // Gives a batch of blocks of the cache back to size class cls
+    void flush(int cls, unsigned n);
+
+    static void add(std::atomic<long>& counter, long n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n,
+                      std::memory_order_relaxed);
+    }
+
+    FreeBlock* mp_free[MEM_POOL_CLASSES] = {};
+    std::atomic<long> m_count[MEM_POOL_CLASSES];
+    std::atomic<long> m_requested[MEM_POOL_CLASSES];
+};
+
+// The caches of the running threads
+struct CacheRegistry {
+    std::mutex m_lock;
+    std::set<ThreadCache*> m_caches;
+};
+
+static CacheRegistry* cache_registry()
+{
+    static CacheRegistry* registry = new CacheRegistry;
+    return registry;
+}
+
+// Set once the cache of the thread is destroyed, after which
+// its blocks go straight to the size classes
+static thread_local bool t_cache_gone = false;
+
+static ThreadCache* thread_cache()
+{
+    if (t_cache_gone) return nullptr;
+    static thread_local ThreadCache cache;
+    return &cache;
+}
+
+// ===================================================================
+
+ThreadCache::ThreadCache()
+{
+    for (int i = 0; i < MEM_POOL_CLASSES; i++) {
+        m_count[i].store(0, std::memory_order_relaxed);
+        m_requested[i].store(0, std::memory_order_relaxed);
+    }
+    CacheRegistry* r = cache_registry();
+    std::lock_guard<std::mutex> guard(r->m_lock);
+    r->m_caches.insert(this);
+}
+
+// ===================================================================
+
+ThreadCache::~ThreadCache()
+{
+    CacheRegistry* r = cache_registry();
+    std::lock_guard<std::mutex> guard(r->m_lock);
+
+    for (int i = 0; i < MEM_POOL_CLASSES; i++) {
+        flush(i, m_count[i].load(std::memory_order_relaxed));
+
+        SizeClass& sc = size_classes()[i];
+        std::lock_guard<SpinLock> sc_guard(sc.m_lock);
+        sc.m_requested += m_requested[i].load(std::memory_order_relaxed);
+    }
+    r->m_caches.erase(this);
+    t_cache_gone = true;
+}
+
+// ===================================================================
+
+bool
+ThreadCache::refill(int cls)
+{
+    SizeClass& sc = size_classes()[cls];
+    size_t block_size = class_size(cls);
+    long n = 0;
+
+    std::lock_guard<SpinLock> guard(sc.m_lock);
+    for (; n < MEM_POOL_BATCH; n++) {
+        FreeBlock* b = static_cast<FreeBlock*>(sc.get(block_size));
+        if (!b) break;
+        b->next = mp_free[cls];
+        mp_free[cls] = b;
+    }
+    add(m_count[cls], n);
+
+    return n > 0;
+}
+
+// ===================================================================
+
+void
+ThreadCache::flush(int cls, unsigned n)
+{
+    SizeClass& sc = size_classes()[cls];
+
+    std::lock_guard<SpinLock> guard(sc.m_lock);
+    for (unsigned i = 0; i < n && mp_free[cls]; i++) {
+        FreeBlock* b = mp_free[cls];
+        mp_free[cls] = b->next;
+        sc.put(b);
+        add(m_count[cls], -1);
+    }
+}
+
+#endif // HYPOCAMPD_POOL_ALLOC
+
+// ===================================================================
+
+void*
+pool_alloc(size_t size)
+{
+#if HYPOCAMPD_POOL_ALLOC
+    if (size <= MEM_POOL_MAX_BLOCK) {
+        int cls = size_class(size);
+        ThreadCache* c = thread_cache();
+
+        if (!c) {
+            SizeClass& sc = size_classes()[cls];
+            std::lock_guard<SpinLock> guard(sc.m_lock);
+            void* p = sc.get(class_size(cls));
+            if (!p) throw std::bad_alloc();
+            sc.m_requested += size;
+            return p;
+        }
+
+        if (!c->mp_free[cls] && !c->refill(cls)) throw std::bad_alloc();
+
+        FreeBlock* b = c->mp_free[cls];
+        c->mp_free[cls] = b->next;
+        ThreadCache::add(c->m_count[cls], -1);
+        ThreadCache::add(c->m_requested[cls], size);
+        return b;
+    }
+#endif
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+// ===================================================================
+
+void
+pool_free(void* p, size_t size) noexcept
+{
+    if (!p) return;
+
+#if HYPOCAMPD_POOL_ALLOC
+    if (size <= MEM_POOL_MAX_BLOCK) {
+        int cls = size_class(size);
+        ThreadCache* c = thread_cache();
+
+        if (!c) {
+            SizeClass& sc = size_classes()[cls];
+            std::lock_guard<SpinLock> guard(sc.m_lock);
+            sc.put(p);
+            sc.m_requested -= size;
+            return;
+        }
+
+        FreeBlock* b = static_cast<FreeBlock*>(p);
+        b->next = c->mp_free[cls];
+        c->mp_free[cls] = b;
+        ThreadCache::add(c->m_requested[cls], -long(size));
+
+        // Keep a batch for the next allocations,
+        // give the rest back for other threads
+        long count = c->m_count[cls].load(std::memory_order_relaxed) + 1;
+        ThreadCache::add(c->m_count[cls], 1);
+        if (count >= 2 * MEM_POOL_BATCH) c->flush(cls, MEM_POOL_BATCH);
+        return;
+    }
+#endif
+    free(p);
+}
+
+// ===================================================================
+
+size_t
+pool_block_size(size_t size) noexcept
+{
+#if HYPOCAMPD_POOL_ALLOC
+    if (size <= MEM_POOL_MAX_BLOCK) return class_size(size_class(size));
+#endif
+    return size;
+}
+
+// ===================================================================
+
+std::vector<MemPoolStats>
+pool_stats()
+{
+#if !HYPOCAMPD_POOL_ALLOC
+    return std::vector<MemPoolStats>();
+#else
+    std::vector<MemPoolStats> stats(MEM_POOL_CLASSES);
+    CacheRegistry* r = cache_registry();
+    std::lock_guard<std::mutex> guard(r->m_lock);
+
+    for (int i = 0; i < MEM_POOL_CLASSES; i++) {
+        SizeClass& sc = size_classes()[i];
+        long cached = 0;
+        long requested = 0;
+        {
+            std::lock_guard<SpinLock> sc_guard(sc.m_lock);
+            stats[i].slabs  = sc.m_slabs;
+            stats[i].blocks = sc.m_blocks;
+            cached    = sc.m_out;
+            requested = sc.m_requested;
+        }
+        // Blocks out of the size class but still free in a cache
+        for (ThreadCache* c : r->m_caches) {
+            cached    -= c->m_count[i].load(std::memory_order_relaxed);
+            requested += c->m_requested[i].load(std::memory_order_relaxed);
+        }
+        stats[i].block_size = class_size(i);
+        stats[i].used       = cached;
+        stats[i].requested  = requested;
+    }
+
+    return stats;
+#endif
+}
+
+// ===================================================================
+
+void
+pool_report(std::ostream& os)
+{
+    size_t reserved = 0, used = 0, requested = 0;
+    char line[128];
+
+    os << "block   slabs     blocks       used  occupancy  internal\n";
+    for (const MemPoolStats& s : pool_stats()) {
+        if (s.slabs == 0) continue;
+
+        reserved  += s.slabs * MEM_POOL_SLAB_SIZE;
+        used      += s.used * s.block_size;
+        requested += s.requested;
+
+        // Occupancy: used blocks out of the carved ones.
+        // Internal: bytes of the used blocks lost to rounding.
+        snprintf(line, sizeof(line),
+                 "%5zu %7zu %10zu %10zu %9.1f%% %8.1f%%\n",
+                 s.block_size, s.slabs, s.blocks, s.used,
+                 s.blocks ? 100.0 * s.used / s.blocks : 0.0,
+                 s.used ? 100.0 - 100.0 * s.requested /
+                              (s.used * s.block_size) : 0.0);
+        os << line;
+    }
+    snprintf(line, sizeof(line),
+             "reserved %zu bytes, in used blocks %zu, requested %zu, "
+             "fragmentation %.1f%%\n",
+             reserved, used, requested,
+             reserved ? 100.0 - 100.0 * requested / reserved : 0.0);
+    os << line;
+}
+
+}; // End namespace hypocampd
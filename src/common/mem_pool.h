@@ -0,0 +1,83 @@
+#ifndef HYPOCAMPD_MEM_POOL_H
+#define HYPOCAMPD_MEM_POOL_H
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+// Set to 0 to make pool_alloc and pool_free plain malloc and free,
+// to compare against malloc or to run memory checkers
+#ifndef HYPOCAMPD_POOL_ALLOC
+#define HYPOCAMPD_POOL_ALLOC 1
+#endif
+
+#define MEM_POOL_SLAB_SIZE (64 * 1024)
+#define MEM_POOL_MAX_BLOCK 256 // Larger allocations go to malloc
+
+// Number of blocks a thread cache gets from, or gives back to,
+// its size class at once
+#define MEM_POOL_BATCH 32
+
+namespace hypocampd {
+
+/*
+ * Memory pool for the small, fixed size allocations of the keyspace:
+ * entries, object holders and string buffers.
+ *
+ * Sizes up to MEM_POOL_MAX_BLOCK are rounded up to one of a few size
+ * classes (every 16 bytes up to 128, then every 32). Each size class
+ * carves blocks out of 64KB slabs and chains the free ones. Every
+ * thread keeps a small cache of free blocks per size class, so that
+ * allocating and freeing only takes the lock of the size class once
+ * every MEM_POOL_BATCH blocks. A block may be freed by another thread
+ * than the one which allocated it.
+ *
+ * Slabs are never given back to the system: a size class keeps the
+ * memory of its peak usage, which pool_stats shows as free blocks.
+ */
+
+// Allocate size bytes.
+// Throws std::bad_alloc if there is no memory left.
+void* pool_alloc(size_t size);
+
+// Free p, allocated with pool_alloc with the same size
+void pool_free(void* p, size_t size) noexcept;
+
+// Returns the bytes an allocation of size bytes takes: the block
+// size of its size class, or size if it goes to malloc
+size_t pool_block_size(size_t size) noexcept;
+
+struct MemPoolStats {
+    size_t block_size = 0;
+    size_t slabs      = 0; // Slabs of the size class
+    size_t blocks     = 0; // Blocks carved out of the slabs
+    size_t used       = 0; // Blocks allocated
+    size_t requested  = 0; // Bytes asked for in the used blocks
+};
+
+// Returns the stats of every size class
+std::vector<MemPoolStats> pool_stats();
+
+// Print the occupancy and fragmentation of every size class
+// in use, and of the whole pool
+void pool_report(std::ostream& os);
+
+/*
+ * PoolAllocated: Base class to allocate the objects of the derived
+ * class with the pool. Deleting through a base class pointer needs
+ * a virtual destructor, which makes the compiler pass the size of
+ * the most derived class.
+ */
+struct PoolAllocated {
+    static void* operator new(size_t size) {
+        return pool_alloc(size);
+    }
+
+    static void operator delete(void* p, size_t size) noexcept {
+        pool_free(p, size);
+    }
+};
+
+}; // End namespace hypocampd
+
+#endif
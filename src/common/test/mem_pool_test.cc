@@ -0,0 +1,125 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "common/mem_pool.h"
+#include "common/test/test_check.h"
+
+// g++ -std=c++11 -O2 -pthread -I <hypocampd>/src -o mem_pool_test mem_pool_test.cc ../mem_pool.cc
+
+using namespace hypocampd;
+
+// Without the pool there are no stats to check
+static void check_stats(bool cond, const char* what) {
+    if (!pool_stats().empty()) check(cond, what);
+}
+
+static size_t used_blocks() {
+    size_t used = 0;
+    for (const MemPoolStats& s : pool_stats()) used += s.used;
+    return used;
+}
+
+static size_t requested_bytes() {
+    size_t requested = 0;
+    for (const MemPoolStats& s : pool_stats()) requested += s.requested;
+    return requested;
+}
+
+struct Node: public PoolAllocated {
+    virtual ~Node() {}
+    char data[24];
+};
+
+struct BigNode: public Node {
+    char more[100];
+};
+
+// Blocks of every size class keep their content, and are
+// counted while allocated
+void test_sizes() {
+    std::cout << "Testing sizes" << std::endl;
+    std::vector<char*> blocks;
+    size_t used = used_blocks();
+
+    for (size_t size = 0; size <= MEM_POOL_MAX_BLOCK + 64; size++) {
+        char* p = static_cast<char*>(pool_alloc(size));
+        memset(p, int(size & 0xff), size);
+        blocks.push_back(p);
+    }
+    check_stats(used_blocks() == used + MEM_POOL_MAX_BLOCK + 1,
+                "used blocks");
+
+    for (size_t size = 0; size < blocks.size(); size++) {
+        bool same = true;
+        for (size_t i = 0; i < size; i++) {
+            same &= blocks[size][i] == char(size & 0xff);
+        }
+        check(same, "block content");
+        pool_free(blocks[size], size);
+    }
+    check_stats(used_blocks() == used, "freed blocks");
+}
+
+// Deleting through a base class gives back the size of the
+// derived class
+void test_class() {
+    std::cout << "Testing PoolAllocated" << std::endl;
+    size_t requested = requested_bytes();
+
+    Node* a = new Node;
+    Node* b = new BigNode;
+    check_stats(requested_bytes() ==
+                requested + sizeof(Node) + sizeof(BigNode),
+                "requested bytes");
+    delete a;
+    delete b;
+    check_stats(requested_bytes() == requested, "freed bytes");
+}
+
+// Blocks allocated by one thread and freed by another, and
+// the caches of exited threads given back
+void test_threads() {
+    std::cout << "Testing threads" << std::endl;
+    const int num_threads = 4;
+    const int per_thread = 100000;
+    std::vector<std::vector<void*>> blocks(num_threads);
+    size_t used = used_blocks();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&blocks, t]() {
+                for (int i = 0; i < per_thread; i++) {
+                    blocks[t].push_back(pool_alloc(40));
+                }
+            });
+    }
+    for (auto& t : threads) t.join();
+    threads.clear();
+    check_stats(used_blocks() == used + num_threads * per_thread,
+                "used after allocating threads");
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&blocks, t]() {
+                for (void* p : blocks[(t + 1) % num_threads]) {
+                    pool_free(p, 40);
+                }
+            });
+    }
+    for (auto& t : threads) t.join();
+    check_stats(used_blocks() == used, "used after freeing threads");
+
+    std::ostringstream report;
+    pool_report(report);
+    check(report.str().find("fragmentation") != std::string::npos,
+          "report");
+}
+
+int main() {
+    test_sizes();
+    test_class();
+    test_threads();
+
+    return test_result();
+}
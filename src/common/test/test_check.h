@@ -0,0 +1,25 @@
+#ifndef HYPOCAMPD_TEST_CHECK_H
+#define HYPOCAMPD_TEST_CHECK_H
+
+#include <iostream>
+
+// The checks of the unit tests: check() reports a condition that does
+// not hold and goes on, and main ends with return test_result().
+// Each test is a program of its own, so the state is per file.
+
+static bool failed = false;
+
+static void check(bool cond, const char* what) {
+    if (!cond) {
+        std::cout << "FAILED: " << what << std::endl;
+        failed = true;
+    }
+}
+
+// Prints the verdict, and returns the exit status of the test
+static int test_result() {
+    std::cout << (failed ? "FAILED" : "PASSED") << std::endl;
+    return failed ? 1 : 0;
+}
+
+#endif